@@ -0,0 +1,56 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPLR_HASH_H
+#define CPLR_HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "attr.h"
+
+/* length of a hex digest including terminator */
+#define CEXT_HASH_HEXLEN 17
+
+/* hash state (FNV-1a, 64 bits) */
+typedef struct {
+  uint64_t h;
+} cext_hash_t;
+
+/* initialize hash state */
+CEXT_FUNC_ARG_NONNULL(1)
+extern void cext_hash_init(cext_hash_t *h);
+
+/* hash a block of memory */
+CEXT_FUNC_ARG_NONNULL(1)
+extern void cext_hash_update(cext_hash_t *h, const void *buf, size_t len);
+
+/* hash a string including its terminator */
+CEXT_FUNC_ARG_NONNULL(1)
+extern void cext_hash_str(cext_hash_t *h, const char *s);
+
+/* hash an integer */
+CEXT_FUNC_ARG_NONNULL(1)
+extern void cext_hash_u64(cext_hash_t *h, uint64_t v);
+
+/* format the digest as hex into BUF */
+CEXT_FUNC_ARG_NONNULL(1,2)
+extern char *cext_hash_hex(cext_hash_t *h, char buf[CEXT_HASH_HEXLEN]);
+
+#endif /* !CPLR_HASH_H */
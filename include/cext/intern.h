@@ -0,0 +1,44 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPLR_INTERN_H
+#define CPLR_INTERN_H
+
+#include <stddef.h>
+
+#include "attr.h"
+
+/*
+ * Interned strings live as long as the process. Equal strings are
+ * interned to the same copy, so they compare equal as pointers.
+ */
+
+/* get the interned copy of a string */
+CEXT_FUNC_RETURNS_NONNULL
+CEXT_FUNC_ARG_NONNULL(1)
+extern const char *cext_intern(const char *s);
+
+/* get the interned copy of a string if there is one */
+CEXT_FUNC_ARG_NONNULL(1)
+extern const char *cext_intern_find(const char *s);
+
+/* number and size of interned strings */
+extern void cext_intern_stats(size_t *count, size_t *bytes);
+
+#endif /* !CPLR_INTERN_H */
@@ -82,6 +82,14 @@ extern void l_append_str_owned(lh_t *lh, char *s);
 CEXT_FUNC_ARG_NONNULL(1,2)
 extern void l_append_str_static(lh_t *lh, const char *s);
 
+/* move all nodes of SRC to the end of DST */
+CEXT_FUNC_ARG_NONNULL(1,2)
+extern void l_splice(lh_t *dst, lh_t *src);
+
+/* find a node with the given string */
+CEXT_FUNC_ARG_NONNULL(1,2)
+extern ln_t *l_find_str(lh_t *lh, const char *s);
+
 #define L_FORWARD(_lhp, _i) \
   for((_i) = ((_lhp)->f); (_i); (_i) = (_i)->n)
 
@@ -58,4 +58,47 @@ extern void cext_xptrfree(void **p);
 
 extern void cext_lptrfree(void **p);
 
+CEXT_FUNC_MALLOC
+CEXT_FUNC_RETURNS_NONNULL
+CEXT_FUNC_ARG_NONNULL(1)
+extern char *cext_strdup(const char *s);
+
+CEXT_FUNC_MALLOC
+CEXT_FUNC_RETURNS_NONNULL
+CEXT_FUNC_ARG_NONNULL(1)
+extern char *cext_strndup(const char *s, size_t n);
+
+/* counts of allocations made through these functions */
+extern void cext_memory_stats(unsigned long *allocs, unsigned long *bytes);
+
+/* arena for objects that are freed all at once */
+typedef struct cext_arena cext_arena_t;
+
+CEXT_FUNC_RETURNS_NONNULL
+extern cext_arena_t *cext_arena_new(size_t chunk);
+
+/* take another reference, dropped with cext_arena_free */
+CEXT_FUNC_RETURNS_NONNULL
+CEXT_FUNC_ARG_NONNULL(1)
+extern cext_arena_t *cext_arena_ref(cext_arena_t *a);
+
+/* drop a reference, freeing the arena with the last one */
+CEXT_FUNC_ARG_NONNULL(1)
+extern void cext_arena_free(cext_arena_t *a);
+
+/* zeroed memory from the arena */
+CEXT_FUNC_MALLOC
+CEXT_FUNC_RETURNS_NONNULL
+CEXT_FUNC_ARG_NONNULL(1)
+CEXT_FUNC_ARG_ALLOC_SIZE(2)
+extern void *cext_arena_alloc(cext_arena_t *a, size_t s);
+
+CEXT_FUNC_RETURNS_NONNULL
+CEXT_FUNC_ARG_NONNULL(1, 2)
+extern char *cext_arena_strdup(cext_arena_t *a, const char *s);
+
+/* bytes handed out by the arena */
+CEXT_FUNC_ARG_NONNULL(1)
+extern size_t cext_arena_size(cext_arena_t *a);
+
 #endif /* !CPLR_MEMORY_H */
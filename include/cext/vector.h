@@ -0,0 +1,111 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef CPLR_VECTOR_H
+#define CPLR_VECTOR_H
+
+#include "attr.h"
+#include "memory.h"
+#include "value.h"
+
+/* vector head */
+typedef struct vh vh_t;
+
+/* structure of vector head */
+struct vh {
+  size_t c;
+  size_t n;
+  value_t *v;
+  /* arena for elements and strings (heap if NULL) */
+  cext_arena_t *a;
+  /* arena of elements shared with other vectors (copied on write) */
+  cext_arena_t *s;
+};
+
+/* initialize vector as empty */
+CEXT_FUNC_ARG_NONNULL(1)
+static inline void v_init(vh_t *vh) {
+  vh->c = 0; vh->n = 0; vh->v = NULL; vh->a = NULL; vh->s = NULL;
+}
+
+/* initialize vector as empty, allocating from an arena */
+CEXT_FUNC_ARG_NONNULL(1,2)
+static inline void v_init_arena(vh_t *vh, cext_arena_t *a) {
+  vh->c = 0; vh->n = 0; vh->v = NULL; vh->a = a; vh->s = NULL;
+}
+
+/* check if vector is empty */
+CEXT_FUNC_PURE
+CEXT_FUNC_ARG_NONNULL(1)
+static inline bool v_empty(vh_t *vh) {
+  return vh->c == 0;
+}
+
+/* get length of vector */
+CEXT_FUNC_PURE
+CEXT_FUNC_ARG_NONNULL(1)
+static inline size_t v_size(vh_t *vh) {
+  return vh->c;
+}
+
+/* check if a vector shares its elements */
+CEXT_FUNC_PURE
+CEXT_FUNC_ARG_NONNULL(1)
+static inline bool v_shared(vh_t *vh) {
+  return vh->s != NULL;
+}
+
+/* clear the vector */
+CEXT_FUNC_ARG_NONNULL(1)
+extern void v_clear(vh_t *vh);
+
+/* clone a vector */
+CEXT_FUNC_ARG_NONNULL(1,2)
+extern void v_clone(vh_t *vsrc, vh_t *vdst);
+
+/* share the elements of an arena vector, both copy on their next write */
+CEXT_FUNC_ARG_NONNULL(1,2)
+extern void v_share(vh_t *vsrc, vh_t *vdst);
+
+CEXT_FUNC_ARG_NONNULL(1,2)
+extern void v_append_str(vh_t *vh, char *s);
+CEXT_FUNC_ARG_NONNULL(1,2)
+extern void v_append_str_owned(vh_t *vh, char *s);
+CEXT_FUNC_ARG_NONNULL(1,2)
+extern void v_append_str_static(vh_t *vh, const char *s);
+
+/* append the interned string unless it is present, comparing pointers */
+CEXT_FUNC_ARG_NONNULL(1,2)
+extern bool v_append_str_unique(vh_t *vh, const char *s);
+
+/* move all elements of SRC to the end of DST */
+CEXT_FUNC_ARG_NONNULL(1,2)
+extern void v_splice(vh_t *dst, vh_t *src);
+
+/* find an element with the given string */
+CEXT_FUNC_ARG_NONNULL(1,2)
+extern value_t *v_find_str(vh_t *vh, const char *s);
+
+#define V_FORWARD(_vhp, _i) \
+  for((_i) = (_vhp)->v; (_i) < (_vhp)->v + (_vhp)->c; (_i)++)
+
+#define V_BACKWARDS(_vhp, _i) \
+  for((_i) = (_vhp)->v + (_vhp)->c; (_i) > (_vhp)->v && ((_i)--, 1); )
+
+#endif /* !CPLR_VECTOR_H */
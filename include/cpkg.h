@@ -22,8 +22,22 @@
 
 #include <stdbool.h>
 
+extern char *cpkg_search_path(void);
+
+extern char *cpkg_find(const char *name);
+
 extern bool cpkg_exists(const char *name, bool verbose);
 
 extern char *cpkg_retrieve(const char *name, const char *what, bool verbose);
 
+typedef struct cpkg_job cpkg_job_t;
+
+extern cpkg_job_t *cpkg_start(const char *name, const char *what, bool verbose);
+
+extern char *cpkg_finish(cpkg_job_t *j);
+
+extern char *cpkg_resolve(const char *name, bool verbose);
+
+extern char *cpkg_files(const char *name);
+
 #endif /*!CPKG_H */
@@ -0,0 +1,69 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runtime for snippets
+ *
+ * Included by default and linked into every program, these helpers
+ * take records apart without copying them. Delimiters are found with
+ * SSE2 or AVX2 where the processor has it.
+ */
+
+#ifndef CPLR_RUNTIME_H
+#define CPLR_RUNTIME_H
+
+#include <stddef.h>
+
+/* view of a field inside a record, not terminated */
+typedef struct {
+  const char *p;
+  size_t n;
+} cplr_field_t;
+
+/* find the first byte C in P[0..N), NULL if there is none */
+extern const char *cplr_scan(const char *p, size_t n, int c);
+
+/* split P[0..N) at every byte DELIM into at most MAX fields,
+ * the last of which keeps the rest, and return their number */
+extern size_t cplr_split(const char *p, size_t n, int delim,
+                         cplr_field_t *f, size_t max);
+
+/* split P[0..N) into at most MAX fields separated by blanks like awk
+ * does, the last of which keeps the rest, and return their number */
+extern size_t cplr_fields(const char *p, size_t n,
+                          cplr_field_t *f, size_t max);
+
+/* parse a decimal integer, END gets the first byte not parsed */
+extern long long cplr_int(const char *p, size_t n, const char **end);
+
+/* parse a floating point number, END gets the first byte not parsed */
+extern double cplr_float(const char *p, size_t n, const char **end);
+
+/* name of the instruction set used for scanning */
+extern const char *cplr_runtime_isa(void);
+
+static inline long long cplr_field_int(cplr_field_t f) {
+  return cplr_int(f.p, f.n, NULL);
+}
+
+static inline double cplr_field_float(cplr_field_t f) {
+  return cplr_float(f.p, f.n, NULL);
+}
+
+#endif /* !CPLR_RUNTIME_H */
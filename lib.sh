@@ -83,3 +83,12 @@ alltests() {
 alltestvariants() {
     basename -s .cmd *.cmd | nquoteline
 }
+
+# normalize <file>
+#
+# Mask timings, sizes and paths that differ between runs.
+#
+normalize() {
+    sed -i -E -e 's/ +[0-9]+\.[0-9]+ms/ #.##ms/g' -e 's/[0-9]+ kB/# kB/g' \
+        -e 's/cplr-[A-Za-z0-9]{6}/cplr-XXXXXX/g' -e "s|${D}/|@/|g" "$1"
+}
@@ -0,0 +1,63 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cext/hash.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+CEXT_FUNC_ARG_NONNULL(1)
+void cext_hash_init(cext_hash_t *h) {
+  h->h = FNV_OFFSET;
+}
+
+CEXT_FUNC_ARG_NONNULL(1)
+void cext_hash_update(cext_hash_t *h, const void *buf, size_t len) {
+  const unsigned char *p = buf;
+  uint64_t v = h->h;
+  size_t i;
+  for(i = 0; i < len; i++) {
+    v ^= p[i];
+    v *= FNV_PRIME;
+  }
+  h->h = v;
+}
+
+CEXT_FUNC_ARG_NONNULL(1)
+void cext_hash_str(cext_hash_t *h, const char *s) {
+  if(s) {
+    cext_hash_update(h, s, strlen(s) + 1);
+  } else {
+    cext_hash_update(h, "", 1);
+  }
+}
+
+CEXT_FUNC_ARG_NONNULL(1)
+void cext_hash_u64(cext_hash_t *h, uint64_t v) {
+  cext_hash_update(h, &v, sizeof(v));
+}
+
+CEXT_FUNC_ARG_NONNULL(1,2)
+char *cext_hash_hex(cext_hash_t *h, char buf[CEXT_HASH_HEXLEN]) {
+  snprintf(buf, CEXT_HASH_HEXLEN, "%016llx", (unsigned long long)h->h);
+  return buf;
+}
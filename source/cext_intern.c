@@ -0,0 +1,117 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "cext/intern.h"
+
+#include "cext/hash.h"
+#include "cext/memory.h"
+
+/* initial number of buckets, must be a power of two */
+#define CEXT_INTERN_INITIAL 512
+
+typedef struct cext_istr cext_istr_t;
+
+struct cext_istr {
+  /* next in bucket */
+  cext_istr_t *next;
+  /* hash of the string */
+  uint64_t hash;
+  /* the string */
+  char str[];
+};
+
+/* strings and the table live in an arena that is never freed */
+static cext_arena_t *intern_arena = NULL;
+static cext_istr_t **intern_buckets = NULL;
+static size_t intern_nbuckets = 0;
+static size_t intern_count = 0;
+
+static uint64_t cext_intern_hash(const char *s, size_t len) {
+  cext_hash_t h;
+  cext_hash_init(&h);
+  cext_hash_update(&h, s, len);
+  return h.h;
+}
+
+static cext_istr_t *cext_intern_lookup(const char *s, size_t len, uint64_t hash) {
+  cext_istr_t *i;
+  if(!intern_buckets) {
+    return NULL;
+  }
+  for(i = intern_buckets[hash & (intern_nbuckets - 1)]; i; i = i->next) {
+    if(i->hash == hash && !memcmp(i->str, s, len + 1)) {
+      return i;
+    }
+  }
+  return NULL;
+}
+
+static void cext_intern_grow(void) {
+  size_t i, n = intern_nbuckets ? intern_nbuckets * 2 : CEXT_INTERN_INITIAL;
+  cext_istr_t **b = cext_arena_alloc(intern_arena, n * sizeof(cext_istr_t*));
+  cext_istr_t *s, *next;
+  for(i = 0; i < intern_nbuckets; i++) {
+    for(s = intern_buckets[i]; s; s = next) {
+      next = s->next;
+      s->next = b[s->hash & (n - 1)];
+      b[s->hash & (n - 1)] = s;
+    }
+  }
+  /* the old buckets stay in the arena */
+  intern_buckets = b;
+  intern_nbuckets = n;
+}
+
+CEXT_FUNC_RETURNS_NONNULL
+CEXT_FUNC_ARG_NONNULL(1)
+const char *cext_intern(const char *s) {
+  size_t len = strlen(s);
+  uint64_t hash = cext_intern_hash(s, len);
+  cext_istr_t *i = cext_intern_lookup(s, len, hash);
+  if(i) {
+    return i->str;
+  }
+  if(!intern_arena) {
+    intern_arena = cext_arena_new(16384);
+  }
+  if(intern_count >= intern_nbuckets) {
+    cext_intern_grow();
+  }
+  i = cext_arena_alloc(intern_arena, sizeof(cext_istr_t) + len + 1);
+  i->hash = hash;
+  memcpy(i->str, s, len + 1);
+  i->next = intern_buckets[hash & (intern_nbuckets - 1)];
+  intern_buckets[hash & (intern_nbuckets - 1)] = i;
+  intern_count++;
+  return i->str;
+}
+
+CEXT_FUNC_ARG_NONNULL(1)
+const char *cext_intern_find(const char *s) {
+  size_t len = strlen(s);
+  cext_istr_t *i = cext_intern_lookup(s, len, cext_intern_hash(s, len));
+  return i ? i->str : NULL;
+}
+
+void cext_intern_stats(size_t *count, size_t *bytes) {
+  *count = intern_count;
+  *bytes = intern_arena ? cext_arena_size(intern_arena) : 0;
+}
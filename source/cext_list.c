@@ -108,3 +108,39 @@ void l_append_str_static(lh_t *lh, const char *s) {
   value_set_str_static(&n->v, s);
   l_append(lh, n);
 }
+
+CEXT_FUNC_ARG_NONNULL(1,2)
+void l_splice(lh_t *dst, lh_t *src) {
+  ln_t *n;
+  if(!src->f) {
+    return;
+  }
+  /* adopt the nodes */
+  for(n = src->f; n; n = n->n) {
+    n->h = dst;
+  }
+  /* link them in */
+  if(dst->l) {
+    dst->l->n = src->f;
+    src->f->p = dst->l;
+  } else {
+    dst->f = src->f;
+  }
+  dst->l = src->l;
+  dst->c += src->c;
+  /* clear the source */
+  src->c = 0;
+  src->f = NULL;
+  src->l = NULL;
+}
+
+CEXT_FUNC_ARG_NONNULL(1,2)
+ln_t *l_find_str(lh_t *lh, const char *s) {
+  ln_t *n;
+  for(n = lh->f; n; n = n->n) {
+    if(value_has_type(&n->v, VT_STRING) && !strcmp(n->v.str, s)) {
+      return n;
+    }
+  }
+  return NULL;
+}
@@ -17,12 +17,23 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <stddef.h>
+#include <string.h>
+
 #include "cext/memory.h"
 
+/* allocation counters */
+static unsigned long cext_allocs = 0;
+static unsigned long cext_bytes = 0;
+
+#define CEXT_COUNT(size) \
+  do { cext_allocs++; cext_bytes += (size); } while(0)
+
 CEXT_FUNC_MALLOC
 CEXT_FUNC_RETURNS_NONNULL
 CEXT_FUNC_ARG_ALLOC_SIZE(1)
 void *cext_malloc(size_t s) {
+  CEXT_COUNT(s);
   CEXT_VOIDPTR_NOTNULL(malloc, "Allocation of size %zu failed", s);
 }
 
@@ -30,6 +41,7 @@ CEXT_FUNC_MALLOC
 CEXT_FUNC_RETURNS_NONNULL
 CEXT_FUNC_ARG_ALLOC_SIZE(1, 2)
 void *cext_calloc(size_t n, size_t s) {
+  CEXT_COUNT(n * s);
   CEXT_VOIDPTR_NOTNULL(calloc, "Allocation of %zu objects of size %zu failed", n, s);
 }
 
@@ -37,6 +49,7 @@ CEXT_FUNC_RETURNS_NONNULL
 CEXT_FUNC_ARG_NONNULL(1)
 CEXT_FUNC_ARG_ALLOC_SIZE(2)
 void *cext_realloc(void *ptr, size_t s) {
+  CEXT_COUNT(s);
   CEXT_VOIDPTR_NOTNULL(realloc, "Reallocation of %p to size %zu failed", ptr, s);
 }
 
@@ -78,3 +91,127 @@ void cext_lptrfree(void **p) {
     *p = NULL;
   }
 }
+
+CEXT_FUNC_MALLOC
+CEXT_FUNC_RETURNS_NONNULL
+CEXT_FUNC_ARG_NONNULL(1)
+char *cext_strdup(const char *s) {
+  CEXT_COUNT(strlen(s) + 1);
+  CEXT_VOIDPTR_NOTNULL(strdup, "Duplication of %s failed", s);
+}
+
+CEXT_FUNC_MALLOC
+CEXT_FUNC_RETURNS_NONNULL
+CEXT_FUNC_ARG_NONNULL(1)
+char *cext_strndup(const char *s, size_t n) {
+  char *p = strndup(s, n);
+  if(p == NULL) cext_abortf("Duplication of %zu bytes failed", n);
+  CEXT_COUNT(strlen(p) + 1);
+  return p;
+}
+
+void cext_memory_stats(unsigned long *allocs, unsigned long *bytes) {
+  *allocs = cext_allocs;
+  *bytes = cext_bytes;
+}
+
+/*
+ * Arena allocator
+ *
+ * Memory comes from a list of chunks that grow in size. Objects
+ * are never freed individually, the arena goes away as a whole
+ * once the last reference to it is dropped.
+ */
+
+/* largest chunk size we grow to */
+#define CEXT_ARENA_MAXCHUNK (64 * 1024)
+
+typedef struct cext_chunk cext_chunk_t;
+struct cext_chunk {
+  cext_chunk_t *next;
+  size_t size;
+  size_t used;
+  /* keeps data aligned for any type */
+  max_align_t data[];
+};
+
+struct cext_arena {
+  unsigned refs;
+  cext_chunk_t *chunks;
+  size_t chunk;
+  size_t total;
+};
+
+CEXT_FUNC_RETURNS_NONNULL
+cext_arena_t *cext_arena_new(size_t chunk) {
+  cext_arena_t *a = cext_calloc(1, sizeof(cext_arena_t));
+  a->refs = 1;
+  a->chunk = chunk ? chunk : 1024;
+  return a;
+}
+
+CEXT_FUNC_RETURNS_NONNULL
+CEXT_FUNC_ARG_NONNULL(1)
+cext_arena_t *cext_arena_ref(cext_arena_t *a) {
+  a->refs++;
+  return a;
+}
+
+CEXT_FUNC_ARG_NONNULL(1)
+void cext_arena_free(cext_arena_t *a) {
+  cext_chunk_t *c, *next;
+  if(--a->refs) {
+    return;
+  }
+  for(c = a->chunks; c; c = next) {
+    next = c->next;
+    free(c);
+  }
+  free(a);
+}
+
+CEXT_FUNC_MALLOC
+CEXT_FUNC_RETURNS_NONNULL
+CEXT_FUNC_ARG_NONNULL(1)
+CEXT_FUNC_ARG_ALLOC_SIZE(2)
+void *cext_arena_alloc(cext_arena_t *a, size_t s) {
+  cext_chunk_t *c = a->chunks;
+  size_t size;
+  void *r;
+  /* round up to keep alignment */
+  s = (s + sizeof(max_align_t) - 1) & ~(sizeof(max_align_t) - 1);
+  if(!c || c->size - c->used < s) {
+    size = a->chunk;
+    while(size < s) {
+      size *= 2;
+    }
+    c = cext_malloc(sizeof(cext_chunk_t) + size);
+    c->size = size;
+    c->used = 0;
+    c->next = a->chunks;
+    a->chunks = c;
+    /* later chunks get bigger */
+    if(a->chunk < CEXT_ARENA_MAXCHUNK) {
+      a->chunk *= 2;
+    }
+  }
+  r = (char*)c->data + c->used;
+  c->used += s;
+  a->total += s;
+  memset(r, 0, s);
+  return r;
+}
+
+CEXT_FUNC_RETURNS_NONNULL
+CEXT_FUNC_ARG_NONNULL(1, 2)
+char *cext_arena_strdup(cext_arena_t *a, const char *s) {
+  size_t l = strlen(s) + 1;
+  char *r = cext_arena_alloc(a, l);
+  memcpy(r, s, l);
+  return r;
+}
+
+CEXT_FUNC_ARG_NONNULL(1)
+size_t cext_arena_size(cext_arena_t *a) {
+  return a->total;
+}
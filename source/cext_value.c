@@ -36,7 +36,7 @@ CEXT_FUNC_ARG_NONNULL(2)
 void value_clone(value_t *vsrc, value_t *vdst) {
   memcpy(vdst, vsrc, sizeof(value_t));
   if(value_has_type(vdst, VT_STRING)) {
-    vdst->str = strdup(vsrc->str);
+    vdst->str = cext_strdup(vsrc->str);
     vdst->type |= VTM_OWNED;
   } else if(vdst->type & VTF_POINTER) {
     if(vdst->type & VTM_OWNED) {
@@ -74,7 +74,7 @@ static void *ptr_fault(void *p) {
 }
 
 VALUE_POINTER_DEFINE_GETTERS(ptr, void, ptr, VT_POINTER, ptr_fault);
-VALUE_POINTER_DEFINE_GETTERS(str, char, str, VT_STRING, strdup);
+VALUE_POINTER_DEFINE_GETTERS(str, char, str, VT_STRING, cext_strdup);
 
 VALUE_POINTER_DEFINE_SETTERS(ptr, void, ptr, VT_POINTER, ptr_fault);
-VALUE_POINTER_DEFINE_SETTERS(str, char, str, VT_STRING, strdup);
+VALUE_POINTER_DEFINE_SETTERS(str, char, str, VT_STRING, cext_strdup);
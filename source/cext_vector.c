@@ -0,0 +1,214 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "cext/vector.h"
+
+#include "cext/intern.h"
+#include "cext/memory.h"
+
+/* capacity of the first array of a vector */
+#define V_MINIMUM 8
+
+/* resize the element array, keeping the elements */
+static void v_resize(vh_t *vh, size_t n) {
+  value_t *v;
+  if(vh->a) {
+    /* the old array stays in the arena */
+    v = cext_arena_alloc(vh->a, n * sizeof(value_t));
+    if(vh->c) {
+      memcpy(v, vh->v, vh->c * sizeof(value_t));
+    }
+  } else {
+    v = cext_realloc(vh->v, n * sizeof(value_t));
+    memset(v + vh->c, 0, (n - vh->c) * sizeof(value_t));
+  }
+  vh->v = v;
+  vh->n = n;
+}
+
+/* set an element to a string, copied into the arena if there is one */
+static void v_set_str(vh_t *vh, value_t *e, const char *s) {
+  if(vh->a) {
+    /* arena strings go with the arena, they are neither owned nor static */
+    value_clear(e);
+    e->str = cext_arena_strdup(vh->a, s);
+    e->type = VT_STRING;
+  } else {
+    value_set_str(e, (char*)s);
+  }
+}
+
+/* copy an element, static and interned strings need no copy */
+static void v_copy(vh_t *vh, value_t *dst, value_t *src) {
+  if(vh->a && (src->type & VTM_STATIC)) {
+    *dst = *src;
+  } else if(vh->a && value_has_type(src, VT_STRING)) {
+    v_set_str(vh, dst, src->str);
+  } else {
+    value_clone(src, dst);
+  }
+}
+
+/* take private copies of shared elements before writing */
+static void v_unshare(vh_t *vh) {
+  vh_t o;
+  if(!vh->s) {
+    return;
+  }
+  o = *vh;
+  vh->c = 0;
+  vh->n = 0;
+  vh->v = NULL;
+  vh->s = NULL;
+  v_clone(&o, vh);
+  cext_arena_free(o.s);
+}
+
+/* get a fresh element at the end of the vector */
+static value_t *v_slot(vh_t *vh) {
+  v_unshare(vh);
+  if(vh->c == vh->n) {
+    v_resize(vh, vh->n ? 2 * vh->n : V_MINIMUM);
+  }
+  return &vh->v[vh->c++];
+}
+
+CEXT_FUNC_ARG_NONNULL(1)
+void v_clear(vh_t *vh) {
+  size_t i;
+  if(vh->s) {
+    /* shared elements belong to their arena */
+    cext_arena_free(vh->s);
+    vh->s = NULL;
+  } else if(!vh->a) {
+    /* heap vectors own their elements */
+    for(i = 0; i < vh->c; i++) {
+      value_clear(&vh->v[i]);
+    }
+    cext_lfree(vh->v);
+  }
+  vh->c = 0;
+  vh->n = 0;
+  vh->v = NULL;
+}
+
+CEXT_FUNC_ARG_NONNULL(1,2)
+void v_clone(vh_t *vsrc, vh_t *vdst) {
+  size_t i;
+  if(!vsrc->c) {
+    return;
+  }
+  v_resize(vdst, vsrc->c);
+  for(i = 0; i < vsrc->c; i++) {
+    v_copy(vdst, &vdst->v[i], &vsrc->v[i]);
+  }
+  vdst->c = vsrc->c;
+}
+
+CEXT_FUNC_ARG_NONNULL(1,2)
+void v_share(vh_t *vsrc, vh_t *vdst) {
+  cext_arena_t *home = vsrc->s ? vsrc->s : vsrc->a;
+  /* heap elements have a single owner */
+  if(!home || !vdst->a) {
+    v_clone(vsrc, vdst);
+    return;
+  }
+  /* nothing to share */
+  if(!vsrc->c) {
+    return;
+  }
+  /* the source becomes immutable as well */
+  if(!vsrc->s) {
+    vsrc->s = cext_arena_ref(home);
+  }
+  vdst->c = vsrc->c;
+  vdst->n = vsrc->c;
+  vdst->v = vsrc->v;
+  vdst->s = cext_arena_ref(home);
+}
+
+CEXT_FUNC_ARG_NONNULL(1,2)
+void v_append_str(vh_t *vh, char *s) {
+  v_set_str(vh, v_slot(vh), s);
+}
+
+CEXT_FUNC_ARG_NONNULL(1,2)
+void v_append_str_owned(vh_t *vh, char *s) {
+  value_t *e = v_slot(vh);
+  if(vh->a) {
+    /* arena vectors own nothing */
+    v_set_str(vh, e, s);
+    cext_free(s);
+  } else {
+    value_set_str_owned(e, s);
+  }
+}
+
+CEXT_FUNC_ARG_NONNULL(1,2)
+void v_append_str_static(vh_t *vh, const char *s) {
+  value_set_str_static(v_slot(vh), s);
+}
+
+CEXT_FUNC_ARG_NONNULL(1,2)
+bool v_append_str_unique(vh_t *vh, const char *s) {
+  const char *i = cext_intern(s);
+  value_t *e;
+  V_FORWARD(vh, e) {
+    if(e->str == i) {
+      return false;
+    }
+  }
+  value_set_str_static(v_slot(vh), i);
+  return true;
+}
+
+CEXT_FUNC_ARG_NONNULL(1,2)
+void v_splice(vh_t *dst, vh_t *src) {
+  size_t i;
+  if(!src->c) {
+    return;
+  }
+  /* heap elements change owner */
+  if(!dst->a && !src->a && !src->s) {
+    for(i = 0; i < src->c; i++) {
+      *v_slot(dst) = src->v[i];
+    }
+    cext_lfree(src->v);
+    src->c = 0;
+    src->n = 0;
+    src->v = NULL;
+    return;
+  }
+  /* others are copied into the destination */
+  for(i = 0; i < src->c; i++) {
+    v_copy(dst, v_slot(dst), &src->v[i]);
+  }
+  v_clear(src);
+}
+
+CEXT_FUNC_ARG_NONNULL(1,2)
+value_t *v_find_str(vh_t *vh, const char *s) {
+  value_t *e;
+  V_FORWARD(vh, e) {
+    if(value_has_type(e, VT_STRING) && !strcmp(e->str, s)) {
+      return e;
+    }
+  }
+  return NULL;
+}
@@ -17,14 +17,62 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <sys/stat.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
 
 #include <cext/memory.h>
 #include <cext/string.h>
 
 #include "cpkg.h"
 
+#include "cplr_config.h"
+
+/* fallback for the search path of pkg-config */
+#ifndef CPLR_PKGCONFIG_PATH
+#define CPLR_PKGCONFIG_PATH \
+  "/usr/local/lib/pkgconfig:/usr/local/share/pkgconfig:" \
+  "/usr/lib/pkgconfig:/usr/share/pkgconfig"
+#endif
+
+char *cpkg_search_path(void) {
+  const char *path = getenv("PKG_CONFIG_PATH");
+  const char *libdir = getenv("PKG_CONFIG_LIBDIR");
+  /* libdir replaces the default */
+  if(!libdir) {
+    libdir = CPLR_PKGCONFIG_PATH;
+  }
+  /* path comes first */
+  if(path && *path) {
+    return msprintf("%s:%s", path, libdir);
+  } else {
+    return strdup(libdir);
+  }
+}
+
+char *cpkg_find(const char *name) {
+  struct stat st;
+  char *path, *dir, *save, *file = NULL;
+  path = cpkg_search_path();
+  for(dir = strtok_r(path, ":", &save); dir; dir = strtok_r(NULL, ":", &save)) {
+    if(!*dir) {
+      continue;
+    }
+    file = msprintf("%s/%s.pc", dir, name);
+    if(stat(file, &st) == 0) {
+      break;
+    }
+    cext_free(file);
+    file = NULL;
+  }
+  cext_free(path);
+  return file;
+}
+
 bool cpkg_exists(const char *name, bool verbose) {
   int res;
   bool ret = false;
@@ -47,7 +95,9 @@ bool cpkg_exists(const char *name, bool verbose) {
 char *cpkg_retrieve(const char *name, const char *what, bool verbose) {
   int res;
   FILE *ps;
-  char *cmd;
+  char *cmd, *buf = NULL;
+  size_t len = 0;
+  FILE *out;
   char rbuf[1024];
   cmd = msprintf("pkg-config %s %s", what, name);
   if(verbose) {
@@ -58,24 +108,754 @@ char *cpkg_retrieve(const char *name, const char *what, bool verbose) {
     fprintf(stderr, "Error: Could not popen \"%s\"\n", cmd);
     goto err_popen;
   }
-  res = fread(rbuf, 1, sizeof(rbuf), ps);
-  if(res < 0) {
-    fprintf(stderr, "Error: Failed to read from \"%s\"\n", cmd);
-    goto err_fread;
+  out = open_memstream(&buf, &len);
+  while((res = fread(rbuf, 1, sizeof(rbuf), ps)) > 0) {
+    fwrite(rbuf, 1, res, out);
   }
-  if(res == sizeof(rbuf)) {
-    fprintf(stderr, "Error: Package options for %s are too long.\n", name);
+  fclose(out);
+  if(ferror(ps)) {
+    fprintf(stderr, "Error: Failed to read from \"%s\"\n", cmd);
     goto err_fread;
   }
-  rbuf[res] = 0;
-  if(rbuf[res - 1] == '\n')
-    rbuf[res - 1] = 0;
+  if(len && buf[len - 1] == '\n')
+    buf[len - 1] = 0;
   pclose(ps);
   cext_free(cmd);
-  return strdup(rbuf);
+  return buf;
  err_fread:
+  cext_free(buf);
   pclose(ps);
  err_popen:
   cext_free(cmd);
   return NULL;
 }
+
+/* pkg-config running in the background */
+struct cpkg_job {
+  FILE *ps;
+  char *cmd;
+};
+
+cpkg_job_t *cpkg_start(const char *name, const char *what, bool verbose) {
+  cpkg_job_t *j;
+  /* errors are reported when resolving in place */
+  char *cmd = msprintf("pkg-config %s %s 2>/dev/null", what, name);
+  FILE *ps;
+  if(verbose) {
+    fprintf(stderr, "Starting \"%s\"\n", cmd);
+  }
+  /* popen does not wait, reading does */
+  fflush(NULL);
+  ps = popen(cmd, "r");
+  if(!ps) {
+    cext_free(cmd);
+    return NULL;
+  }
+  j = cext_malloc(sizeof(cpkg_job_t));
+  j->ps = ps;
+  j->cmd = cmd;
+  return j;
+}
+
+char *cpkg_finish(cpkg_job_t *j) {
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *out;
+  char rbuf[1024];
+  int res;
+  out = open_memstream(&buf, &len);
+  while((res = fread(rbuf, 1, sizeof(rbuf), j->ps)) > 0) {
+    fwrite(rbuf, 1, res, out);
+  }
+  fclose(out);
+  /* missing packages make pkg-config fail */
+  res = pclose(j->ps);
+  if(res != 0) {
+    cext_free(buf);
+    buf = NULL;
+  } else if(len && buf[len - 1] == '\n') {
+    buf[len - 1] = 0;
+  }
+  cext_free(j->cmd);
+  cext_free(j);
+  return buf;
+}
+
+/*
+ * Native resolver
+ *
+ * Reads .pc files directly and produces the same output as
+ * "pkg-config --cflags --libs", including the ordering and
+ * deduplication rules of pkgconf.
+ */
+
+/* fallback for system directories filtered from output */
+#ifndef CPLR_PKGCONFIG_SYSTEM_INCLUDEDIRS
+#define CPLR_PKGCONFIG_SYSTEM_INCLUDEDIRS "/usr/include"
+#endif
+#ifndef CPLR_PKGCONFIG_SYSTEM_LIBDIRS
+#define CPLR_PKGCONFIG_SYSTEM_LIBDIRS "/usr/lib:/lib"
+#endif
+
+/* flag fragment */
+typedef struct cpkg_frag cpkg_frag_t;
+struct cpkg_frag {
+  cpkg_frag_t *prev;
+  cpkg_frag_t *next;
+  /* option character, 0 for special fragments */
+  char type;
+  /* special fragment consisting of several arguments */
+  bool merged;
+  /* no further arguments may be merged */
+  bool terminated;
+  char *data;
+};
+
+/* list of fragments */
+typedef struct {
+  cpkg_frag_t *head;
+  cpkg_frag_t *tail;
+} cpkg_frags_t;
+
+/* package variable */
+typedef struct cpkg_var cpkg_var_t;
+struct cpkg_var {
+  cpkg_var_t *next;
+  char *name;
+  char *value;
+};
+
+/* parsed package */
+typedef struct cpkg_pc cpkg_pc_t;
+struct cpkg_pc {
+  cpkg_pc_t *next;
+  char *name;
+  char *path;
+  cpkg_var_t *vars;
+  char *requires;
+  char *requires_private;
+  cpkg_frags_t cflags;
+  cpkg_frags_t libs;
+  /* on the current traversal path */
+  bool ancestor;
+  /* traversal that last listed this package */
+  unsigned listed;
+};
+
+/* packages parsed so far */
+static cpkg_pc_t *cpkg_loaded = NULL;
+
+static void cpkg_frags_append(cpkg_frags_t *l, cpkg_frag_t *f) {
+  f->next = NULL;
+  f->prev = l->tail;
+  if(l->tail) {
+    l->tail->next = f;
+  } else {
+    l->head = f;
+  }
+  l->tail = f;
+}
+
+static void cpkg_frags_remove(cpkg_frags_t *l, cpkg_frag_t *f) {
+  if(f->prev) {
+    f->prev->next = f->next;
+  } else {
+    l->head = f->next;
+  }
+  if(f->next) {
+    f->next->prev = f->prev;
+  } else {
+    l->tail = f->prev;
+  }
+  cext_free(f->data);
+  cext_free(f);
+}
+
+static void cpkg_frags_clear(cpkg_frags_t *l) {
+  while(l->head) {
+    cpkg_frags_remove(l, l->head);
+  }
+}
+
+/* true if PATH is in the colon-separated LIST */
+static bool cpkg_path_listed(const char *list, const char *path) {
+  size_t n = strlen(path);
+  const char *p = list, *e;
+  while(*p) {
+    e = strchr(p, ':');
+    if(!e) {
+      e = p + strlen(p);
+    }
+    if((size_t)(e - p) == n && !strncmp(p, path, n)) {
+      return true;
+    }
+    p = *e ? e + 1 : e;
+  }
+  return false;
+}
+
+static bool cpkg_prefixed(const char *s, const char * const *table) {
+  int i;
+  for(i = 0; table[i]; i++) {
+    if(!strncmp(s, table[i], strlen(table[i]))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* fragments that are never deduplicated by value alone */
+static bool cpkg_frag_unmergeable(const char *s) {
+  static const char * const table[] = {
+    "-framework", "-isystem", "-idirafter", "-pthread",
+    "-Wa,", "-Wl,", "-Wp,", "-trigraphs", "-pedantic", "-ansi",
+    "-std=", "-stdlib=", "-include", "-nostdinc", "-nostdlibinc",
+    "-nobuiltininc", NULL
+  };
+  if(*s != '-') {
+    return true;
+  }
+  return cpkg_prefixed(s, table);
+}
+
+/* fragments that collect arguments until terminated */
+static bool cpkg_frag_groupable(const char *s) {
+  static const char * const table[] = {
+    "-Wl,--start-group", "-framework", "-isystem",
+    "-idirafter", "-include", NULL
+  };
+  return cpkg_prefixed(s, table);
+}
+
+static bool cpkg_frag_special(const char *s) {
+  if(*s != '-' || !strncmp(s, "-lib:", 5)) {
+    return true;
+  }
+  return cpkg_frag_unmergeable(s);
+}
+
+/* prefix absolute paths with the sysroot */
+static char *cpkg_sysroot(const char *s) {
+  const char *sysroot = getenv("PKG_CONFIG_SYSROOT_DIR");
+  if(sysroot && *sysroot && *s == '/'
+     && strncmp(s, sysroot, strlen(sysroot))) {
+    return msprintf("%s%s", sysroot, s);
+  }
+  return strdup(s);
+}
+
+/* add one argument to a fragment list */
+static void cpkg_frag_add(cpkg_frags_t *l, const char *s) {
+  cpkg_frag_t *f, *p = l->tail;
+  char *d;
+  if(!*s) {
+    return;
+  }
+  if(!cpkg_frag_special(s)) {
+    f = cext_calloc(1, sizeof(cpkg_frag_t));
+    f->type = s[1];
+    if(f->type == 'I' || f->type == 'L') {
+      f->data = cpkg_sysroot(s + 2);
+    } else {
+      f->data = strdup(s + 2);
+    }
+    cpkg_frags_append(l, f);
+    return;
+  }
+  /* special arguments may belong to the previous one */
+  if(p && !p->type && cpkg_frag_unmergeable(p->data) && !p->terminated) {
+    if(cpkg_frag_groupable(p->data)) {
+      if(!strcmp(s, "-Wl,--end-group")) {
+        p->terminated = true;
+      }
+    } else {
+      p->terminated = true;
+    }
+    d = msprintf("%s %s", p->data, s);
+    cext_free(p->data);
+    p->data = d;
+    p->merged = true;
+    return;
+  }
+  f = cext_calloc(1, sizeof(cpkg_frag_t));
+  f->data = cpkg_sysroot(s);
+  cpkg_frags_append(l, f);
+}
+
+/* split a flag string into arguments like a shell would */
+static void cpkg_frag_parse(cpkg_frags_t *l, const char *s) {
+  size_t n = strlen(s);
+  char *arg = cext_malloc(n + 1);
+  char quote;
+  bool have;
+  size_t i;
+  while(*s) {
+    while(*s && isspace(*s)) s++;
+    if(!*s) {
+      break;
+    }
+    i = 0;
+    quote = 0;
+    have = false;
+    for(; *s; s++) {
+      if(quote) {
+        if(*s == quote) {
+          quote = 0;
+        } else if(*s == '\\' && quote == '"' && s[1]) {
+          arg[i++] = *++s;
+        } else {
+          arg[i++] = *s;
+        }
+      } else if(isspace(*s)) {
+        break;
+      } else if(*s == '\'' || *s == '"') {
+        quote = *s;
+        have = true;
+      } else if(*s == '\\' && s[1]) {
+        arg[i++] = *++s;
+      } else {
+        arg[i++] = *s;
+      }
+    }
+    arg[i] = 0;
+    if(i || have) {
+      cpkg_frag_add(l, arg);
+    }
+  }
+  cext_free(arg);
+}
+
+static bool cpkg_frag_samedata(const cpkg_frag_t *a, const cpkg_frag_t *b) {
+  return a->type == b->type && !strcmp(a->data, b->data);
+}
+
+static cpkg_frag_t *cpkg_frag_lookup(cpkg_frags_t *l, const cpkg_frag_t *f) {
+  cpkg_frag_t *i;
+  for(i = l->tail; i; i = i->prev) {
+    if(cpkg_frag_samedata(i, f)) {
+      return i;
+    }
+  }
+  return NULL;
+}
+
+/* may an older copy be replaced by a newer one */
+static bool cpkg_frag_replaceable(const cpkg_frag_t *f) {
+  if(f->type == 'I' || f->type == 'L' || f->type == 'F') {
+    return false;
+  }
+  return cpkg_frag_unmergeable(f->data);
+}
+
+/* may an older copy be removed from its position */
+static bool cpkg_frag_movable(const cpkg_frag_t *f) {
+  if(!f->prev) {
+    return true;
+  }
+  switch(f->prev->type) {
+  case 'l':
+  case 'L':
+  case 'I':
+    return true;
+  default:
+    return !f->type || f->prev->type == f->type;
+  }
+}
+
+/* append a copy of F, deduplicating */
+static void cpkg_frag_copy(cpkg_frags_t *l, const cpkg_frag_t *f) {
+  cpkg_frag_t *o, *n;
+  if(cpkg_frag_replaceable(f)) {
+    /* later occurrences win */
+    o = cpkg_frag_lookup(l, f);
+    if(o && cpkg_frag_movable(o)) {
+      cpkg_frags_remove(l, o);
+    }
+  } else if(cpkg_frag_lookup(l, f)) {
+    /* earlier occurrences win */
+    return;
+  }
+  n = cext_calloc(1, sizeof(cpkg_frag_t));
+  n->type = f->type;
+  n->merged = f->merged;
+  n->data = strdup(f->data);
+  cpkg_frags_append(l, n);
+}
+
+/* drop fragments naming system directories */
+static void cpkg_frag_filter(cpkg_frags_t *l, char type, const char *dirs) {
+  cpkg_frag_t *i, *n;
+  for(i = l->head; i; i = n) {
+    n = i->next;
+    if(i->type == type && cpkg_path_listed(dirs, i->data)) {
+      cpkg_frags_remove(l, i);
+    }
+  }
+}
+
+/* render fragments with the quoting of pkgconf */
+static void cpkg_frag_render(FILE *out, cpkg_frags_t *l) {
+  cpkg_frag_t *f;
+  const unsigned char *p;
+  unsigned char ch;
+  for(f = l->head; f; f = f->next) {
+    if(f->type) {
+      fprintf(out, "-%c", f->type);
+    }
+    for(p = (const unsigned char*)f->data; *p; p++) {
+      ch = *p;
+      if(ch < ' ' || (ch == ' ' && !f->merged)
+         || (ch > ' ' && ch < '$') || (ch > '$' && ch < '(')
+         || (ch > ')' && ch < '+') || (ch > ':' && ch < '=')
+         || (ch > '=' && ch < '@') || (ch > 'Z' && ch < '^')
+         || ch == '`' || (ch > 'z' && ch < '~') || ch > '~') {
+        fputc('\\', out);
+      }
+      fputc(ch, out);
+    }
+    fputc(' ', out);
+  }
+}
+
+static const char *cpkg_var_get(cpkg_pc_t *pc, const char *name) {
+  cpkg_var_t *v;
+  for(v = pc->vars; v; v = v->next) {
+    if(!strcmp(v->name, name)) {
+      return v->value;
+    }
+  }
+  if(!strcmp(name, "pc_sysrootdir")) {
+    const char *sysroot = getenv("PKG_CONFIG_SYSROOT_DIR");
+    return sysroot ? sysroot : "/";
+  }
+  return "";
+}
+
+static void cpkg_var_set(cpkg_pc_t *pc, const char *name, char *value) {
+  cpkg_var_t *v = cext_calloc(1, sizeof(cpkg_var_t));
+  v->name = strdup(name);
+  v->value = value;
+  v->next = pc->vars;
+  pc->vars = v;
+}
+
+/* expand variable references in S */
+static char *cpkg_expand(cpkg_pc_t *pc, const char *s) {
+  char *buf = NULL, *name;
+  const char *e;
+  size_t len = 0;
+  FILE *f = open_memstream(&buf, &len);
+  while(*s) {
+    if(s[0] == '$' && s[1] == '$') {
+      fputc('$', f);
+      s += 2;
+    } else if(s[0] == '$' && s[1] == '{' && (e = strchr(s + 2, '}'))) {
+      name = strndup(s + 2, e - s - 2);
+      fputs(cpkg_var_get(pc, name), f);
+      cext_free(name);
+      s = e + 1;
+    } else {
+      fputc(*s++, f);
+    }
+  }
+  fclose(f);
+  return buf;
+}
+
+/* read a logical line, joining continuations and dropping comments */
+static char *cpkg_getline(FILE *f) {
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *out;
+  int ch, next;
+  bool any = false, comment = false;
+  out = open_memstream(&buf, &len);
+  while((ch = fgetc(f)) != EOF) {
+    any = true;
+    if(ch == '\n') {
+      break;
+    }
+    if(ch == '\\') {
+      next = fgetc(f);
+      if(next == '\n') {
+        continue;
+      }
+      if(next == '\r') {
+        if((next = fgetc(f)) != '\n' && next != EOF) {
+          ungetc(next, f);
+        }
+        continue;
+      }
+      if(next == '#') {
+        if(!comment) {
+          fputc('#', out);
+        }
+        continue;
+      }
+      if(next != EOF) {
+        ungetc(next, f);
+      }
+    } else if(ch == '#') {
+      comment = true;
+    } else if(ch == '\r') {
+      continue;
+    }
+    if(!comment) {
+      fputc(ch, out);
+    }
+  }
+  fclose(out);
+  if(!any) {
+    cext_free(buf);
+    return NULL;
+  }
+  return buf;
+}
+
+static char *cpkg_trim(char *s) {
+  char *e;
+  while(*s && isspace(*s)) s++;
+  e = s + strlen(s);
+  while(e > s && isspace(e[-1])) e--;
+  *e = 0;
+  return s;
+}
+
+/* parse the package file at PATH */
+static cpkg_pc_t *cpkg_parse(const char *name, const char *path) {
+  cpkg_pc_t *pc;
+  char *line, *key, *value, *end, *dir;
+  char op;
+  FILE *f;
+  f = fopen(path, "r");
+  if(!f) {
+    fprintf(stderr, "Error: Could not read %s\n", path);
+    return NULL;
+  }
+  pc = cext_calloc(1, sizeof(cpkg_pc_t));
+  pc->name = strdup(name);
+  pc->path = strdup(path);
+  dir = strdup(path);
+  *strrchr(dir, '/') = 0;
+  cpkg_var_set(pc, "pcfiledir", dir);
+  while((line = cpkg_getline(f))) {
+    key = cpkg_trim(line);
+    for(end = key; isalnum(*end) || *end == '_' || *end == '.'; end++);
+    value = end;
+    while(*value && isspace(*value)) value++;
+    op = *value;
+    if(end == key || (op != ':' && op != '=')) {
+      cext_free(line);
+      continue;
+    }
+    *end = 0;
+    value = cpkg_trim(value + 1);
+    if(op == '=') {
+      if(!strcmp(key, "pcfiledir")) {
+        cext_free(line);
+        continue;
+      }
+      cpkg_var_set(pc, key, cpkg_expand(pc, value));
+    } else if(!strcasecmp(key, "Requires")) {
+      cext_lfree(pc->requires);
+      pc->requires = cpkg_expand(pc, value);
+    } else if(!strcasecmp(key, "Requires.private")) {
+      cext_lfree(pc->requires_private);
+      pc->requires_private = cpkg_expand(pc, value);
+    } else if(!strcasecmp(key, "Cflags")) {
+      value = cpkg_expand(pc, value);
+      cpkg_frags_clear(&pc->cflags);
+      cpkg_frag_parse(&pc->cflags, value);
+      cext_free(value);
+    } else if(!strcasecmp(key, "Libs")) {
+      value = cpkg_expand(pc, value);
+      cpkg_frags_clear(&pc->libs);
+      cpkg_frag_parse(&pc->libs, value);
+      cext_free(value);
+    }
+    cext_free(line);
+  }
+  fclose(f);
+  return pc;
+}
+
+/* find and parse a package, reusing earlier results */
+static cpkg_pc_t *cpkg_load(const char *name) {
+  cpkg_pc_t *pc;
+  char *path;
+  path = cpkg_find(name);
+  if(!path) {
+    return NULL;
+  }
+  for(pc = cpkg_loaded; pc; pc = pc->next) {
+    if(!strcmp(pc->name, name) && !strcmp(pc->path, path)) {
+      cext_free(path);
+      return pc;
+    }
+  }
+  pc = cpkg_parse(name, path);
+  cext_free(path);
+  if(pc) {
+    pc->next = cpkg_loaded;
+    cpkg_loaded = pc;
+  }
+  return pc;
+}
+
+/* call CB for each package name in a Requires field */
+static bool cpkg_requires(const char *s, const char *from,
+                          bool (*cb)(const char *name, const char *from,
+                                     void *ctx),
+                          void *ctx) {
+  const char *b;
+  char *name;
+  bool ok = true;
+  while(ok && *s) {
+    while(*s && (isspace(*s) || *s == ',')) s++;
+    if(!*s) {
+      break;
+    }
+    b = s;
+    while(*s && !isspace(*s) && *s != ',' && !strchr("<>=!", *s)) s++;
+    name = strndup(b, s - b);
+    /* skip a version constraint */
+    while(*s && isspace(*s)) s++;
+    if(*s && strchr("<>=!", *s)) {
+      while(*s && strchr("<>=!", *s)) s++;
+      while(*s && isspace(*s)) s++;
+      while(*s && !isspace(*s) && *s != ',') s++;
+    }
+    if(*name) {
+      ok = cb(name, from, ctx);
+    }
+    cext_free(name);
+  }
+  return ok;
+}
+
+/* traversal state */
+typedef struct {
+  bool private;
+  bool verbose;
+  cpkg_frags_t cflags;
+  cpkg_frags_t libs;
+} cpkg_walk_t;
+
+static bool cpkg_visit(const char *name, const char *from, void *ctx);
+
+static bool cpkg_walk(cpkg_pc_t *pc, cpkg_walk_t *w) {
+  cpkg_frag_t *f;
+  bool ok = true, private;
+  /* ignore circular references */
+  if(pc->ancestor) {
+    return true;
+  }
+  if(w->verbose) {
+    fprintf(stderr, "Package %s from %s\n", pc->name, pc->path);
+  }
+  /* compile flags come from private dependencies too */
+  for(f = pc->cflags.head; f; f = f->next) {
+    cpkg_frag_copy(&w->cflags, f);
+  }
+  if(!w->private) {
+    for(f = pc->libs.head; f; f = f->next) {
+      cpkg_frag_copy(&w->libs, f);
+    }
+  }
+  pc->ancestor = true;
+  if(pc->requires) {
+    ok = cpkg_requires(pc->requires, pc->name, cpkg_visit, w);
+  }
+  if(ok && pc->requires_private) {
+    private = w->private;
+    w->private = true;
+    ok = cpkg_requires(pc->requires_private, pc->name, cpkg_visit, w);
+    w->private = private;
+  }
+  pc->ancestor = false;
+  return ok;
+}
+
+static bool cpkg_visit(const char *name, const char *from, void *ctx) {
+  cpkg_pc_t *pc = cpkg_load(name);
+  if(!pc) {
+    fprintf(stderr, "Error: Package %s required by %s not found\n",
+            name, from);
+    return false;
+  }
+  return cpkg_walk(pc, ctx);
+}
+
+char *cpkg_resolve(const char *name, bool verbose) {
+  const char *incdirs, *libdirs;
+  cpkg_walk_t w;
+  cpkg_pc_t *pc;
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *out;
+  pc = cpkg_load(name);
+  if(!pc) {
+    fprintf(stderr, "Error: Package %s not present\n", name);
+    return NULL;
+  }
+  memset(&w, 0, sizeof(w));
+  w.verbose = verbose;
+  if(!cpkg_walk(pc, &w)) {
+    goto out;
+  }
+  /* system directories are implied */
+  if(!getenv("PKG_CONFIG_ALLOW_SYSTEM_CFLAGS")) {
+    incdirs = getenv("PKG_CONFIG_SYSTEM_INCLUDE_PATH");
+    cpkg_frag_filter(&w.cflags, 'I',
+                     incdirs ? incdirs : CPLR_PKGCONFIG_SYSTEM_INCLUDEDIRS);
+  }
+  if(!getenv("PKG_CONFIG_ALLOW_SYSTEM_LIBS")) {
+    libdirs = getenv("PKG_CONFIG_SYSTEM_LIBRARY_PATH");
+    cpkg_frag_filter(&w.libs, 'L',
+                     libdirs ? libdirs : CPLR_PKGCONFIG_SYSTEM_LIBDIRS);
+  }
+  out = open_memstream(&buf, &len);
+  cpkg_frag_render(out, &w.cflags);
+  cpkg_frag_render(out, &w.libs);
+  fclose(out);
+ out:
+  cpkg_frags_clear(&w.cflags);
+  cpkg_frags_clear(&w.libs);
+  return buf;
+}
+
+/* file listing state */
+typedef struct {
+  unsigned pass;
+  FILE *out;
+} cpkg_list_t;
+
+static bool cpkg_list(const char *name, const char *from, void *ctx) {
+  cpkg_list_t *l = ctx;
+  cpkg_pc_t *pc = cpkg_load(name);
+  /* missing packages fail when resolving */
+  if(!pc || pc->listed == l->pass) {
+    return true;
+  }
+  pc->listed = l->pass;
+  fprintf(l->out, "%s\n", pc->path);
+  if(pc->requires) {
+    cpkg_requires(pc->requires, pc->name, cpkg_list, l);
+  }
+  if(pc->requires_private) {
+    cpkg_requires(pc->requires_private, pc->name, cpkg_list, l);
+  }
+  return true;
+}
+
+char *cpkg_files(const char *name) {
+  static unsigned pass = 0;
+  cpkg_list_t l;
+  char *buf = NULL;
+  size_t len = 0;
+  l.pass = ++pass;
+  l.out = open_memstream(&buf, &len);
+  cpkg_list(name, NULL, &l);
+  fclose(l.out);
+  return buf;
+}
@@ -20,14 +20,18 @@
 #ifndef CPLR_PRIVATE_H
 #define CPLR_PRIVATE_H
 
+#include <sys/types.h>
 #include <assert.h>
 #include <ctype.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 
 #include <libtcc.h>
 
-#include <cext/list.h>
+#include <cext/intern.h>
+#include <cext/vector.h>
+#include <cext/memory.h>
 #include <cext/string.h>
 
 #include "cplr_config.h"
@@ -46,6 +50,15 @@ typedef enum {
    CPLR_FLAG_NORUN = (1<<4),
    CPLR_FLAG_FORK = (1<<5),
    CPLR_FLAG_INTERACTIVE = (1<<6),
+   CPLR_FLAG_NOCACHE = (1<<7),
+   CPLR_FLAG_WARM = (1<<8),
+   CPLR_FLAG_PKGCONFIG = (1<<9),
+   CPLR_FLAG_ZYGOTE = (1<<19),
+   CPLR_FLAG_LINES = (1<<20),
+   CPLR_FLAG_UNORDERED = (1<<21),
+   CPLR_FLAG_BENCH = (1<<22),
+   CPLR_FLAG_PROFILE = (1<<23),
+   CPLR_FLAG_TIERED = (1<<24),
 
    CPLR_FLAG_GENERATED = (1<<10),
    CPLR_FLAG_PREPARED = (1<<11),
@@ -53,8 +66,22 @@ typedef enum {
    CPLR_FLAG_LOADED = (1<<13),
    CPLR_FLAG_EXECUTED = (1<<14),
    CPLR_FLAG_FINISHED = (1<<15),
+   CPLR_FLAG_TRIMMED = (1<<16),
+   CPLR_FLAG_PINNED = (1<<17),
+   CPLR_FLAG_RELOCATED = (1<<18),
 } cplr_flag_t;
 
+/* output types */
+typedef enum {
+   CPLR_OUTPUT_MEMORY = 0,
+   CPLR_OUTPUT_EXE = 1,
+   CPLR_OUTPUT_DLL = 2,
+   CPLR_OUTPUT_OBJ = 3,
+   CPLR_OUTPUT_ASM = 4,
+   CPLR_OUTPUT_SOURCE = 5,
+   CPLR_OUTPUT_PREPROCESS = 6,
+} cplr_output_t;
+
 /* target environment */
 typedef enum {
    CPLR_TARGET_NONE = 0,
@@ -72,9 +99,73 @@ typedef enum {
    CPLR_GSTATE_STATEMENT = 5,
 } cplr_gstate_t;
 
+/* request sent from client to server */
+typedef struct {
+  /* always CPLR_REQUEST_MAGIC */
+  uint32_t magic;
+  /* number of arguments */
+  uint32_t argc;
+  /* number of environment variables */
+  uint32_t envc;
+  /* size of the strings following: cwd, arguments, environment */
+  uint32_t size;
+} cplr_request_t;
+
+/* statistics output */
+typedef enum {
+  CPLR_STATS_NONE = 0,
+  CPLR_STATS_TEXT = 1,
+  CPLR_STATS_JSON = 2,
+} cplr_statsfmt_t;
+
+/* timed phases */
+typedef enum {
+  CPLR_PHASE_OPTPARSE,
+  CPLR_PHASE_DEFAULTS,
+  CPLR_PHASE_GENERATE,
+  CPLR_PHASE_PREPARE,
+  CPLR_PHASE_COMPILE,
+  CPLR_PHASE_RELOCATE,
+  CPLR_PHASE_EXECUTE,
+  CPLR_PHASE_COUNT,
+} cplr_phase_t;
+
+/* timing of a package or source within a phase */
+typedef struct {
+  /* "package" or "source" */
+  const char *kind;
+  /* interned name */
+  const char *name;
+  /* milliseconds */
+  double ms;
+} cplr_timing_t;
+
+/* per-state timings and counters */
+typedef struct {
+  /* milliseconds per phase */
+  double phase[CPLR_PHASE_COUNT];
+  /* packages and sources */
+  cplr_timing_t *items;
+  size_t nitems;
+  /* bytes of generated code */
+  size_t generated;
+  /* symbols redefined by the state */
+  unsigned long redefined;
+  /* libraries given to the compiler */
+  unsigned long libraries;
+} cplr_stats_t;
+
+#define CPLR_REQUEST_MAGIC 0x63706c72
+#define CPLR_SOCKET_MAXFDS 3
+
 /* forward declarations */
 struct cplr;
 typedef struct cplr cplr_t;
+struct cplr_symtab;
+typedef struct cplr_symtab cplr_symtab_t;
+
+/* entry point of loaded objects */
+typedef int (*cplr_main_t)(int argc, char **argv);
 
 /* main state structure */
 struct cplr {
@@ -90,6 +181,18 @@ struct cplr {
   cplr_target_t target;
   /* output filename (memory if NULL) */
   char *out;
+  /* output type */
+  cplr_output_t otype;
+  /* server socket (not serving if NULL) */
+  char *server;
+  /* threads for --lines (0 for one per processor) */
+  int jobs;
+  /* folded stacks of --profile (default if NULL) */
+  char *profile;
+  /* statistics output */
+  cplr_statsfmt_t statsfmt;
+  /* timings and counters */
+  cplr_stats_t stats;
 
   /* complete argument count */
   int    argc;
@@ -106,49 +209,96 @@ struct cplr {
   cplr_t *c_prev;
   /* next in chain */
   cplr_t *c_next;
+  /* number of later states folded into this one */
+  int c_folded;
+  /* number of compilers reclaimed (first state only) */
+  int c_reclaimed;
 
   /* compiler state */
   TCCState *tcc;
   /* flag set on first compiler condition */
   bool tccerr;
 
+  /* symbol registry of an interactive session (first state only) */
+  cplr_symtab_t *s_syms;
+  /* registry lookups made by this state */
+  unsigned long sym_hits;
+  unsigned long sym_misses;
+  /* flag set once our symbols are in the registry */
+  bool sym_learned;
+  /* registry symbols we define and states importing them */
+  unsigned long sym_owned;
+  unsigned long sym_users;
+  /* states we import symbols from */
+  cplr_t **sym_deps;
+  size_t sym_ndeps;
+
+  /* loaded shared object and its entry point */
+  void *so_handle;
+  cplr_main_t so_main;
+  /* code cache key and object being compiled for it */
+  char *cache_key;
+  char *cache_tmp;
+  /* files the compiler reports opening, and our stdout meanwhile */
+  char *cache_deps;
+  int cache_stdout;
+
   /* code generation state */
   cplr_gstate_t g_state;
   /* state for line numbering */
   int   g_prevline;
-  char *g_prevfile;
-  /* output streams */
-  FILE *g_code;
-  FILE *g_dump;
-  /* stream buffers in case of memory streams */
+  const char *g_prevfile;
+  int   g_previndex;
+  /* output buffers with their length and capacity */
   char *g_codebuf;
+  size_t g_codelen;
+  size_t g_codecap;
   char *g_dumpbuf;
+  size_t g_dumplen;
+  size_t g_dumpcap;
+  /* length of the include sections in the code buffer */
+  size_t g_prologue_len;
+  /* cached header prologue replacing the include sections */
+  char *g_prologue;
+  /* session headers replacing the include sections (not owned) */
+  const char *g_headers;
+
+  /* preprocessed headers of an interactive session (first state only) */
+  char *s_headkey;
+  char *s_headers;
+
+  /* arena for piles */
+  cext_arena_t *arena;
 
   /* compiler options */
-  lh_t optf;
-  lh_t optm;
+  vh_t optf;
+  vh_t optm;
 
   /* stable piles (kept in chaining) */
-  lh_t defdef;
-  lh_t defsys;
-  lh_t sysdirs;
-  lh_t incdirs;
-  lh_t libdirs;
-  lh_t defs;
-  lh_t syss;
-  lh_t incs;
-  lh_t libs;
-  lh_t pkgs;
-  lh_t tlds;
+  vh_t defdef;
+  vh_t defsys;
+  vh_t sysdirs;
+  vh_t incdirs;
+  vh_t libdirs;
+  vh_t defs;
+  vh_t syss;
+  vh_t incs;
+  vh_t libs;
+  vh_t pkgs;
+  vh_t tlds;
 
   /* volatile piles (cleared in chaining) */
-  lh_t srcs;
-  lh_t tlfs;
-  lh_t stms;
-  lh_t befs;
-  lh_t afts;
+  vh_t srcs;
+  vh_t tlfs;
+  vh_t stms;
+  vh_t befs;
+  vh_t afts;
+  vh_t fins;
 };
 
+/* cplr_main.c - main program */
+extern int cplr_main(int argc, char **argv);
+
 /* cplr_state.c - piler state management */
 extern cplr_t *cplr_new(void);
 extern void cplr_free(cplr_t *c);
@@ -161,21 +311,41 @@ extern int cplr_optparse(cplr_t *c, int argc, char **argv);
 
 /* cplr_defaults.c - apply defaults */
 extern int cplr_defaults(cplr_t *c);
+extern const char *cplr_runtime_dir(void);
 
 /* cplr_prepare.c - generate C code (repeatable) */
 extern int cplr_generate(cplr_t *c);
 
 /* cplr_prepare.c - prepare C compiler (non-repeatable) */
 extern int cplr_prepare(cplr_t *c);
+extern int cplr_prepare_compiler(cplr_t *c);
+extern bool cplr_runtime_defines(const char *name);
+extern int cplr_tcc_prepare_libdir(cplr_t *c, TCCState *t);
+extern int cplr_tcc_prepare_paths(cplr_t *c, TCCState *t);
 
 /* cplr_compile.c - run C code (non-repeatable) */
 extern int cplr_compile(cplr_t *c);
+extern char *cplr_cc_cmdline(cplr_t *c, const char *out);
+extern bool cplr_output_links(cplr_t *c);
 
 /* cplr_execute.c - execute output (non-repeatable) */
 extern int cplr_execute(cplr_t *c);
 
+/* cplr_profile.c - sample the running program */
+extern void cplr_profile_define(cplr_t *c);
+extern void cplr_profile_finish(cplr_t *c);
+
 /* cplr_run.c -  prepare, generate, compile, execute (non-repeatable) */
 extern int cplr_run(cplr_t *c);
+extern double cplr_clock(void);
+extern int cplr_warm(cplr_t *c);
+
+/* cplr_stats.c - timings and counters */
+extern void cplr_stats_phase(cplr_t *c, cplr_phase_t p, double begin);
+extern void cplr_stats_item(cplr_t *c, const char *kind, const char *name, double begin);
+extern void cplr_stats_free(cplr_t *c);
+extern void cplr_stats_print(cplr_t *c, FILE *f, const char *indent);
+extern void cplr_stats_report(cplr_t *c);
 
 /* cplr_interact.c - run the interactor */
 extern int cplr_interact(cplr_t *c);
@@ -184,10 +354,78 @@ extern int cplr_interact(cplr_t *c);
 extern int cplr_command(cplr_t *c, const char *line);
 
 /* cplr_package.c - pkg-config routines */
+extern char *cplr_pkgconfig_resolve(cplr_t *c, const char *name);
 extern int cplr_pkgconfig_prepare(cplr_t *c, const char *name);
+extern int cplr_pkgconfig_apply(cplr_t *c, const char *name);
 extern int cplr_pkgconfig_add(cplr_t *c, const char *name, const char *args);
+extern void cplr_pkgconfig_start(cplr_t *c);
+extern void cplr_pkgconfig_join(cplr_t *c);
+
+/* cplr_cache.c - on-disk cache helpers */
+extern bool cplr_cache_enabled(cplr_t *c);
+extern char *cplr_cache_dir(const char *kind);
+extern char *cplr_cache_path(const char *kind, const char *name, const char *ext);
+extern char *cplr_cache_read(const char *path, size_t *lenp);
+extern char *cplr_cache_tmpname(const char *path);
+extern int cplr_cache_publish(const char *tmp, const char *path);
+extern int cplr_cache_write(const char *path, const void *buf, size_t len);
+extern char *cplr_cache_depline(const char *path);
+extern bool cplr_cache_depcheck(const char *deps);
+
+/* cplr_codecache.c - compiled code cache */
+extern bool cplr_codecache_usable(cplr_t *c);
+extern int cplr_codecache_load(cplr_t *c);
+extern void cplr_codecache_begin(cplr_t *c);
+extern int cplr_codecache_store(cplr_t *c);
+extern void cplr_codecache_finish(cplr_t *c);
+
+/* cplr_prologue.c - header prologue cache */
+extern int cplr_prologue_prepare(cplr_t *c);
+extern int cplr_prologue_session(cplr_t *c);
+extern char *cplr_prologue_depends(cplr_t *c);
+
+/* cplr_socket.c - unix socket helpers */
+extern int cplr_socket_connect(const char *path);
+extern int cplr_socket_listen(const char *path);
+extern bool cplr_socket_trusted(int fd);
+extern int cplr_socket_write(int fd, const void *buf, size_t len);
+extern int cplr_socket_read(int fd, void *buf, size_t len);
+extern int cplr_socket_sendfds(int fd, const void *buf, size_t len,
+                               const int *fds, int nfds);
+extern int cplr_socket_recvfds(int fd, void *buf, size_t len,
+                               int *fds, int nfds);
+
+/* cplr_client.c - forward invocations to a server */
+extern int cplr_client(int argc, char **argv, int *ret);
+
+/* cplr_server.c - warm server with pre-forked workers */
+extern int cplr_serve(cplr_t *c);
+extern TCCState *cplr_server_take(cplr_t *c);
 
 /* cplr_symbols.c - symbol management */
 extern TCCState *cplr_find_syms(cplr_t *c);
+extern int cplr_symtab_resolve(cplr_t *c, const char *code);
+extern void cplr_symtab_report(cplr_t *c);
+extern void cplr_symtab_free(cplr_symtab_t *t);
+extern void cplr_symtab_learn(cplr_t *p);
+extern void cplr_symtab_release(cplr_t *c);
+
+/* cplr_reclaim.c - reclamation of old chain states */
+extern size_t cplr_reclaim_size(cplr_t *c);
+extern void cplr_reclaim(cplr_t *c);
+extern void cplr_reclaim_report(cplr_t *c);
+
+/* cplr_tier.c - promote functions to optimized code */
+extern bool cplr_tier_function(const char *def, size_t *pos, size_t *len, size_t *body);
+extern bool *cplr_tier_select(cplr_t *c);
+extern void cplr_tier_define(cplr_t *c);
+extern void cplr_tier_finish(cplr_t *c);
+
+/* cplr_zygote.c - run before statements once and fork per run */
+extern bool cplr_zygote_enabled(cplr_t *c);
+extern bool cplr_zygote_child(void);
+extern void cplr_zygote_define(cplr_t *c);
+extern void cplr_zygote_request(int argc, char **argv);
+extern int cplr_zygote(cplr_t *c);
 
 #endif /* CPLR_PRIVATE_H */
@@ -0,0 +1,249 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "cplr.h"
+
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cext/memory.h>
+
+bool cplr_cache_enabled(cplr_t *c) {
+  if(c->flag & CPLR_FLAG_NOCACHE) {
+    return false;
+  }
+  if(getenv("CPLR_NOCACHE")) {
+    return false;
+  }
+  return true;
+}
+
+static int cplr_cache_mkdirs(char *path) {
+  char *p;
+  /* create each component in turn */
+  for(p = path + 1; *p; p++) {
+    if(*p == '/') {
+      *p = 0;
+      if(mkdir(path, 0755) && errno != EEXIST) {
+        *p = '/';
+        return 1;
+      }
+      *p = '/';
+    }
+  }
+  if(mkdir(path, 0755) && errno != EEXIST) {
+    return 1;
+  }
+  return 0;
+}
+
+char *cplr_cache_dir(const char *kind) {
+  const char *env;
+  char *base, *res;
+  /* determine base directory */
+  if((env = getenv("CPLR_CACHE_DIR"))) {
+    base = strdup(env);
+  } else if((env = getenv("XDG_CACHE_HOME"))) {
+    base = msprintf("%s/cplr", env);
+  } else if((env = getenv("HOME"))) {
+    base = msprintf("%s/.cache/cplr", env);
+  } else {
+    return NULL;
+  }
+  /* append kind and create */
+  res = msprintf("%s/%s", base, kind);
+  cext_free(base);
+  if(cplr_cache_mkdirs(res)) {
+    cext_free(res);
+    return NULL;
+  }
+  return res;
+}
+
+char *cplr_cache_path(const char *kind, const char *name, const char *ext) {
+  char *dir, *res;
+  dir = cplr_cache_dir(kind);
+  if(!dir) {
+    return NULL;
+  }
+  res = msprintf("%s/%s%s", dir, name, ext);
+  cext_free(dir);
+  return res;
+}
+
+char *cplr_cache_read(const char *path, size_t *lenp) {
+  struct stat st;
+  char *buf;
+  ssize_t res;
+  size_t done = 0;
+  int fd;
+  /* open and size the file */
+  fd = open(path, O_RDONLY|O_CLOEXEC);
+  if(fd < 0) {
+    return NULL;
+  }
+  if(fstat(fd, &st)) {
+    close(fd);
+    return NULL;
+  }
+  /* read all of it */
+  buf = cext_malloc(st.st_size + 1);
+  while(done < (size_t)st.st_size) {
+    res = read(fd, buf + done, st.st_size - done);
+    if(res < 0 && errno == EINTR) {
+      continue;
+    }
+    if(res <= 0) {
+      cext_free(buf);
+      close(fd);
+      return NULL;
+    }
+    done += res;
+  }
+  close(fd);
+  buf[done] = 0;
+  if(lenp) {
+    *lenp = done;
+  }
+  return buf;
+}
+
+char *cplr_cache_tmpname(const char *path) {
+  char *tmp;
+  int fd;
+  /* unique even among threads, next to the target for rename */
+  tmp = msprintf("%s.XXXXXX.tmp", path);
+  fd = mkstemps(tmp, 4);
+  if(fd < 0) {
+    cext_free(tmp);
+    return NULL;
+  }
+  fchmod(fd, 0644);
+  close(fd);
+  return tmp;
+}
+
+int cplr_cache_publish(const char *tmp, const char *path) {
+  /* rename is atomic within the cache directory */
+  if(rename(tmp, path)) {
+    unlink(tmp);
+    return 1;
+  }
+  return 0;
+}
+
+int cplr_cache_write(const char *path, const void *buf, size_t len) {
+  const char *p = buf;
+  char *tmp;
+  ssize_t res;
+  size_t done = 0;
+  int fd;
+  /* write to a private temporary */
+  tmp = cplr_cache_tmpname(path);
+  if(!tmp) {
+    return 1;
+  }
+  fd = open(tmp, O_WRONLY|O_TRUNC|O_CLOEXEC);
+  if(fd < 0) {
+    unlink(tmp);
+    cext_free(tmp);
+    return 1;
+  }
+  while(done < len) {
+    res = write(fd, p + done, len - done);
+    if(res < 0 && errno == EINTR) {
+      continue;
+    }
+    if(res <= 0) {
+      close(fd);
+      unlink(tmp);
+      cext_free(tmp);
+      return 1;
+    }
+    done += res;
+  }
+  if(close(fd)) {
+    unlink(tmp);
+    cext_free(tmp);
+    return 1;
+  }
+  /* publish it */
+  res = cplr_cache_publish(tmp, path);
+  cext_free(tmp);
+  return res;
+}
+
+char *cplr_cache_depline(const char *path) {
+  struct stat st;
+  if(stat(path, &st)) {
+    return NULL;
+  }
+  return msprintf("D %lld %ld %lld %s\n",
+                  (long long)st.st_mtim.tv_sec,
+                  (long)st.st_mtim.tv_nsec,
+                  (long long)st.st_size,
+                  path);
+}
+
+bool cplr_cache_depcheck(const char *deps) {
+  const char *cur = deps, *end;
+  long long sec, size;
+  long nsec;
+  int pos;
+  struct stat st;
+  char cwd[PATH_MAX];
+  char *path;
+  bool ret = true;
+  /* check every dependency line */
+  while(ret && *cur) {
+    end = strchr(cur, '\n');
+    if(!end) {
+      end = cur + strlen(cur);
+    }
+    /* relative paths are only valid in their directory */
+    if(strprefix(cur, "C ")) {
+      if(!getcwd(cwd, sizeof(cwd))
+         || strlen(cwd) != (size_t)(end - (cur + 2))
+         || strncmp(cur + 2, cwd, end - (cur + 2))) {
+        ret = false;
+      }
+      cur = *end ? end + 1 : end;
+      continue;
+    }
+    if(sscanf(cur, "D %lld %ld %lld %n", &sec, &nsec, &size, &pos) != 3
+       || (cur + pos) > end) {
+      ret = false;
+      break;
+    }
+    path = strndup(cur + pos, end - (cur + pos));
+    if(stat(path, &st)
+       || st.st_mtim.tv_sec != sec
+       || st.st_mtim.tv_nsec != nsec
+       || st.st_size != size) {
+      ret = false;
+    }
+    cext_free(path);
+    cur = *end ? end + 1 : end;
+  }
+  return ret;
+}
@@ -0,0 +1,195 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cplr.h"
+
+/*
+ * The client runs before anything else and must stay thin:
+ * no allocation, no collector, no compiler.
+ */
+
+extern char **environ;
+
+/* worker executing our request */
+static volatile pid_t client_worker = 0;
+
+/* signals forwarded to the worker */
+static const int client_signals[] = {
+  SIGHUP, SIGINT, SIGQUIT, SIGTERM, SIGWINCH, 0
+};
+
+static void cplr_client_signal(int sig) {
+  if(client_worker > 0) {
+    kill(client_worker, sig);
+  }
+}
+
+/* buffered writer for the request strings */
+typedef struct {
+  int fd;
+  size_t len;
+  char buf[16384];
+} client_out_t;
+
+static int cplr_client_put(client_out_t *o, const char *s) {
+  size_t n = strlen(s) + 1, c;
+  while(n) {
+    if(o->len == sizeof(o->buf)) {
+      if(cplr_socket_write(o->fd, o->buf, o->len)) {
+        return -1;
+      }
+      o->len = 0;
+    }
+    c = sizeof(o->buf) - o->len;
+    if(c > n) {
+      c = n;
+    }
+    memcpy(o->buf + o->len, s, c);
+    o->len += c;
+    s += c;
+    n -= c;
+  }
+  return 0;
+}
+
+static int cplr_client_send(int fd, int argc, char **argv, const char *cwd) {
+  static client_out_t out;
+  cplr_request_t req;
+  int fds[3] = { 0, 1, 2 };
+  size_t size;
+  int i, envc;
+
+  /* measure the strings */
+  size = strlen(cwd) + 1;
+  for(i = 0; i < argc; i++) {
+    size += strlen(argv[i]) + 1;
+  }
+  for(envc = 0; environ[envc]; envc++) {
+    size += strlen(environ[envc]) + 1;
+  }
+  if(size > UINT32_MAX) {
+    return -1;
+  }
+
+  /* header goes with our stdio */
+  req.magic = CPLR_REQUEST_MAGIC;
+  req.argc = argc;
+  req.envc = envc;
+  req.size = size;
+  if(cplr_socket_sendfds(fd, &req, sizeof(req), fds, 3)) {
+    return -1;
+  }
+
+  /* strings follow */
+  out.fd = fd;
+  out.len = 0;
+  if(cplr_client_put(&out, cwd)) {
+    return -1;
+  }
+  for(i = 0; i < argc; i++) {
+    if(cplr_client_put(&out, argv[i])) {
+      return -1;
+    }
+  }
+  for(i = 0; i < envc; i++) {
+    if(cplr_client_put(&out, environ[i])) {
+      return -1;
+    }
+  }
+  return cplr_socket_write(fd, out.buf, out.len);
+}
+
+int cplr_client(int argc, char **argv, int *ret) {
+  struct sigaction sa;
+  const char *path;
+  char cwd[PATH_MAX];
+  int32_t pid, status;
+  int fd, i;
+
+  /* only when a server is configured */
+  path = getenv("CPLR_SERVER");
+  if(!path || !*path) {
+    return 1;
+  }
+
+  /* servers serve themselves */
+  for(i = 1; i < argc; i++) {
+    if(!strcmp(argv[i], "--")) {
+      break;
+    }
+    if(strprefix(argv[i], "--server")) {
+      return 1;
+    }
+  }
+
+  /* fall back to local execution if the server is gone */
+  if(!getcwd(cwd, sizeof(cwd))) {
+    return 1;
+  }
+  fd = cplr_socket_connect(path);
+  if(fd < 0) {
+    return 1;
+  }
+
+  /* send the request and learn who runs it */
+  if(cplr_client_send(fd, argc, argv, cwd)
+     || cplr_socket_read(fd, &pid, sizeof(pid))) {
+    close(fd);
+    return 1;
+  }
+
+  /* from here on the request belongs to the server */
+  client_worker = pid;
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = cplr_client_signal;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  for(i = 0; client_signals[i]; i++) {
+    sigaction(client_signals[i], &sa, NULL);
+  }
+
+  /* wait for the exit status */
+  if(cplr_socket_read(fd, &status, sizeof(status))) {
+    fprintf(stderr, "Error: Lost connection to server\n");
+    *ret = 1;
+    goto out;
+  }
+
+  /* die the same way as the worker, the core is elsewhere */
+  if(WIFSIGNALED(status)) {
+    struct rlimit rl = { 0, 0 };
+    setrlimit(RLIMIT_CORE, &rl);
+    signal(WTERMSIG(status), SIG_DFL);
+    raise(WTERMSIG(status));
+    *ret = 128 + WTERMSIG(status);
+  } else {
+    *ret = WEXITSTATUS(status);
+  }
+
+ out:
+  close(fd);
+  return 0;
+}
@@ -0,0 +1,626 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compiled code cache
+ *
+ * Generated code is compiled into a shared object which is stored
+ * under a hash of the code and all compiler inputs. Later runs with
+ * identical inputs load the object directly, skipping preparation
+ * and compilation entirely. The compiler reports every file it opens
+ * while the entry is built, which together with the headers of the
+ * prologue are the dependencies checked on each hit.
+ *
+ * Entries are published atomically by renaming. Access times and sizes
+ * live in a shared index that is mapped by all processes, which is used
+ * to evict the least recently used entries once the size limit is hit.
+ * Updates to the index are serialized using a file lock.
+ */
+
+#include "cplr.h"
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <cext/hash.h>
+#include <cext/memory.h>
+
+/* index magic and geometry */
+#define CODECACHE_MAGIC 0x31786463726c7063ULL
+#define CODECACHE_SLOTS 1024
+
+/* default size limit in megabytes */
+#define CODECACHE_LIMIT 256
+
+/* index slot, key 0 means free */
+typedef struct {
+  uint64_t key;
+  uint64_t size;
+  uint64_t atime;
+} ccslot_t;
+
+/* the mapped index */
+typedef struct {
+  uint64_t magic;
+  uint64_t slots;
+  ccslot_t slot[CODECACHE_SLOTS];
+} ccindex_t;
+
+static uint64_t cplr_codecache_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t cplr_codecache_limit(void) {
+  const char *env = getenv("CPLR_CACHE_LIMIT");
+  unsigned long long mb = CODECACHE_LIMIT;
+  if(env) {
+    mb = strtoull(env, NULL, 10);
+  }
+  return mb * 1024 * 1024;
+}
+
+static ccindex_t *cplr_codecache_index(int *fdp) {
+  struct stat st;
+  ccindex_t *idx;
+  char *path;
+  int fd;
+  /* open the index file */
+  path = cplr_cache_path("code", "index", "");
+  if(!path) {
+    return NULL;
+  }
+  fd = open(path, O_RDWR|O_CREAT|O_CLOEXEC, 0644);
+  cext_free(path);
+  if(fd < 0) {
+    return NULL;
+  }
+  /* initialize under lock if new */
+  if(fstat(fd, &st) || st.st_size < (off_t)sizeof(ccindex_t)) {
+    flock(fd, LOCK_EX);
+    if(fstat(fd, &st) || st.st_size < (off_t)sizeof(ccindex_t)) {
+      if(ftruncate(fd, sizeof(ccindex_t))) {
+        flock(fd, LOCK_UN);
+        close(fd);
+        return NULL;
+      }
+    }
+    flock(fd, LOCK_UN);
+  }
+  /* map it */
+  idx = mmap(NULL, sizeof(ccindex_t), PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(idx == MAP_FAILED) {
+    close(fd);
+    return NULL;
+  }
+  *fdp = fd;
+  return idx;
+}
+
+static void cplr_codecache_unindex(ccindex_t *idx, int fd) {
+  munmap(idx, sizeof(ccindex_t));
+  close(fd);
+}
+
+static ccslot_t *cplr_codecache_find(ccindex_t *idx, uint64_t key) {
+  int i;
+  for(i = 0; i < CODECACHE_SLOTS; i++) {
+    if(__atomic_load_n(&idx->slot[i].key, __ATOMIC_RELAXED) == key) {
+      return &idx->slot[i];
+    }
+  }
+  return NULL;
+}
+
+static void cplr_codecache_touch(uint64_t key) {
+  ccindex_t *idx;
+  ccslot_t *s;
+  int fd;
+  idx = cplr_codecache_index(&fd);
+  if(!idx) {
+    return;
+  }
+  s = cplr_codecache_find(idx, key);
+  if(s) {
+    __atomic_store_n(&s->atime, cplr_codecache_now(), __ATOMIC_RELAXED);
+  }
+  cplr_codecache_unindex(idx, fd);
+}
+
+static void cplr_codecache_remove(uint64_t key) {
+  cext_hash_t h = { key };
+  char hex[CEXT_HASH_HEXLEN];
+  char *path;
+  cext_hash_hex(&h, hex);
+  /* key first so that the entry is never seen half-removed */
+  if((path = cplr_cache_path("code", hex, ".key"))) {
+    unlink(path);
+    cext_free(path);
+  }
+  if((path = cplr_cache_path("code", hex, ".so"))) {
+    unlink(path);
+    cext_free(path);
+  }
+}
+
+static void cplr_codecache_account(uint64_t key, uint64_t size) {
+  uint64_t total, limit = cplr_codecache_limit();
+  ccslot_t *s, *lru;
+  ccindex_t *idx;
+  int fd, i;
+  idx = cplr_codecache_index(&fd);
+  if(!idx) {
+    return;
+  }
+  flock(fd, LOCK_EX);
+  idx->magic = CODECACHE_MAGIC;
+  idx->slots = CODECACHE_SLOTS;
+  /* find or allocate a slot */
+  s = cplr_codecache_find(idx, key);
+  if(!s) {
+    s = cplr_codecache_find(idx, 0);
+  }
+  if(!s) {
+    /* full - replace the least recently used */
+    lru = &idx->slot[0];
+    for(i = 1; i < CODECACHE_SLOTS; i++) {
+      if(idx->slot[i].atime < lru->atime) {
+        lru = &idx->slot[i];
+      }
+    }
+    cplr_codecache_remove(lru->key);
+    s = lru;
+  }
+  s->size = size;
+  s->atime = cplr_codecache_now();
+  __atomic_store_n(&s->key, key, __ATOMIC_RELEASE);
+  /* evict until within limit */
+  while(1) {
+    total = 0;
+    lru = NULL;
+    for(i = 0; i < CODECACHE_SLOTS; i++) {
+      ccslot_t *x = &idx->slot[i];
+      if(!x->key) {
+        continue;
+      }
+      total += x->size;
+      if(x != s && (!lru || x->atime < lru->atime)) {
+        lru = x;
+      }
+    }
+    if(total <= limit || !lru) {
+      break;
+    }
+    cplr_codecache_remove(lru->key);
+    __atomic_store_n(&lru->key, 0, __ATOMIC_RELEASE);
+    lru->size = 0;
+    lru->atime = 0;
+  }
+  flock(fd, LOCK_UN);
+  cplr_codecache_unindex(idx, fd);
+}
+
+static void cplr_codecache_key_pile(FILE *f, const char *name, vh_t *list) {
+  value_t *i;
+  V_FORWARD(list, i) {
+    fprintf(f, "%s %s\n", name, value_get_str(i));
+  }
+}
+
+static char *cplr_codecache_key(cplr_t *c) {
+  char *buf = NULL, *dep, *self, *flags;
+  const char *libdir = getenv("CPLR_TINYCC_LIBDIR");
+  size_t len = 0;
+  value_t *i;
+  FILE *f;
+#ifndef CPLR_TINYCC_EXTERNAL
+  if(!libdir) {
+    libdir = CPLR_TINYCC_LIBDIR;
+  }
+#endif
+  f = open_memstream(&buf, &len);
+  /* the compiler itself */
+  fprintf(f, "cplr " CPLR_VERSION_STRING "\n");
+  self = realpath("/proc/self/exe", NULL);
+  if(self && (dep = cplr_cache_depline(self))) {
+    fputs(dep, f);
+    cext_free(dep);
+  }
+  cext_lfree(self);
+  fprintf(f, "libdir %s\n", libdir ? libdir : "");
+  /* all prepare inputs */
+  cplr_codecache_key_pile(f, "optf", &c->optf);
+  cplr_codecache_key_pile(f, "optm", &c->optm);
+  cplr_codecache_key_pile(f, "defdef", &c->defdef);
+  cplr_codecache_key_pile(f, "defs", &c->defs);
+  cplr_codecache_key_pile(f, "sysdir", &c->sysdirs);
+  cplr_codecache_key_pile(f, "incdir", &c->incdirs);
+  cplr_codecache_key_pile(f, "libdir", &c->libdirs);
+  cplr_codecache_key_pile(f, "lib", &c->libs);
+  /* packages by what they resolve to */
+  V_FORWARD(&c->pkgs, i) {
+    flags = cplr_pkgconfig_resolve(c, value_get_str(i));
+    if(!flags) {
+      fclose(f);
+      cext_free(buf);
+      return NULL;
+    }
+    fprintf(f, "pkg %s %s\n", value_get_str(i), flags);
+    cext_free(flags);
+  }
+  /* source files by content */
+  V_FORWARD(&c->srcs, i) {
+    dep = cplr_cache_depline(value_get_str(i));
+    if(!dep) {
+      fclose(f);
+      cext_free(buf);
+      return NULL;
+    }
+    fprintf(f, "src %s", dep);
+    cext_free(dep);
+  }
+  /* the generated code */
+  fprintf(f, "code %zu\n", strlen(c->g_codebuf));
+  fputs(c->g_codebuf, f);
+  fputc('\n', f);
+  fclose(f);
+  return buf;
+}
+
+bool cplr_codecache_usable(cplr_t *c) {
+  /* only for plain runs of the tcc backend */
+  if(!cplr_cache_enabled(c)) {
+    return false;
+  }
+  if(c->backend != CPLR_BACKEND_LIBTCC) {
+    return false;
+  }
+  /* interactive states must keep their compiler for chaining */
+  if(c->flag & CPLR_FLAG_INTERACTIVE) {
+    return false;
+  }
+  if(c->out || c->c_prev) {
+    return false;
+  }
+  /* a zygote, the profiler and tiers call back into us */
+  if(c->flag & (CPLR_FLAG_ZYGOTE|CPLR_FLAG_PROFILE|CPLR_FLAG_TIERED)) {
+    return false;
+  }
+  return true;
+}
+
+/* hash of the key from the lookup */
+static void cplr_codecache_hash(cplr_t *c, cext_hash_t *h, char *hex) {
+  cext_hash_init(h);
+  cext_hash_str(h, c->cache_key);
+  if(!h->h) {
+    h->h = 1;
+  }
+  cext_hash_hex(h, hex);
+}
+
+/* load the object the way a cache hit does */
+static int cplr_codecache_open(cplr_t *c, const char *path) {
+  void *dl;
+  dl = dlopen(path, RTLD_NOW|RTLD_LOCAL);
+  if(!dl) {
+    if(c->verbosity >= 1) {
+      fprintf(stderr, "Code cache entry unusable: %s\n", dlerror());
+    }
+    return 1;
+  }
+  c->so_main = (cplr_main_t)dlsym(dl, "main");
+  if(!c->so_main) {
+    dlclose(dl);
+    return 1;
+  }
+  c->so_handle = dl;
+  return 0;
+}
+
+int cplr_codecache_load(cplr_t *c) {
+  int ret = 1;
+  cext_hash_t h;
+  char hex[CEXT_HASH_HEXLEN];
+  char *key, *kpath = NULL, *spath = NULL, *stored = NULL;
+  size_t klen;
+
+  /* compute the key */
+  key = cplr_codecache_key(c);
+  if(!key) {
+    return 1;
+  }
+  cext_lptrfree((void**)&c->cache_key);
+  c->cache_key = key;
+  cplr_codecache_hash(c, &h, hex);
+
+  /* read the entry */
+  kpath = cplr_cache_path("code", hex, ".key");
+  spath = cplr_cache_path("code", hex, ".so");
+  if(!kpath || !spath) {
+    goto out;
+  }
+  stored = cplr_cache_read(kpath, NULL);
+  if(!stored) {
+    goto miss;
+  }
+
+  /* check key and header dependencies */
+  klen = strlen(key);
+  if(strncmp(stored, key, klen) || !strprefix(stored + klen, "--\n")) {
+    goto miss;
+  }
+  if(!cplr_cache_depcheck(stored + klen + 3)) {
+    goto miss;
+  }
+
+  /* load the object */
+  if(cplr_codecache_open(c, spath)) {
+    goto miss;
+  }
+
+  /* record the access */
+  cplr_codecache_touch(h.h);
+
+  /* report */
+  if(c->verbosity >= 1) {
+    fprintf(stderr, "Code cache hit %s\n", hex);
+  }
+  ret = 0;
+  goto out;
+
+ miss:
+  if(c->verbosity >= 1) {
+    fprintf(stderr, "Code cache miss %s\n", hex);
+  }
+
+ out:
+  cext_lfree(stored);
+  cext_lfree(spath);
+  cext_lfree(kpath);
+  return ret;
+}
+
+/* append the files the compiler reported opening */
+static int cplr_codecache_reported(const char *path, FILE *f, bool *relative) {
+  char *text, *file, *dep;
+  const char *cur, *end;
+  vh_t seen;
+  text = cplr_cache_read(path, NULL);
+  if(!text) {
+    return 1;
+  }
+  v_init(&seen);
+  /* lines of the form '-> file', indented by include depth */
+  for(cur = text; *cur; cur = *end ? end + 1 : end) {
+    end = strchrnul(cur, '\n');
+    if(!strprefix(cur, "-> ")) {
+      continue;
+    }
+    for(cur += 3; cur < end && *cur == ' '; cur++);
+    if(cur == end) {
+      continue;
+    }
+    file = cext_strndup(cur, end - cur);
+    if(v_find_str(&seen, file)) {
+      cext_free(file);
+      continue;
+    }
+    if(file[0] != '/') {
+      *relative = true;
+    }
+    dep = cplr_cache_depline(file);
+    if(dep) {
+      fputs(dep, f);
+      cext_free(dep);
+    }
+    v_append_str_owned(&seen, file);
+  }
+  v_clear(&seen);
+  cext_free(text);
+  return 0;
+}
+
+/* headers of the prologue and of the compilation itself */
+static char *cplr_codecache_depends(cplr_t *c) {
+  char *buf = NULL, *deps, *line;
+  char cwd[PATH_MAX];
+  bool relative = false;
+  size_t len = 0;
+  int ret;
+  FILE *f;
+  f = open_memstream(&buf, &len);
+  /* the prologue knows the headers it was built from */
+  deps = cplr_prologue_depends(c);
+  if(deps) {
+    line = deps;
+    if(strprefix(deps, "C ")) {
+      relative = true;
+      line = strchrnul(deps, '\n');
+      line += *line ? 1 : 0;
+    }
+    fputs(line, f);
+    cext_free(deps);
+  }
+  /* the compiler told us about everything else */
+  ret = cplr_codecache_reported(c->cache_deps, f, &relative);
+  fclose(f);
+  if(ret) {
+    cext_free(buf);
+    return NULL;
+  }
+  /* relative headers tie the entry to our directory */
+  if(relative) {
+    if(!getcwd(cwd, sizeof(cwd))) {
+      cext_free(buf);
+      return NULL;
+    }
+    deps = msprintf("C %s\n%s", cwd, buf);
+    cext_free(buf);
+    return deps;
+  }
+  return buf;
+}
+
+/* stop collecting what the compiler reports */
+static void cplr_codecache_unlisten(cplr_t *c) {
+  if(c->cache_stdout >= 0) {
+    fflush(stdout);
+    dup2(c->cache_stdout, 1);
+    close(c->cache_stdout);
+    c->cache_stdout = -1;
+  }
+}
+
+void cplr_codecache_begin(cplr_t *c) {
+  cext_hash_t h;
+  char hex[CEXT_HASH_HEXLEN];
+  char *spath, *dpath;
+  int fd;
+
+  /* need the key from the lookup */
+  if(!c->cache_key) {
+    return;
+  }
+  cplr_codecache_hash(c, &h, hex);
+  spath = cplr_cache_path("code", hex, ".so");
+  dpath = cplr_cache_path("code", hex, ".dep");
+  if(!spath || !dpath) {
+    cext_lfree(dpath);
+    cext_lfree(spath);
+    return;
+  }
+
+  /* compile into a private file instead of memory */
+  c->cache_tmp = cplr_cache_tmpname(spath);
+  if(!c->cache_tmp) {
+    cext_free(dpath);
+    cext_free(spath);
+    return;
+  }
+  c->out = strdup(c->cache_tmp);
+  c->otype = CPLR_OUTPUT_DLL;
+
+  /* the compiler lists the files it opens on stdout at -vv */
+  c->cache_deps = cplr_cache_tmpname(dpath);
+  fd = c->cache_deps ? open(c->cache_deps, O_WRONLY|O_APPEND|O_CLOEXEC) : -1;
+  if(fd >= 0) {
+    fflush(stdout);
+    c->cache_stdout = dup(1);
+    if(c->cache_stdout < 0 || dup2(fd, 1) < 0) {
+      cplr_codecache_unlisten(c);
+      close(fd);
+      fd = -1;
+    } else {
+      close(fd);
+    }
+  }
+  /* without the report the entry can not be kept */
+  if(fd < 0 && c->cache_deps) {
+    unlink(c->cache_deps);
+    cext_ptrfree((void**)&c->cache_deps);
+  }
+  cext_free(dpath);
+  cext_free(spath);
+}
+
+int cplr_codecache_store(cplr_t *c) {
+  int ret = 1;
+  struct stat st;
+  cext_hash_t h;
+  char hex[CEXT_HASH_HEXLEN];
+  char *kpath = NULL, *spath = NULL, *deps = NULL, *entry = NULL;
+
+  /* only after compiling with begin */
+  if(!c->cache_tmp) {
+    return 1;
+  }
+  cplr_codecache_unlisten(c);
+  cext_lptrfree((void**)&c->out);
+  c->otype = CPLR_OUTPUT_MEMORY;
+  cplr_codecache_hash(c, &h, hex);
+  kpath = cplr_cache_path("code", hex, ".key");
+  spath = cplr_cache_path("code", hex, ".so");
+  if(!kpath || !spath || stat(c->cache_tmp, &st)) {
+    goto out;
+  }
+
+  /* run from the object like after a hit, even if it can not be kept */
+  if(cplr_codecache_open(c, c->cache_tmp)) {
+    goto out;
+  }
+  c->flag |= CPLR_FLAG_LOADED;
+  ret = 0;
+
+  /* entries must know their headers */
+  deps = c->cache_deps ? cplr_codecache_depends(c) : NULL;
+  if(!deps) {
+    if(c->verbosity >= 1) {
+      fprintf(stderr, "Code cache not updated, headers unknown\n");
+    }
+    goto out;
+  }
+
+  /* publish object, then key */
+  if(cplr_cache_publish(c->cache_tmp, spath)) {
+    goto out;
+  }
+  cext_ptrfree((void**)&c->cache_tmp);
+  entry = msprintf("%s--\n%s", c->cache_key, deps);
+  if(cplr_cache_write(kpath, entry, strlen(entry)) == 0) {
+    /* account and evict */
+    cplr_codecache_account(h.h, st.st_size);
+    if(c->verbosity >= 2) {
+      fprintf(stderr, "Cached code as %s\n", hex);
+    }
+  }
+
+ out:
+  cplr_codecache_finish(c);
+  cext_lfree(entry);
+  cext_lfree(deps);
+  cext_lfree(spath);
+  cext_lfree(kpath);
+  return ret;
+}
+
+void cplr_codecache_finish(cplr_t *c) {
+  /* drop the compiler report */
+  cplr_codecache_unlisten(c);
+  if(c->cache_deps) {
+    unlink(c->cache_deps);
+    cext_ptrfree((void**)&c->cache_deps);
+  }
+  /* drop an object that did not make it into the cache */
+  if(c->cache_tmp) {
+    unlink(c->cache_tmp);
+    cext_ptrfree((void**)&c->cache_tmp);
+  }
+}
@@ -43,6 +43,7 @@ static int cmd_syms(cplr_t *c, int argc, char **argv);
 static int cmd_dump(cplr_t *c, int argc, char **argv);
 static int cmd_opts(cplr_t *c, int argc, char **argv);
 static int cmd_stat(cplr_t *c, int argc, char **argv);
+static int cmd_bench(cplr_t *c, int argc, char **argv);
 static int cmd_help(cplr_t *c, int argc, char **argv);
 static int cmd_quit(cplr_t *c, int argc, char **argv);
 
@@ -52,6 +53,7 @@ static command_t commands[] = {
 { "d", "Show dump",     cmd_dump },
 { "o", "Show opts",     cmd_opts },
 { "s", "Show stat",     cmd_stat },
+{ "bench", "Time the pile", cmd_bench },
 { "?", "Show help",     cmd_help },
 { "q", "Quit",          cmd_quit },
 { NULL, NULL, NULL },
@@ -176,30 +178,30 @@ int cplr_command(cplr_t *c, const char *line) {
 
     /* declaration */
   case '@':
-    l_append_str_owned(&c->tlds, strdup(line+1));
+    v_append_str_owned(&c->tlds, strdup(line+1));
     goto out;
     /* toplevel */
   case '^':
-    l_append_str_owned(&c->tlfs, strdup(line+1));
+    v_append_str_owned(&c->tlfs, strdup(line+1));
     goto out;
     /* before */
   case '<':
-    l_append_str_owned(&c->befs, strdup(line+1));
+    v_append_str_owned(&c->befs, strdup(line+1));
     goto out;
     /* after */
   case '>':
-    l_append_str_owned(&c->afts, strdup(line+1));
+    v_append_str_owned(&c->afts, strdup(line+1));
     goto out;
     /* statement */
   case '.':
     if(strlen(line+1)) {
-      l_append_str_owned(&c->stms, strdup(line+1));
+      v_append_str_owned(&c->stms, strdup(line+1));
       goto out;
     }
     break;
 
   default:
-    l_append_str_owned(&c->stms, strdup(line));
+    v_append_str_owned(&c->stms, strdup(line));
     break;
   }
 
@@ -246,11 +248,11 @@ static void print_help(void) {
   fprintf(stderr, "\n");
 }
 
-static bool print_pile(cplr_t *c, const char *name, lh_t *list, bool compact, bool reverse) {
+static bool print_pile(cplr_t *c, const char *name, vh_t *list, bool compact, bool reverse) {
   int i;
-  ln_t *n;
+  value_t *n;
 
-  if(l_empty(list)) {
+  if(v_empty(list)) {
     return false;
   }
 
@@ -260,21 +262,21 @@ static bool print_pile(cplr_t *c, const char *name, lh_t *list, bool compact, bo
 
   if(reverse) {
     i = 0;
-    L_BACKWARDS(list, n) {
+    V_BACKWARDS(list, n) {
       if(compact) {
-        fprintf(stderr, " %s", value_get_str(&n->v));
+        fprintf(stderr, " %s", value_get_str(n));
       } else {
-        fprintf(stderr, "c%d%s%d: %s\n", c->c_index, name, i, value_get_str(&n->v));
+        fprintf(stderr, "c%d%s%d: %s\n", c->c_index, name, i, value_get_str(n));
       }
       i++;
     }
   } else {
     i = 0;
-    L_FORWARD(list, n) {
+    V_FORWARD(list, n) {
       if(compact) {
-        fprintf(stderr, " %s", value_get_str(&n->v));
+        fprintf(stderr, " %s", value_get_str(n));
       } else {
-        fprintf(stderr, "c%d%s%d: %s\n", c->c_index, name, i, value_get_str(&n->v));
+        fprintf(stderr, "c%d%s%d: %s\n", c->c_index, name, i, value_get_str(n));
       }
       i++;
     }
@@ -299,6 +301,7 @@ static int print_piles(cplr_t *c) {
   print_pile(c, "b", &c->befs, false, false);
   print_pile(c, "s", &c->stms, false, false);
   print_pile(c, "a", &c->afts, false, true);
+  print_pile(c, "f", &c->fins, false, false);
 
   return 0;
 }
@@ -349,6 +352,8 @@ static int cmd_opts(cplr_t *c, int argc, char **argv) {
 }
 
 static int cmd_stat(cplr_t *c, int argc, char **argv) {
+  unsigned long allocs, bytes;
+  size_t strings, sbytes;
   cplr_t *cur;
   for(cur = c->c_first; cur; cur = cur->c_next) {
     fprintf(stderr, "c%d:", cur->c_index);
@@ -367,8 +372,24 @@ static int cmd_stat(cplr_t *c, int argc, char **argv) {
     if(cur->flag & CPLR_FLAG_FINISHED) {
       fprintf(stderr, " finished");
     }
+    if(cur->c_folded) {
+      fprintf(stderr, " (folded %d)", cur->c_folded);
+    }
+    fprintf(stderr, " (mem %zu%s)", cplr_reclaim_size(cur),
+            cur->tcc ? " + compiler" : "");
+    if(cur->sym_hits || cur->sym_misses) {
+      fprintf(stderr, " (syms %lu hits, %lu misses)",
+              cur->sym_hits, cur->sym_misses);
+    }
     fprintf(stderr, "\n");
+    cplr_stats_print(cur, stderr, "    ");
   }
+  cplr_symtab_report(c);
+  cplr_reclaim_report(c);
+  cext_memory_stats(&allocs, &bytes);
+  fprintf(stderr, "alloc: %lu allocations, %lu bytes\n", allocs, bytes);
+  cext_intern_stats(&strings, &sbytes);
+  fprintf(stderr, "intern: %zu strings, %zu bytes\n", strings, sbytes);
   return 0;
 }
 
@@ -396,6 +417,21 @@ static int cmd_syms(cplr_t *c, int argc, char **argv) {
   }
 }
 
+static int cmd_bench(cplr_t *c, int argc, char **argv) {
+  cplr_flag_t keep = c->flag & CPLR_FLAG_BENCH;
+  if(c->flag & CPLR_FLAG_LINES) {
+    fprintf(stderr, "Cannot time lines.\n");
+    return 0;
+  }
+  /* run the pile like '.' does, but in a timing loop */
+  c->flag |= CPLR_FLAG_BENCH;
+  if(cplr_run(c)) {
+    fprintf(stderr, "Run failed\n");
+  }
+  c->flag = (c->flag & ~CPLR_FLAG_BENCH) | keep;
+  return 0;
+}
+
 static int cmd_help(cplr_t *c, int argc, char **argv) {
   print_help();
   return 0;
@@ -21,62 +21,343 @@
 
 #include <cext/string.h>
 
-static int cplr_cc_compile(cplr_t *c) {
+#include <sys/wait.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+bool cplr_output_links(cplr_t *c) {
+  switch(c->otype) {
+  case CPLR_OUTPUT_MEMORY:
+  case CPLR_OUTPUT_EXE:
+  case CPLR_OUTPUT_DLL:
+    return true;
+  default:
+    return false;
+  }
+}
+
+/* generated source goes out as it is */
+static int cplr_compile_source(cplr_t *c) {
+  FILE *f = stdout;
+  size_t n;
+  if(strcmp(c->out, "-")) {
+    f = fopen(c->out, "w");
+    if(!f) {
+      fprintf(stderr, "Failed to open %s\n", c->out);
+      return 1;
+    }
+  }
+  n = fwrite(c->g_codebuf, 1, c->g_codelen, f);
+  if(f == stdout ? fflush(f) : fclose(f)) {
+    n = 0;
+  }
+  if(n != c->g_codelen) {
+    fprintf(stderr, "Failed to output file %s\n", c->out);
+    return 1;
+  }
+  c->flag |= CPLR_FLAG_COMPILED;
+  return 0;
+}
+
+/* system compiler and its optimization */
+static const char *cplr_cc_command(void) {
+  const char *cc = getenv("CPLR_CC");
+  return (cc && *cc) ? cc : "cc -O2";
+}
+
+/* append a quoted argument to a command */
+static void cplr_cc_arg(FILE *f, const char *pfx, const char *arg) {
+  const char *p;
+  fprintf(f, " '%s", pfx);
+  for(p = arg; *p; p++) {
+    if(*p == '\'') {
+      fputs("'\\''", f);
+    } else {
+      fputc(*p, f);
+    }
+  }
+  fputc('\'', f);
+}
+
+static void cplr_cc_pile(FILE *f, const char *pfx, vh_t *l) {
+  value_t *i;
+  V_FORWARD(l, i) {
+    cplr_cc_arg(f, pfx, value_get_str(i));
+  }
+}
+
+char *cplr_cc_cmdline(cplr_t *c, const char *out) {
+  const char *dir = cplr_runtime_dir();
+  char *buf = NULL, *lib;
+  size_t len = 0;
+  value_t *i;
+  FILE *f;
+  f = open_memstream(&buf, &len);
+  fputs(cplr_cc_command(), f);
+  switch(c->otype) {
+  case CPLR_OUTPUT_MEMORY:
+    /* loaded code is a shared object, preferring its own symbols */
+    fputs(" -shared -fPIC -Wl,-Bsymbolic", f);
+    break;
+  case CPLR_OUTPUT_DLL:
+    fputs(" -shared -fPIC", f);
+    break;
+  case CPLR_OUTPUT_OBJ:
+    /* one relocatable object, including the sources */
+    fputs(" -fPIC -r -nostdlib", f);
+    break;
+  case CPLR_OUTPUT_ASM:
+    fputs(" -S", f);
+    break;
+  case CPLR_OUTPUT_PREPROCESS:
+    fputs(" -E", f);
+    break;
+  default:
+    break;
+  }
+  fputs(" -pthread -o", f);
+  cplr_cc_arg(f, "", out);
+  /* preprocessor */
+  cplr_cc_pile(f, "", &c->defdef);
+  cplr_cc_pile(f, "", &c->defs);
+  V_FORWARD(&c->sysdirs, i) {
+    fputs(" -isystem", f);
+    cplr_cc_arg(f, "", value_get_str(i));
+  }
+  cplr_cc_pile(f, "-I", &c->incdirs);
+  fputs(" -I.", f);
+  /* compiler and machine options */
+  cplr_cc_pile(f, "-f", &c->optf);
+  cplr_cc_pile(f, "-m", &c->optm);
+  /* generated code comes through the pipe */
+  fputs(" -x c -", f);
+  /* text output is about the generated code alone */
+  if(c->otype == CPLR_OUTPUT_ASM || c->otype == CPLR_OUTPUT_PREPROCESS) {
+    fclose(f);
+    return buf;
+  }
+  fputs(" -x none", f);
+  cplr_cc_pile(f, "", &c->srcs);
+  if(!cplr_output_links(c)) {
+    fclose(f);
+    return buf;
+  }
+  /* runtime, linked into the object itself */
+  if(dir) {
+    lib = msprintf("%s/libcplrrt.a", dir);
+    if(access(lib, R_OK) == 0) {
+      cplr_cc_arg(f, "", lib);
+    }
+    cext_free(lib);
+  }
+  /* libraries */
+  cplr_cc_pile(f, "-L", &c->libdirs);
+  fputs(" -L.", f);
+  V_FORWARD(&c->libs, i) {
+    cplr_cc_arg(f, "-l", value_get_str(i));
+    c->stats.libraries++;
+  }
+  fclose(f);
+  return buf;
+}
+
+/* load a shared object built by the system compiler */
+static int cplr_cc_load(cplr_t *c, const char *path) {
+  void *dl;
+  dl = dlopen(path, RTLD_NOW|RTLD_LOCAL);
+  if(!dl) {
+    fprintf(stderr, "Failed to load %s: %s\n", path, dlerror());
+    return 1;
+  }
+  c->so_main = (cplr_main_t)dlsym(dl, "main");
+  if(!c->so_main) {
+    fprintf(stderr, "Failed to find main in %s\n", path);
+    dlclose(dl);
+    return 1;
+  }
+  c->so_handle = dl;
   return 0;
 }
 
-static void cplr_tcc_redefsym_cb(void *ctx, const char *name, const void *val) {
-  cplr_t *c = (cplr_t *)ctx;
-  /* ignore various built-ins (FIXME better method?) */
-  if(name[0] == '_') {
-    return;
+static int cplr_cc_compile(cplr_t *c) {
+  const char *tmpdir = getenv("TMPDIR");
+  const char *out = c->out;
+  char *tmp = NULL, *cmd = NULL;
+  void (*pipesig)(int);
+  int fd, rc, ret = 1;
+  size_t n;
+  FILE *p;
+
+  /* in-memory runs go through a temporary object */
+  if(!out) {
+    tmp = msprintf("%s/cplr-XXXXXX.so", (tmpdir && *tmpdir) ? tmpdir : "/tmp");
+    fd = mkstemps(tmp, 3);
+    if(fd < 0) {
+      fprintf(stderr, "Failed to create temporary file %s\n", tmp);
+      goto out;
+    }
+    close(fd);
+    out = tmp;
   }
-  if(strcmp(name, "main") == 0) {
-    return;
+
+  /* run the compiler on the generated code */
+  cmd = cplr_cc_cmdline(c, out);
+  if(c->verbosity >= 2) {
+    fprintf(stderr, "Running \"%s\"\n", cmd);
   }
-  if(strcmp(name, "exit") == 0) {
-    return;
+  fflush(stdout);
+  fflush(stderr);
+  p = popen(cmd, "w");
+  if(!p) {
+    fprintf(stderr, "Error: Could not popen \"%s\"\n", cmd);
+    goto out;
   }
-  if(strcmp(name, "atexit") == 0) {
-    return;
+  /* a compiler that fails to start must not take us along */
+  pipesig = signal(SIGPIPE, SIG_IGN);
+  n = fwrite(c->g_codebuf, 1, c->g_codelen, p);
+  rc = pclose(p);
+  signal(SIGPIPE, pipesig);
+  if(n != c->g_codelen || rc != 0) {
+    goto out;
   }
-  if(strcmp(name, "on_exit") == 0) {
-    return;
+
+  /* compilation was successful */
+  c->flag |= CPLR_FLAG_COMPILED;
+  if(tmp) {
+    if(cplr_cc_load(c, tmp)) {
+      goto out;
+    }
+    c->flag |= CPLR_FLAG_LOADED;
   }
-  if(strprefix(name, "tcc_")) {
-    return;
+  ret = 0;
+
+ out:
+  if(tmp) {
+    unlink(tmp);
+    cext_free(tmp);
   }
-  if(strsuffix(name, "@plt")) {
-    return;
+  cext_lfree(cmd);
+  return ret;
+}
+
+/* outputs link the installed runtime archive */
+static int cplr_tcc_compile_runtime(cplr_t *c) {
+  const char *dir = cplr_runtime_dir();
+  char *lib;
+  int ret = 0;
+  if(!dir) {
+    return 0;
   }
-  /* log for debugging */
-  if(c->verbosity >= 3) {
-    fprintf(stderr, "Redefining symbol %s as %p\n", name, val);
+  /* archives only resolve what is undefined by now */
+  lib = msprintf("%s/libcplrrt.a", dir);
+  if(access(lib, R_OK) == 0 && tcc_add_file(c->tcc, lib)) {
+    fprintf(stderr, "Failed to add runtime %s\n", lib);
+    ret = 1;
   }
-  /* define the symbol */
-  tcc_add_symbol(c->tcc, name, val);
+  cext_free(lib);
+  return ret;
+}
+
+/* preprocessing writes to stdout, so do it in a child */
+static int cplr_tcc_compile_preprocess(cplr_t *c) {
+  pid_t p, rp;
+  int fd, rc;
+  fflush(stdout);
+  fflush(stderr);
+  p = fork();
+  if(p < 0) {
+    fprintf(stderr, "Error: Failed to fork\n");
+    return 1;
+  }
+  if(p == 0) {
+    if(strcmp(c->out, "-")) {
+      fd = open(c->out, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+      if(fd < 0 || dup2(fd, 1) < 0) {
+        fprintf(stderr, "Failed to open %s\n", c->out);
+        _exit(1);
+      }
+    }
+    if(tcc_compile_string(c->tcc, c->g_codebuf)) {
+      _exit(1);
+    }
+    fflush(stdout);
+    _exit(0);
+  }
+  do {
+    rp = waitpid(p, &rc, 0);
+    if(rp < 0 && errno != EINTR) {
+      fprintf(stderr, "Error: Failed to wait for child\n");
+      return 1;
+    }
+  } while(rp != p);
+  if(!WIFEXITED(rc) || WEXITSTATUS(rc) != 0) {
+    return 1;
+  }
+  c->flag |= CPLR_FLAG_COMPILED;
+  return 0;
 }
 
 static int cplr_tcc_compile(cplr_t *c) {
+  int res;
+  char *code = c->g_codebuf;
+  /* preprocessed output has no further steps */
+  if(c->otype == CPLR_OUTPUT_PREPROCESS) {
+    return cplr_tcc_compile_preprocess(c);
+  }
+  /* substitute session headers or the header prologue if we have them */
+  if(c->g_headers) {
+    size_t hl = strlen(c->g_headers);
+    size_t bl = c->g_codelen - c->g_prologue_len;
+    code = cext_malloc(hl + bl + 2);
+    memcpy(code, c->g_headers, hl);
+    code[hl] = '\n';
+    memcpy(code + hl + 1, c->g_codebuf + c->g_prologue_len, bl + 1);
+  } else if(c->g_prologue) {
+    code = msprintf("#include \"%s\"\n%s",
+                    c->g_prologue, c->g_codebuf + c->g_prologue_len);
+  }
   /* compile the code */
-  if(tcc_compile_string(c->tcc, c->g_codebuf)) {
+  res = tcc_compile_string(c->tcc, code);
+  if(code != c->g_codebuf) {
+    cext_free(code);
+  }
+  if(res) {
     return 1;
   }
   /* compilation was successful */
   c->flag |= CPLR_FLAG_COMPILED;
-  /* if chained, redefine symbols from previous context */
-  if(c->c_prev && c->c_prev->tcc) {
+  /* if chained, import the symbols we use from previous states */
+  if(c->c_prev) {
     if(c->verbosity >= 3) {
-      fprintf(stderr, "Redefining symbols\n");
+      fprintf(stderr, "Importing symbols\n");
     }
-    tcc_list_symbols(c->c_prev->tcc, c, &cplr_tcc_redefsym_cb);
+    cplr_symtab_resolve(c, c->g_codebuf + c->g_prologue_len);
+  }
+  /* provide the callback of a zygote */
+  if(cplr_zygote_enabled(c)) {
+    cplr_zygote_define(c);
+  }
+  /* provide the callback of the profiler */
+  if(c->flag & CPLR_FLAG_PROFILE) {
+    cplr_profile_define(c);
+  }
+  /* provide the callback for tiered execution */
+  if((c->flag & CPLR_FLAG_TIERED) && !c->out) {
+    cplr_tier_define(c);
   }
   /* produce compilation output */
   if(c->out == NULL) {
     /* this was a memory compilation, so mark state as loaded */
     c->flag |= CPLR_FLAG_LOADED;
   } else {
-    /* produce an object file or executable */
+    /* produce an object file, library or executable */
+    if(cplr_output_links(c) && cplr_tcc_compile_runtime(c)) {
+      return 1;
+    }
     if(tcc_output_file(c->tcc, c->out)) {
       fprintf(stderr, "Failed to output file %s\n", c->out);
       return 1;
@@ -92,14 +373,18 @@ int cplr_compile(cplr_t *c) {
   if(c->verbosity >= 1) {
     fprintf(stderr, "Compilation phase\n");
   }
-  /* run backend method */
-  switch(c->backend) {
-  case CPLR_BACKEND_CC:
-    ret = cplr_cc_compile(c);
-    break;
-  case CPLR_BACKEND_LIBTCC:
-    ret = cplr_tcc_compile(c);
-    break;
+  /* run backend method, generated source needs no compiler */
+  if(c->otype == CPLR_OUTPUT_SOURCE) {
+    ret = cplr_compile_source(c);
+  } else {
+    switch(c->backend) {
+    case CPLR_BACKEND_CC:
+      ret = cplr_cc_compile(c);
+      break;
+    case CPLR_BACKEND_LIBTCC:
+      ret = cplr_tcc_compile(c);
+      break;
+    }
   }
   /* report */
   if(ret != 0) {
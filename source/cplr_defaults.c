@@ -19,48 +19,81 @@
 
 #include "cplr.h"
 
+#include <stdlib.h>
+#include <unistd.h>
+
+const char *cplr_runtime_dir(void) {
+  const char *dir = getenv("CPLR_RUNTIME_DIR");
+#ifdef CPLR_RUNTIME_DIR
+  if(!dir) {
+    dir = CPLR_RUNTIME_DIR;
+  }
+#endif
+  return dir;
+}
+
 static void cplr_defaults_basic(cplr_t *c) {
   /* headers defined in the ISO C standard */
-  l_append_str_static(&c->defsys, "stdalign.h");
-  l_append_str_static(&c->defsys, "stdarg.h");
-  l_append_str_static(&c->defsys, "stdatomic.h");
-  l_append_str_static(&c->defsys, "stdbool.h");
-  l_append_str_static(&c->defsys, "stddef.h");
-  l_append_str_static(&c->defsys, "stdint.h");
-  l_append_str_static(&c->defsys, "stdnoreturn.h");
+  v_append_str_static(&c->defsys, "stdalign.h");
+  v_append_str_static(&c->defsys, "stdarg.h");
+  v_append_str_static(&c->defsys, "stdatomic.h");
+  v_append_str_static(&c->defsys, "stdbool.h");
+  v_append_str_static(&c->defsys, "stddef.h");
+  v_append_str_static(&c->defsys, "stdint.h");
+  v_append_str_static(&c->defsys, "stdnoreturn.h");
 }
 
 static void cplr_defaults_posix(cplr_t *c) {
   /* headers available on POSIX systems */
-  l_append_str_static(&c->defdef, "-D_DEFAULT_SOURCE");
-  l_append_str_static(&c->defdef, "-D_XOPEN_SOURCE=700");
-  l_append_str_static(&c->defdef, "-D_POSIX_SOURCE=200809L");
-  l_append_str_static(&c->defsys, "sys/stat.h");
-  l_append_str_static(&c->defsys, "sys/types.h");
-  l_append_str_static(&c->defsys, "sys/wait.h");
-  l_append_str_static(&c->defsys, "assert.h");
-  l_append_str_static(&c->defsys, "ctype.h");
-  l_append_str_static(&c->defsys, "errno.h");
-  l_append_str_static(&c->defsys, "fcntl.h");
-  l_append_str_static(&c->defsys, "inttypes.h");
-  l_append_str_static(&c->defsys, "libgen.h");
-  l_append_str_static(&c->defsys, "limits.h");
-  l_append_str_static(&c->defsys, "locale.h");
-  l_append_str_static(&c->defsys, "stdio.h");
-  l_append_str_static(&c->defsys, "stdlib.h");
-  l_append_str_static(&c->defsys, "string.h");
-  l_append_str_static(&c->defsys, "termios.h");
-  l_append_str_static(&c->defsys, "time.h");
-  l_append_str_static(&c->defsys, "unistd.h");
-  l_append_str_static(&c->defsys, "wchar.h");
+  v_append_str_static(&c->defdef, "-D_DEFAULT_SOURCE");
+  v_append_str_static(&c->defdef, "-D_XOPEN_SOURCE=700");
+  v_append_str_static(&c->defdef, "-D_POSIX_SOURCE=200809L");
+  v_append_str_static(&c->defsys, "sys/stat.h");
+  v_append_str_static(&c->defsys, "sys/types.h");
+  v_append_str_static(&c->defsys, "sys/wait.h");
+  v_append_str_static(&c->defsys, "assert.h");
+  v_append_str_static(&c->defsys, "ctype.h");
+  v_append_str_static(&c->defsys, "errno.h");
+  v_append_str_static(&c->defsys, "fcntl.h");
+  v_append_str_static(&c->defsys, "inttypes.h");
+  v_append_str_static(&c->defsys, "libgen.h");
+  v_append_str_static(&c->defsys, "limits.h");
+  v_append_str_static(&c->defsys, "locale.h");
+  v_append_str_static(&c->defsys, "stdio.h");
+  v_append_str_static(&c->defsys, "stdlib.h");
+  v_append_str_static(&c->defsys, "string.h");
+  v_append_str_static(&c->defsys, "termios.h");
+  v_append_str_static(&c->defsys, "time.h");
+  v_append_str_static(&c->defsys, "unistd.h");
+  v_append_str_static(&c->defsys, "wchar.h");
 }
 
 static void cplr_defaults_linux(cplr_t *c) {
   /* headers available only on Linux */
-  l_append_str_static(&c->defsys, "sys/epoll.h");
-  l_append_str_static(&c->defsys, "sys/eventfd.h");
-  l_append_str_static(&c->defsys, "sys/inotify.h");
-  l_append_str_static(&c->defsys, "sys/signalfd.h");
+  v_append_str_static(&c->defsys, "sys/epoll.h");
+  v_append_str_static(&c->defsys, "sys/eventfd.h");
+  v_append_str_static(&c->defsys, "sys/inotify.h");
+  v_append_str_static(&c->defsys, "sys/signalfd.h");
+}
+
+static void cplr_defaults_runtime(cplr_t *c) {
+  /* our runtime, if it has been installed */
+  const char *dir = cplr_runtime_dir();
+  char *hdr, *inc;
+  bool found;
+  if(!dir) {
+    return;
+  }
+  hdr = msprintf("%s/include/cplr/runtime.h", dir);
+  found = (access(hdr, R_OK) == 0);
+  cext_free(hdr);
+  if(!found) {
+    return;
+  }
+  inc = msprintf("%s/include", dir);
+  v_append_str_unique(&c->sysdirs, inc);
+  cext_free(inc);
+  v_append_str_static(&c->defsys, "cplr/runtime.h");
 }
 
 int cplr_defaults(cplr_t *c) {
@@ -71,5 +104,6 @@ int cplr_defaults(cplr_t *c) {
   if(c->target & CPLR_TARGET_LINUX) {
     cplr_defaults_linux(c);
   }
+  cplr_defaults_runtime(c);
   return 0;
 }
@@ -26,6 +26,8 @@
 
 int cplr_tcc_execute(cplr_t *c, int argc, char **argv) {
   int ret;
+  /* tcc_run relocates */
+  c->flag |= CPLR_FLAG_RELOCATED;
   /* run the program */
   ret = tcc_run(c->tcc, argc, argv);
   /* return */
@@ -36,6 +38,7 @@ int cplr_execute(cplr_t *c) {
   int i, rc, ret = 1;
   int argc; char **argv;
   pid_t p = 0, rp;
+  bool forking;
 
   /* report status */
   if(c->verbosity >= 1) {
@@ -53,8 +56,9 @@ int cplr_execute(cplr_t *c) {
   /* set context as executed */
   c->flag |= CPLR_FLAG_EXECUTED;
 
-  /* fork if requested */
-  if(c->flag & CPLR_FLAG_FORK) {
+  /* fork if requested, a zygote forks by itself */
+  forking = (c->flag & CPLR_FLAG_FORK) && !cplr_zygote_enabled(c);
+  if(forking) {
     if(c->verbosity >= 1) {
       fprintf(stderr, "Forking for execution\n");
     }
@@ -68,31 +72,52 @@ int cplr_execute(cplr_t *c) {
       /* parent waits for child */
       do {
         rp = waitpid(p, &rc, 0);
-        if(rp < 0 && errno != EAGAIN) {
+        if(rp < 0 && errno != EINTR) {
           fprintf(stderr, "Failed to wait for child\n");
           goto out;
         }
       } while(rp != p);
       /* use the childs return code */
-      ret = rc;
+      if(WIFSIGNALED(rc)) {
+        ret = 128 + WTERMSIG(rc);
+      } else {
+        ret = WEXITSTATUS(rc);
+      }
       if(c->verbosity >= 1) {
         fprintf(stderr, "Child has returned\n");
       }
       /* done */
+      c->flag |= CPLR_FLAG_FINISHED;
       goto out;
     }
     /* we are the child - continue executing */
   }
 
-  /* call backend method */
-  switch(c->backend) {
-  case CPLR_BACKEND_LIBTCC:
-    ret = cplr_tcc_execute(c, argc, argv);
-    break;
+  /* call loaded object or backend method */
+  if(c->so_main) {
+    ret = c->so_main(argc, argv);
+  } else {
+    switch(c->backend) {
+    case CPLR_BACKEND_CC:
+      /* compiled code is always loaded */
+      break;
+    case CPLR_BACKEND_LIBTCC:
+      ret = cplr_tcc_execute(c, argc, argv);
+      break;
+    }
+  }
+
+  /* report samples before the fork goes */
+  if(c->flag & CPLR_FLAG_PROFILE) {
+    cplr_profile_finish(c);
+  }
+  /* and stop compiling for a program that is done */
+  if(c->flag & CPLR_FLAG_TIERED) {
+    cplr_tier_finish(c);
   }
 
   /* exit the fork quickly */
-  if(c->flag & CPLR_FLAG_FORK && p == 0) {
+  if((forking && p == 0) || cplr_zygote_child()) {
     exit(ret);
   }
 
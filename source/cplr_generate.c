@@ -27,18 +27,68 @@ static const char *bar =
   "========================================"
   "========================================";
 
+/* make room for n more bytes and the terminator */
+static void cplr_generate_room(char **buf, size_t len, size_t *cap, size_t n) {
+  size_t ncap;
+  if(len + n < *cap) {
+    return;
+  }
+  ncap = *cap ? *cap : 4096;
+  while(len + n >= ncap) {
+    ncap *= 2;
+  }
+  *buf = cext_realloc(*buf, ncap);
+  *cap = ncap;
+}
+
+/* format directly into the code buffer, return the new text */
+static const char *cplr_generate_vformat(cplr_t *c, const char *fmt, va_list a) {
+  size_t len = c->g_codelen;
+  va_list b;
+  int n;
+  va_copy(b, a);
+  n = vsnprintf(c->g_codebuf + len, c->g_codecap - len, fmt, a);
+  if(n >= 0 && len + n >= c->g_codecap) {
+    cplr_generate_room(&c->g_codebuf, len, &c->g_codecap, n);
+    n = vsnprintf(c->g_codebuf + len, c->g_codecap - len, fmt, b);
+  }
+  va_end(b);
+  if(n > 0) {
+    c->g_codelen += n;
+  }
+  return c->g_codebuf + len;
+}
+
+static const char *cplr_generate_format(cplr_t *c, const char *fmt, ...) {
+  const char *r;
+  va_list a;
+  va_start(a, fmt);
+  r = cplr_generate_vformat(c, fmt, a);
+  va_end(a);
+  return r;
+}
+
+/* copy text to the dump buffer */
+static void cplr_generate_dumptext(cplr_t *c, const char *text, size_t n) {
+  cplr_generate_room(&c->g_dumpbuf, c->g_dumplen, &c->g_dumpcap, n);
+  memcpy(c->g_dumpbuf + c->g_dumplen, text, n);
+  c->g_dumplen += n;
+  c->g_dumpbuf[c->g_dumplen] = 0;
+}
+
 static void cplr_emit(cplr_t *c,
                       cplr_gstate_t nstate,
-                      const char * file, int line,
+                      const char *file, int index, int line,
                       const char *fmt, ...) {
   bool needline = false;
-  char *sline, *sfmt;
+  const char *text;
+  size_t start;
   va_list a;
   if(nstate == CPLR_GSTATE_COMMENT) {
     needline = false;
   } else if(c->g_state != nstate) {
     needline = true;
-  } else if(c->g_prevfile == NULL || strcmp(c->g_prevfile, file) != 0) {
+  } else if(c->g_prevfile != file || c->g_previndex != index) {
     needline = true;
   } else if(nstate == CPLR_GSTATE_PREPROC) {
     needline = false;
@@ -46,156 +96,685 @@ static void cplr_emit(cplr_t *c,
     needline = (c->g_prevline && (line != (c->g_prevline+1)));
   }
 
-  if(needline)
-    sline = msprintf("#line %d \"%s\"\n", line, file);
+  /* line directive goes to the dump only at higher levels */
+  if(needline) {
+    start = c->g_codelen;
+    if(index < 0) {
+      text = cplr_generate_format(c, "#line %d \"%s\"\n", line, file);
+    } else {
+      text = cplr_generate_format(c, "#line %d \"%s_%d\"\n", line, file, index);
+    }
+    if(c->g_dumpbuf && (c->dump > 1)) {
+      cplr_generate_dumptext(c, text, c->g_codelen - start);
+    }
+  }
+  start = c->g_codelen;
   va_start(a, fmt);
-  sfmt = vmsprintf(fmt, a);
+  text = cplr_generate_vformat(c, fmt, a);
   va_end(a);
-
-  if(c->g_code) {
-    if(needline)
-      fwrite(sline, 1, strlen(sline), c->g_code);
-    fwrite(sfmt, 1, strlen(sfmt), c->g_code);
-  }
-
-  if(c->g_dump) {
-    if(needline && (c->dump > 1))
-      fwrite(sline, 1, strlen(sline), c->g_dump);
-    fwrite(sfmt, 1, strlen(sfmt), c->g_dump);
+  if(c->g_dumpbuf) {
+    cplr_generate_dumptext(c, text, c->g_codelen - start);
   }
 
-  if(needline)
-    cext_free(sline);
-  cext_free(sfmt);
-
   if(nstate != CPLR_GSTATE_COMMENT) {
     c->g_state = nstate;
     c->g_prevline = line;
-    if(c->g_prevfile) {
-      cext_xptrfree((void**)&c->g_prevfile);
-    }
-    c->g_prevfile = strdup(file);
+    c->g_prevfile = file;
+    c->g_previndex = index;
   }
 }
 
 #define CPLR_EMIT_COMMENT(c, fmt, ...)          \
-  cplr_emit(c, CPLR_GSTATE_COMMENT, NULL,       \
+  cplr_emit(c, CPLR_GSTATE_COMMENT, NULL, -1,   \
             1, "/* " fmt " */\n", ##__VA_ARGS__)
-#define CPLR_EMIT_PREPROC(c, fn, fmt, ...) \
-  cplr_emit(c, CPLR_GSTATE_PREPROC, fn,    \
+#define CPLR_EMIT_PREPROC(c, fn, fi, fmt, ...) \
+  cplr_emit(c, CPLR_GSTATE_PREPROC, fn, fi,    \
             1, fmt, ##__VA_ARGS__)
-#define CPLR_EMIT_TOPLEVEL(c, fn, fmt, ...) \
-  cplr_emit(c, CPLR_GSTATE_TOPLEVEL, fn,    \
+#define CPLR_EMIT_TOPLEVEL(c, fn, fi, fmt, ...) \
+  cplr_emit(c, CPLR_GSTATE_TOPLEVEL, fn, fi,    \
             1, fmt, ##__VA_ARGS__)
-#define CPLR_EMIT_INTERNAL(c, fmt, ...)          \
-  cplr_emit(c, CPLR_GSTATE_INTERNAL, "internal", \
+#define CPLR_EMIT_INTERNAL(c, fmt, ...)              \
+  cplr_emit(c, CPLR_GSTATE_INTERNAL, "internal", -1, \
             __LINE__, fmt, ##__VA_ARGS__)
-#define CPLR_EMIT_STATEMENT(c, fn, fmt, ...) \
-  cplr_emit(c, CPLR_GSTATE_STATEMENT, fn,    \
+#define CPLR_EMIT_STATEMENT(c, fn, fi, fmt, ...) \
+  cplr_emit(c, CPLR_GSTATE_STATEMENT, fn, fi,    \
             1, fmt, ##__VA_ARGS__)
 
 static void cplr_generate_section(cplr_t *c,
                                   const char *name,
-                                  lh_t *list,
+                                  vh_t *list,
                                   bool reverse,
                                   const char *fmt, ...) {
   int i;
-  ln_t *n;
-  char fn[64];
+  value_t *n;
   if(c->verbosity >= 2) {
     fprintf(stderr, "Generating section %s\n", name);
   }
+  /* file names compare as pointers */
+  name = cext_intern(name);
   CPLR_EMIT_COMMENT(c, "%s", name);
   if(reverse) {
-    i = l_size(list);
-    L_BACKWARDS(list, n) {
-      snprintf(fn, sizeof(fn), "%s_%d", name, i--);
-      CPLR_EMIT_STATEMENT(c, fn, fmt, value_get_str(&n->v));
+    i = v_size(list);
+    V_BACKWARDS(list, n) {
+      CPLR_EMIT_STATEMENT(c, name, i--, fmt, value_get_str(n));
     }
   } else {
     i = 0;
-    L_FORWARD(list, n) {
-      snprintf(fn, sizeof(fn), "%s_%d", name, i++);
-      CPLR_EMIT_PREPROC(c, fn, fmt, value_get_str(&n->v));
+    V_FORWARD(list, n) {
+      CPLR_EMIT_PREPROC(c, name, i++, fmt, value_get_str(n));
+    }
+  }
+}
+
+/* statements inside functions, marked for the profiler */
+static void cplr_generate_statements(cplr_t *c,
+                                     const char *name,
+                                     vh_t *list,
+                                     bool reverse) {
+  int i;
+  value_t *n;
+  if(!(c->flag & CPLR_FLAG_PROFILE)) {
+    cplr_generate_section(c, name, list, reverse, "\t%s;\n");
+    return;
+  }
+  if(c->verbosity >= 2) {
+    fprintf(stderr, "Generating section %s\n", name);
+  }
+  /* file names compare as pointers */
+  name = cext_intern(name);
+  CPLR_EMIT_COMMENT(c, "%s", name);
+  /* markers carry the names of the line directives */
+  if(reverse) {
+    i = v_size(list);
+    V_BACKWARDS(list, n) {
+      CPLR_EMIT_INTERNAL(c, "\t__cplr_profile_at = \"%s_%d\";\n", name, i);
+      CPLR_EMIT_STATEMENT(c, name, i--, "\t%s;\n", value_get_str(n));
+    }
+  } else {
+    i = 0;
+    V_FORWARD(list, n) {
+      CPLR_EMIT_INTERNAL(c, "\t__cplr_profile_at = \"%s_%d\";\n", name, i);
+      CPLR_EMIT_PREPROC(c, name, i++, "\t%s;\n", value_get_str(n));
     }
   }
 }
 
 static void cplr_generate_labeled(cplr_t *c,
                                   const char *name,
-                                  lh_t *list,
+                                  vh_t *list,
                                   bool reverse,
                                   const char *fmt, ...) {
   int i, j;
-  ln_t *n;
-  char fn[64];
+  value_t *n;
   if(c->verbosity >= 2) {
     fprintf(stderr, "Generating labeled %s\n", name);
   }
+  /* file names compare as pointers */
+  name = cext_intern(name);
   CPLR_EMIT_COMMENT(c, "%s", name);
   if(reverse) {
-    i = l_size(list); j = 0;
-    L_BACKWARDS(list, n) {
-      snprintf(fn, sizeof(fn), "%s_%d", name, i);
-      CPLR_EMIT_STATEMENT(c, fn, fmt, j, value_get_str(&n->v));
+    i = v_size(list); j = 0;
+    V_BACKWARDS(list, n) {
+      CPLR_EMIT_STATEMENT(c, name, i, fmt, j, value_get_str(n));
       i--; j++;
     }
   } else {
     i = 0; j = 0;
-    L_FORWARD(list, n) {
-      snprintf(fn, sizeof(fn), "%s_%d", name, i);
-      CPLR_EMIT_PREPROC(c, fn, fmt, j, value_get_str(&n->v));
+    V_FORWARD(list, n) {
+      CPLR_EMIT_PREPROC(c, name, i, fmt, j, value_get_str(n));
       i++; j++;
     }
   }
 }
 
+/* toplevel functions called through slots for --tiered */
+static void cplr_generate_tiered(cplr_t *c, bool *sel) {
+  const char *name = cext_intern("toplevel"), *d;
+  size_t pos, len, body, blen[3] = { 0, 0, 0 };
+  char *fn, *r, *buf[3] = { NULL, NULL, NULL };
+  FILE *tab[3];
+  value_t *v;
+  int i = 0;
+  if(c->verbosity >= 2) {
+    fprintf(stderr, "Generating section %s\n", name);
+  }
+  CPLR_EMIT_COMMENT(c, "%s", name);
+  for(i = 0; i < 3; i++) {
+    tab[i] = open_memstream(&buf[i], &blen[i]);
+  }
+  i = 0;
+  V_FORWARD(&c->tlfs, v) {
+    d = value_get_str(v);
+    if(!sel[i] || !cplr_tier_function(d, &pos, &len, &body)) {
+      CPLR_EMIT_PREPROC(c, name, i++, "%s;\n", d);
+      continue;
+    }
+    fn = cext_strndup(d + pos, len);
+    r = msprintf("%.*s__cplr_tier0_%s", (int)pos, d, d + pos);
+    /* prototype, slot and calls through the slot */
+    CPLR_EMIT_INTERNAL(c, "%.*s;\n", (int)(body + strlen("__cplr_tier0_")), r);
+    CPLR_EMIT_INTERNAL(c, "void *volatile __cplr_tier_%s = (void*)__cplr_tier0_%s;\n", fn, fn);
+    CPLR_EMIT_INTERNAL(c, "#define %s (*(__typeof__(__cplr_tier0_%s) *)__cplr_tier_%s)\n",
+                       fn, fn, fn);
+    CPLR_EMIT_PREPROC(c, name, i++, "%s;\n", r);
+    fprintf(tab[0], " &__cplr_tier_%s,", fn);
+    fprintf(tab[1], " \"%s\",", fn);
+    fprintf(tab[2], " (void*)__cplr_tier0_%s,", fn);
+    cext_free(r);
+    cext_free(fn);
+  }
+  for(i = 0; i < 3; i++) {
+    fclose(tab[i]);
+  }
+  /* both tiers have the tables, the optimized one is asked for them */
+  CPLR_EMIT_COMMENT(c, "tier");
+  CPLR_EMIT_INTERNAL(c, "void *volatile *__cplr_tier_slots[] = {%s 0 };\n", buf[0]);
+  CPLR_EMIT_INTERNAL(c, "const char *__cplr_tier_names[] = {%s 0 };\n", buf[1]);
+  CPLR_EMIT_INTERNAL(c, "void *__cplr_tier_impls[] = {%s 0 };\n", buf[2]);
+  CPLR_EMIT_INTERNAL(c, "extern void __cplr_tier(void *volatile **slots, const char **names)"
+                     " __attribute__((weak));\n");
+  for(i = 0; i < 3; i++) {
+    cext_free(buf[i]);
+  }
+}
+
+/*
+ * Record reader for --lines
+ *
+ * Reads the files given as program arguments, or stdin without any.
+ * Regular files are mapped privately, everything else is read into
+ * a growing buffer. Records are terminated in place, so each line
+ * is handed out as pointer and length without being copied.
+ */
+static const char cplr_lines_reader[] =
+  "#include <sys/mman.h>\n"
+  "#include <sys/stat.h>\n"
+  "#include <errno.h>\n"
+  "#include <fcntl.h>\n"
+  "#include <stdio.h>\n"
+  "#include <stdlib.h>\n"
+  "#include <string.h>\n"
+  "#include <unistd.h>\n"
+  "typedef struct {\n"
+  "\tchar **files;\n"
+  "\tint input, fd, eof;\n"
+  "\tchar *map; size_t maplen;\n"
+  "\tchar *buf; size_t cap;\n"
+  "\tchar *base; size_t len, pos;\n"
+  "} __cplr_lines_t;\n"
+  "static void __cplr_lines_close(__cplr_lines_t *l) {\n"
+  "\tif(l->map) munmap(l->map, l->maplen);\n"
+  "\tif(l->fd > 0) close(l->fd);\n"
+  "\tl->map = NULL; l->fd = -1;\n"
+  "\tl->base = l->buf; l->len = l->pos = 0; l->eof = 1;\n"
+  "}\n"
+  "static int __cplr_lines_open(__cplr_lines_t *l) {\n"
+  "\tconst char *name = \"-\";\n"
+  "\tstruct stat st;\n"
+  "\tvoid *m;\n"
+  "\t__cplr_lines_close(l);\n"
+  "\tdo {\n"
+  "\t\tif(*l->files) name = *l->files++;\n"
+  "\t\telse if(l->input++) return 0;\n"
+  "\t\tl->fd = strcmp(name, \"-\") ? open(name, O_RDONLY) : 0;\n"
+  "\t\tif(l->fd < 0) fprintf(stderr, \"%s: %s\\n\", name, strerror(errno));\n"
+  "\t\tl->input = 1;\n"
+  "\t} while(l->fd < 0);\n"
+  "\t/* mappings end in zeroes unless the file fills its last page */\n"
+  "\tif(!fstat(l->fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0\n"
+  "\t   && st.st_size % sysconf(_SC_PAGESIZE)) {\n"
+  "\t\tm = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, l->fd, 0);\n"
+  "\t\tif(m != MAP_FAILED) {\n"
+  "\t\t\tmadvise(m, st.st_size, MADV_SEQUENTIAL);\n"
+  "\t\t\tl->map = l->base = m; l->maplen = l->len = st.st_size;\n"
+  "\t\t\treturn 1;\n"
+  "\t\t}\n"
+  "\t}\n"
+  "\tl->eof = 0;\n"
+  "\treturn 1;\n"
+  "}\n"
+  "static void __cplr_lines_fill(__cplr_lines_t *l) {\n"
+  "\tssize_t n;\n"
+  "\tif(l->pos) {\n"
+  "\t\tmemmove(l->buf, l->buf + l->pos, l->len - l->pos);\n"
+  "\t\tl->len -= l->pos; l->pos = 0;\n"
+  "\t}\n"
+  "\tif(l->cap - l->len < 32768) {\n"
+  "\t\tl->cap = l->cap ? 2 * l->cap : 65536;\n"
+  "\t\tif(!(l->buf = l->base = realloc(l->buf, l->cap))) abort();\n"
+  "\t}\n"
+  "\tdo n = read(l->fd, l->buf + l->len, l->cap - l->len - 1);\n"
+  "\twhile(n < 0 && errno == EINTR);\n"
+  "\tif(n > 0) l->len += n; else l->eof = 1;\n"
+  "}\n"
+  "static int __cplr_lines_next(__cplr_lines_t *l, char **line, size_t *len) {\n"
+  "\tchar *p, *e;\n"
+  "\twhile(1) {\n"
+  "\t\tp = l->base + l->pos;\n"
+  "\t\te = l->pos < l->len ? memchr(p, '\\n', l->len - l->pos) : NULL;\n"
+  "\t\tif(e || (l->eof && l->pos < l->len)) {\n"
+  "\t\t\tif(!e) e = l->base + l->len;\n"
+  "\t\t\t*e = 0; *line = p; *len = e - p;\n"
+  "\t\t\tl->pos = e - l->base + 1;\n"
+  "\t\t\treturn 1;\n"
+  "\t\t}\n"
+  "\t\tif(!l->eof) __cplr_lines_fill(l);\n"
+  "\t\telse if(!__cplr_lines_open(l)) return 0;\n"
+  "\t}\n"
+  "}\n";
+
+/*
+ * Parallel record processing for --lines with --jobs
+ *
+ * All input is mapped or read up front and cut into chunks at line
+ * boundaries, sized so that each thread gets several. Threads take
+ * chunks from a shared queue, so faster ones simply take more.
+ *
+ * Each chunk writes to its own memory stream. Finished chunks are
+ * written out in input order, or as they complete when unordered.
+ */
+static const char cplr_jobs_runner[] =
+  "#include <sys/mman.h>\n"
+  "#include <sys/stat.h>\n"
+  "#include <errno.h>\n"
+  "#include <fcntl.h>\n"
+  "#include <pthread.h>\n"
+  "#include <stdio.h>\n"
+  "#include <stdlib.h>\n"
+  "#include <string.h>\n"
+  "#include <unistd.h>\n"
+  "typedef struct { char *p; size_t n; int map; } __cplr_input_t;\n"
+  "typedef struct { char *p; size_t n; char *out; size_t outlen; int done; } __cplr_chunk_t;\n"
+  "typedef struct {\n"
+  "\tint argc; char **argv;\n"
+  "\tint njobs, ordered, stop, ret;\n"
+  "\tFILE *out;\n"
+  "\t__cplr_input_t *in; size_t nin;\n"
+  "\t__cplr_chunk_t *chunks; size_t nchunks, cap, next, flushed;\n"
+  "\tpthread_mutex_t lock, outlock;\n"
+  "} __cplr_jobs_t;\n"
+  "static void __cplr_jobs_input(__cplr_jobs_t *j, const char *name) {\n"
+  "\tstruct stat st;\n"
+  "\tchar *p = NULL; size_t n = 0, cap = 0;\n"
+  "\tssize_t r; int fd, map = 0;\n"
+  "\tfd = strcmp(name, \"-\") ? open(name, O_RDONLY) : 0;\n"
+  "\tif(fd < 0) { fprintf(stderr, \"%s: %s\\n\", name, strerror(errno)); return; }\n"
+  "\t/* mappings end in zeroes unless the file fills its last page */\n"
+  "\tif(!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size > 0\n"
+  "\t   && st.st_size % sysconf(_SC_PAGESIZE)) {\n"
+  "\t\tp = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);\n"
+  "\t\tif(p != MAP_FAILED) { n = st.st_size; map = 1; } else p = NULL;\n"
+  "\t}\n"
+  "\twhile(!map) {\n"
+  "\t\tif(cap - n < 32768) {\n"
+  "\t\t\tcap = cap ? 2 * cap : 65536;\n"
+  "\t\t\tif(!(p = realloc(p, cap))) abort();\n"
+  "\t\t}\n"
+  "\t\tdo r = read(fd, p + n, cap - n - 1);\n"
+  "\t\twhile(r < 0 && errno == EINTR);\n"
+  "\t\tif(r <= 0) break;\n"
+  "\t\tn += r;\n"
+  "\t}\n"
+  "\tif(fd > 0) close(fd);\n"
+  "\tif(!n) { free(p); return; }\n"
+  "\tif(!(j->in = realloc(j->in, (j->nin + 1) * sizeof(*j->in)))) abort();\n"
+  "\tj->in[j->nin].p = p; j->in[j->nin].n = n; j->in[j->nin].map = map;\n"
+  "\tj->nin++;\n"
+  "}\n"
+  "static void __cplr_jobs_split(__cplr_jobs_t *j, char *p, size_t n, size_t size) {\n"
+  "\tchar *e = p + n, *q;\n"
+  "\twhile(p < e) {\n"
+  "\t\tq = (size_t)(e - p) > size ? memchr(p + size, '\\n', e - p - size) : NULL;\n"
+  "\t\tq = q ? q + 1 : e;\n"
+  "\t\tif(j->nchunks == j->cap) {\n"
+  "\t\t\tj->cap = j->cap ? 2 * j->cap : 64;\n"
+  "\t\t\tif(!(j->chunks = realloc(j->chunks, j->cap * sizeof(*j->chunks)))) abort();\n"
+  "\t\t}\n"
+  "\t\tmemset(&j->chunks[j->nchunks], 0, sizeof(*j->chunks));\n"
+  "\t\tj->chunks[j->nchunks].p = p; j->chunks[j->nchunks].n = q - p;\n"
+  "\t\tj->nchunks++;\n"
+  "\t\tp = q;\n"
+  "\t}\n"
+  "}\n"
+  "static void __cplr_jobs_load(__cplr_jobs_t *j) {\n"
+  "\tsize_t i, total = 0, size;\n"
+  "\tif(j->argc > 1) for(i = 1; i < (size_t)j->argc; i++) __cplr_jobs_input(j, j->argv[i]);\n"
+  "\telse __cplr_jobs_input(j, \"-\");\n"
+  "\tfor(i = 0; i < j->nin; i++) total += j->in[i].n;\n"
+  "\t/* several chunks per thread, but not too small */\n"
+  "\tsize = total / (8 * j->njobs);\n"
+  "\tif(size < (1 << 16)) size = 1 << 16;\n"
+  "\tif(size > (1 << 22)) size = 1 << 22;\n"
+  "\tfor(i = 0; i < j->nin; i++) __cplr_jobs_split(j, j->in[i].p, j->in[i].n, size);\n"
+  "}\n"
+  "static __cplr_chunk_t *__cplr_jobs_take(__cplr_jobs_t *j) {\n"
+  "\t__cplr_chunk_t *k = NULL;\n"
+  "\tpthread_mutex_lock(&j->lock);\n"
+  "\tif(!j->stop && j->next < j->nchunks) k = &j->chunks[j->next++];\n"
+  "\tpthread_mutex_unlock(&j->lock);\n"
+  "\treturn k;\n"
+  "}\n"
+  "static FILE *__cplr_jobs_open(__cplr_chunk_t *k) {\n"
+  "\tFILE *f = open_memstream(&k->out, &k->outlen);\n"
+  "\tif(!f) abort();\n"
+  "\treturn f;\n"
+  "}\n"
+  "static void __cplr_jobs_write(__cplr_jobs_t *j, __cplr_chunk_t *k) {\n"
+  "\tif(k->outlen) fwrite(k->out, 1, k->outlen, j->out);\n"
+  "\tfree(k->out); k->out = NULL; k->outlen = 0;\n"
+  "}\n"
+  "static void __cplr_jobs_done(__cplr_jobs_t *j, __cplr_chunk_t *k, FILE *f, int stop) {\n"
+  "\tfclose(f);\n"
+  "\tif(stop) { pthread_mutex_lock(&j->lock); j->stop = 1; pthread_mutex_unlock(&j->lock); }\n"
+  "\tpthread_mutex_lock(&j->outlock);\n"
+  "\tk->done = 1;\n"
+  "\tif(!j->ordered) __cplr_jobs_write(j, k);\n"
+  "\telse while(j->flushed < j->nchunks && j->chunks[j->flushed].done)\n"
+  "\t\t__cplr_jobs_write(j, &j->chunks[j->flushed++]);\n"
+  "\tpthread_mutex_unlock(&j->outlock);\n"
+  "}\n"
+  "static void __cplr_jobs_run(__cplr_jobs_t *j, void *(*fn)(void *)) {\n"
+  "\tpthread_t *t;\n"
+  "\tsize_t i;\n"
+  "\tint n;\n"
+  "\tif(j->njobs <= 0) j->njobs = sysconf(_SC_NPROCESSORS_ONLN);\n"
+  "\tif(j->njobs <= 0) j->njobs = 1;\n"
+  "\tpthread_mutex_init(&j->lock, NULL);\n"
+  "\tpthread_mutex_init(&j->outlock, NULL);\n"
+  "\t__cplr_jobs_load(j);\n"
+  "\tif(!(t = calloc(j->njobs, sizeof(*t)))) abort();\n"
+  "\tfor(n = 0; n < j->njobs; n++) if(pthread_create(&t[n], NULL, fn, j)) break;\n"
+  "\tif(!n) fn(j);\n"
+  "\twhile(n--) pthread_join(t[n], NULL);\n"
+  "\tfree(t);\n"
+  "\t/* output of chunks after a break */\n"
+  "\tfor(i = j->flushed; i < j->nchunks; i++) if(j->chunks[i].done) __cplr_jobs_write(j, &j->chunks[i]);\n"
+  "\tfor(i = 0; i < j->nin; i++)\n"
+  "\t\tif(j->in[i].map) munmap(j->in[i].p, j->in[i].n); else free(j->in[i].p);\n"
+  "\tfree(j->in);\n"
+  "\tfree(j->chunks);\n"
+  "}\n"
+  "static int __cplr_jobs_next(__cplr_chunk_t *k, size_t *pos, char **line, size_t *len) {\n"
+  "\tchar *p, *e;\n"
+  "\tif(*pos >= k->n) return 0;\n"
+  "\tp = k->p + *pos;\n"
+  "\te = memchr(p, '\\n', k->n - *pos);\n"
+  "\tif(!e) e = k->p + k->n;\n"
+  "\t*e = 0; *line = p; *len = e - p;\n"
+  "\t*pos = e - k->p + 1;\n"
+  "\treturn 1;\n"
+  "}\n"
+  "/* statements print into the stream of their chunk */\n"
+  "#undef printf\n"
+  "#undef puts\n"
+  "#undef putchar\n"
+  "#define printf(...) fprintf(stdout, __VA_ARGS__)\n"
+  "#define puts(s) (fputs((s), stdout) < 0 ? EOF : putc('\\n', stdout))\n"
+  "#define putchar(ch) putc((ch), stdout)\n";
+
+/*
+ * Timing harness for --bench
+ *
+ * The statements run in a loop that grows until one pass takes long
+ * enough to measure, which doubles as warmup. Then the same number
+ * of iterations is timed for every sample. Before and after statements
+ * run once around all of it and are not timed.
+ */
+static const char cplr_bench_harness[] =
+  "#include <stdio.h>\n"
+  "#include <stdlib.h>\n"
+  "#include <string.h>\n"
+  "#include <time.h>\n"
+  "/* keep the compiler from dropping a value */\n"
+  "#define cplr_sink(x) __asm__ __volatile__(\"\" : : \"g\"(x) : \"memory\")\n"
+  "typedef struct {\n"
+  "\tint warm, samples, count;\n"
+  "\tlong n;\n"
+  "\tdouble target, spent, start, *t;\n"
+  "} __cplr_bench_t;\n"
+  "static double __cplr_bench_now(void) {\n"
+  "\tstruct timespec ts;\n"
+  "\tclock_gettime(CLOCK_MONOTONIC, &ts);\n"
+  "\treturn ts.tv_sec + ts.tv_nsec * 1e-9;\n"
+  "}\n"
+  "static void __cplr_bench_init(__cplr_bench_t *b) {\n"
+  "\tconst char *e;\n"
+  "\tmemset(b, 0, sizeof(*b));\n"
+  "\tb->n = 1; b->samples = 31; b->target = 0.01;\n"
+  "\tif((e = getenv(\"CPLR_BENCH_SAMPLES\")) && atoi(e) > 0) b->samples = atoi(e);\n"
+  "\tif((e = getenv(\"CPLR_BENCH_SAMPLE_MS\")) && atof(e) > 0) b->target = atof(e) / 1000;\n"
+  "\tif(!(b->t = calloc(b->samples, sizeof(double)))) abort();\n"
+  "}\n"
+  "static long __cplr_bench_next(__cplr_bench_t *b) {\n"
+  "\t/* slow statements get fewer samples */\n"
+  "\tif(b->count == b->samples || (b->count >= 5 && b->spent > 2.0)) return 0;\n"
+  "\tb->start = __cplr_bench_now();\n"
+  "\treturn b->n;\n"
+  "}\n"
+  "static void __cplr_bench_stop(__cplr_bench_t *b) {\n"
+  "\tdouble d = __cplr_bench_now() - b->start, f;\n"
+  "\tif(!b->warm) {\n"
+  "\t\tif(d >= b->target) { b->warm = 1; return; }\n"
+  "\t\tf = d > 0 ? 1.2 * b->target / d : 10;\n"
+  "\t\tb->n = b->n * (f < 2 ? 2 : f > 10 ? 10 : f);\n"
+  "\t\treturn;\n"
+  "\t}\n"
+  "\tb->spent += d;\n"
+  "\tb->t[b->count++] = d / b->n;\n"
+  "}\n"
+  "static int __cplr_bench_cmp(const void *x, const void *y) {\n"
+  "\tdouble a = *(const double *)x, b = *(const double *)y;\n"
+  "\treturn a < b ? -1 : a > b;\n"
+  "}\n"
+  "static const char *__cplr_bench_fmt(char *buf, double s) {\n"
+  "\tif(s < 1e-6) sprintf(buf, \"%.2fns\", s * 1e9);\n"
+  "\telse if(s < 1e-3) sprintf(buf, \"%.2fus\", s * 1e6);\n"
+  "\telse if(s < 1) sprintf(buf, \"%.2fms\", s * 1e3);\n"
+  "\telse sprintf(buf, \"%.3fs\", s);\n"
+  "\treturn buf;\n"
+  "}\n"
+  "static void __cplr_bench_report(__cplr_bench_t *b) {\n"
+  "\tchar f[4][32];\n"
+  "\tdouble sum = 0, var = 0, mean, sd;\n"
+  "\tint i;\n"
+  "\tif(!b->count) return;\n"
+  "\tqsort(b->t, b->count, sizeof(double), __cplr_bench_cmp);\n"
+  "\tfor(i = 0; i < b->count; i++) sum += b->t[i];\n"
+  "\tmean = sum / b->count;\n"
+  "\tfor(i = 0; i < b->count; i++) var += (b->t[i] - mean) * (b->t[i] - mean);\n"
+  "\tvar /= b->count;\n"
+  "\t/* no libm needed for one square root */\n"
+  "\tfor(sd = var > 0 ? mean : 0, i = 0; sd > 0 && i < 64; i++) sd = (sd + var / sd) / 2;\n"
+  "\tfflush(stdout);\n"
+  "\tprintf(\"bench: %d samples of %ld iterations\\n\", b->count, b->n);\n"
+  "\tprintf(\"  min %s  median %s  p99 %s  stddev %s  %.0f iterations/s\\n\",\n"
+  "\t       __cplr_bench_fmt(f[0], b->t[0]),\n"
+  "\t       __cplr_bench_fmt(f[1], b->t[b->count / 2]),\n"
+  "\t       __cplr_bench_fmt(f[2], b->t[(b->count * 99 + 99) / 100 - 1]),\n"
+  "\t       __cplr_bench_fmt(f[3], sd), 1 / mean);\n"
+  "\tfree(b->t);\n"
+  "}\n";
+
+/* thread function running the statements for --jobs */
+static void cplr_generate_job(cplr_t *c) {
+  CPLR_EMIT_COMMENT(c, "job");
+  CPLR_EMIT_INTERNAL(c, "static void *__cplr_job(void *__cplr_arg) {\n");
+  CPLR_EMIT_INTERNAL(c, "\t__cplr_jobs_t *__cplr_jobs = __cplr_arg;\n");
+  CPLR_EMIT_INTERNAL(c, "\tFILE *stdout = __cplr_jobs->out;\n");
+  CPLR_EMIT_INTERNAL(c, "\tint argc = __cplr_jobs->argc; char **argv = __cplr_jobs->argv;\n");
+  CPLR_EMIT_INTERNAL(c, "\tint ret = 0;\n");
+  CPLR_EMIT_INTERNAL(c, "\tchar *line = NULL; size_t len = 0; long nr = 0;\n");
+  CPLR_EMIT_INTERNAL(c, "\t__cplr_chunk_t *__cplr_chunk; size_t __cplr_pos; int __cplr_more = 0;\n");
+  /* before statements run in every thread */
+  if(!v_empty(&c->befs)) {
+    cplr_generate_statements(c, "before", &c->befs, false);
+  }
+  /* a break leaves the loop with a record pending and stops all */
+  CPLR_EMIT_INTERNAL(c, "\twhile(!__cplr_more && (__cplr_chunk = __cplr_jobs_take(__cplr_jobs))) {\n");
+  CPLR_EMIT_INTERNAL(c, "\tstdout = __cplr_jobs_open(__cplr_chunk); __cplr_pos = 0;\n");
+  CPLR_EMIT_INTERNAL(c, "\twhile((__cplr_more = __cplr_jobs_next(__cplr_chunk, &__cplr_pos, &line, &len))) {\n");
+  CPLR_EMIT_INTERNAL(c, "\tnr++;\n");
+  if(!v_empty(&c->stms)) {
+    cplr_generate_statements(c, "statements", &c->stms, false);
+  }
+  CPLR_EMIT_INTERNAL(c, "\t}\n");
+  CPLR_EMIT_INTERNAL(c, "\t__cplr_jobs_done(__cplr_jobs, __cplr_chunk, stdout, __cplr_more);\n");
+  CPLR_EMIT_INTERNAL(c, "\tstdout = __cplr_jobs->out;\n");
+  CPLR_EMIT_INTERNAL(c, "\t}\n");
+  /* after statements take turns so they can combine results */
+  CPLR_EMIT_INTERNAL(c, "\tpthread_mutex_lock(&__cplr_jobs->lock);\n");
+  if(!v_empty(&c->afts)) {
+    cplr_generate_statements(c, "after", &c->afts, true);
+  }
+  CPLR_EMIT_INTERNAL(c, "\tif(ret) __cplr_jobs->ret = ret;\n");
+  CPLR_EMIT_INTERNAL(c, "\tpthread_mutex_unlock(&__cplr_jobs->lock);\n");
+  CPLR_EMIT_INTERNAL(c, "\treturn NULL;\n");
+  CPLR_EMIT_INTERNAL(c, "}\n");
+}
+
 static int cplr_generate_code(cplr_t *c) {
+  bool zygote = cplr_zygote_enabled(c);
+  bool lines = c->flag & CPLR_FLAG_LINES;
+  bool jobs = lines && c->jobs != 1;
+  bool bench = c->flag & CPLR_FLAG_BENCH;
+  bool profile = c->flag & CPLR_FLAG_PROFILE;
+  bool *sel = NULL, tiered = false;
   if(c->verbosity >= 1) {
     fprintf(stderr, "Generating code\n");
   }
   /* includes */
-  if(!l_empty(&c->defsys)) {
+  if(!v_empty(&c->defsys)) {
     cplr_generate_section(c, "defsysinclude", &c->defsys,
                           false, "#include <%s>\n");
   }
-  if(!l_empty(&c->syss)) {
+  if(!v_empty(&c->syss)) {
     cplr_generate_section(c, "sysinclude", &c->syss,
                           false, "#include <%s>\n");
   }
-  if(!l_empty(&c->incs)) {
+  if(!v_empty(&c->incs)) {
     cplr_generate_section(c, "include", &c->incs,
                           false, "#include <%s>\n");
   }
+  /* remember where the includes end */
+  c->g_prologue_len = c->g_codelen;
   /* toplevel declarations */
-  if(!l_empty(&c->tlds)) {
+  if(!v_empty(&c->tlds)) {
     cplr_generate_section(c, "declarations", &c->tlds,
                           false, "%s;\n");
   }
   /* toplevel statements */
-  if(!l_empty(&c->tlds)) {
+  if(!v_empty(&c->tlds)) {
     cplr_generate_section(c, "definition", &c->tlds,
                           false, "%s;\n");
   }
-  if(!l_empty(&c->tlfs)) {
+  /* functions may be promoted when running tiered */
+  if((c->flag & CPLR_FLAG_TIERED) && !c->out) {
+    sel = cplr_tier_select(c);
+  }
+  if(sel) {
+    cplr_generate_tiered(c, sel);
+    cext_free(sel);
+    tiered = true;
+  } else if(!v_empty(&c->tlfs)) {
     cplr_generate_section(c, "toplevel", &c->tlfs,
                           false, "%s;\n");
   }
+  /* zygote callback */
+  if(zygote) {
+    CPLR_EMIT_COMMENT(c, "zygote");
+    CPLR_EMIT_INTERNAL(c, "extern int __cplr_zygote(int *argc, char ***argv, int *ret);\n");
+  }
+  /* profiler callback and statement marker */
+  if(profile) {
+    CPLR_EMIT_COMMENT(c, "profile");
+    CPLR_EMIT_INTERNAL(c, "extern void __cplr_profile(const char *volatile *at);\n");
+    CPLR_EMIT_INTERNAL(c, "static const char *volatile __cplr_profile_at = \"main\";\n");
+  }
+  /* record reader */
+  if(jobs) {
+    CPLR_EMIT_COMMENT(c, "jobs");
+    CPLR_EMIT_INTERNAL(c, "%s", cplr_jobs_runner);
+    cplr_generate_job(c);
+  } else if(lines) {
+    CPLR_EMIT_COMMENT(c, "lines");
+    CPLR_EMIT_INTERNAL(c, "%s", cplr_lines_reader);
+  }
+  /* timing harness */
+  if(bench) {
+    CPLR_EMIT_COMMENT(c, "bench");
+    CPLR_EMIT_INTERNAL(c, "%s", cplr_bench_harness);
+  }
   /* main function */
   CPLR_EMIT_COMMENT(c, "main");
   CPLR_EMIT_INTERNAL(c, "int main(int argc, char **argv) {\n");
   CPLR_EMIT_INTERNAL(c, "\tint ret = 0;\n");
-  if(!l_empty(&c->befs)) {
-    cplr_generate_section(c, "before", &c->befs,
-                          false, "\t%s;\n");
+  if(profile) {
+    CPLR_EMIT_INTERNAL(c, "\t__cplr_profile(&__cplr_profile_at);\n");
+  }
+  if(tiered) {
+    CPLR_EMIT_INTERNAL(c, "\tif(__cplr_tier) __cplr_tier(__cplr_tier_slots, __cplr_tier_names);\n");
+  }
+  if(bench) {
+    CPLR_EMIT_INTERNAL(c, "\t__cplr_bench_t __cplr_bench; long __cplr_i, __cplr_n;\n");
+  }
+  /* threads get their records from the queue */
+  if(jobs) {
+    CPLR_EMIT_INTERNAL(c, "\t__cplr_jobs_t __cplr_jobs;\n");
+    CPLR_EMIT_INTERNAL(c, "\tmemset(&__cplr_jobs, 0, sizeof(__cplr_jobs));\n");
+    CPLR_EMIT_INTERNAL(c, "\t__cplr_jobs.njobs = %d; __cplr_jobs.ordered = %d;\n",
+                       c->jobs, !(c->flag & CPLR_FLAG_UNORDERED));
+    CPLR_EMIT_INTERNAL(c, "\t__cplr_jobs.out = stdout;\n");
+    CPLR_EMIT_INTERNAL(c, "\tif(!isatty(1)) setvbuf(stdout, NULL, _IOFBF, 1 << 16);\n");
+  }
+  /* records and their count are visible throughout */
+  if(lines && !jobs) {
+    CPLR_EMIT_INTERNAL(c, "\t__cplr_lines_t __cplr_lines = { argv + 1, argc > 1, -1, 1 };\n");
+    CPLR_EMIT_INTERNAL(c, "\tchar *line = NULL; size_t len = 0; long nr = 0;\n");
+    /* output goes in large blocks unless someone is watching */
+    CPLR_EMIT_INTERNAL(c, "\tif(!isatty(1)) setvbuf(stdout, NULL, _IOFBF, 1 << 16);\n");
+  }
+  if(!jobs && !v_empty(&c->befs)) {
+    cplr_generate_statements(c, "before", &c->befs, false);
+  }
+  /* the zygote skips the statements */
+  if(zygote) {
+    CPLR_EMIT_INTERNAL(c, "\tif(__cplr_zygote(&argc, &argv, &ret)) goto __cplr_zygote_done;\n");
+  }
+  /* statements run for every record */
+  if(jobs) {
+    CPLR_EMIT_INTERNAL(c, "\t__cplr_jobs.argc = argc; __cplr_jobs.argv = argv;\n");
+    CPLR_EMIT_INTERNAL(c, "\t__cplr_jobs_run(&__cplr_jobs, __cplr_job);\n");
+    CPLR_EMIT_INTERNAL(c, "\tif(__cplr_jobs.ret) ret = __cplr_jobs.ret;\n");
+  } else if(lines) {
+    CPLR_EMIT_INTERNAL(c, "\twhile(__cplr_lines_next(&__cplr_lines, &line, &len)) {\n");
+    CPLR_EMIT_INTERNAL(c, "\tnr++;\n");
+  } else if(bench) {
+    CPLR_EMIT_INTERNAL(c, "\t__cplr_bench_init(&__cplr_bench);\n");
+    CPLR_EMIT_INTERNAL(c, "\twhile((__cplr_n = __cplr_bench_next(&__cplr_bench))) {\n");
+    CPLR_EMIT_INTERNAL(c, "\tfor(__cplr_i = 0; __cplr_i < __cplr_n; __cplr_i++) {\n");
+  }
+  if(!jobs && !v_empty(&c->stms)) {
+    cplr_generate_statements(c, "statements", &c->stms, false);
+  }
+  if(lines && !jobs) {
+    CPLR_EMIT_INTERNAL(c, "\t}\n");
+    CPLR_EMIT_INTERNAL(c, "\t__cplr_lines_close(&__cplr_lines);\n");
+    CPLR_EMIT_INTERNAL(c, "\tfree(__cplr_lines.buf);\n");
+  } else if(bench) {
+    CPLR_EMIT_INTERNAL(c, "\t}\n");
+    CPLR_EMIT_INTERNAL(c, "\t__cplr_bench_stop(&__cplr_bench);\n");
+    CPLR_EMIT_INTERNAL(c, "\t}\n");
+    CPLR_EMIT_INTERNAL(c, "\t__cplr_bench_report(&__cplr_bench);\n");
   }
-  if(!l_empty(&c->stms)) {
-    cplr_generate_section(c, "statements", &c->stms,
-                          false, "\t%s;\n");
+  if(zygote) {
+    CPLR_EMIT_INTERNAL(c, "__cplr_zygote_done:;\n");
   }
-  if(!l_empty(&c->afts)) {
-    cplr_generate_section(c, "after", &c->afts,
-                          true, "\t%s;\n");
+  if(!jobs && !v_empty(&c->afts)) {
+    cplr_generate_statements(c, "after", &c->afts, true);
+  }
+  /* final statements run once, after all threads */
+  if(!v_empty(&c->fins)) {
+    cplr_generate_statements(c, "final", &c->fins, false);
   }
   CPLR_EMIT_COMMENT(c, "done");
   CPLR_EMIT_INTERNAL(c, "\treturn ret;\n");
@@ -204,69 +783,19 @@ static int cplr_generate_code(cplr_t *c) {
   return 0;
 }
 
-#ifdef _GNU_SOURCE
-static ssize_t code_stream_write(void *cp, const char *buf, size_t size) {
-  cplr_t *c = (cplr_t*)cp;
-  assert(c->g_codebuf);
-  assert(size < SSIZE_MAX);
-  size_t ol = strlen(c->g_codebuf);
-  size_t nl = ol + size + 1;
-  char *n = cext_realloc(c->g_codebuf, nl);
-  c->g_codebuf = n;
-  strncpy(n + ol, buf, size);
-  (n+ol)[size] = 0;
-  return size;
-}
-static cookie_io_functions_t code_stream_functions = {
-  NULL, &code_stream_write, NULL, NULL
-};
-static ssize_t dump_stream_write(void *cp, const char *buf, size_t size) {
-  cplr_t *c = (cplr_t*)cp;
-  assert(c->g_dumpbuf);
-  assert(size < SSIZE_MAX);
-  size_t ol = strlen(c->g_dumpbuf);
-  size_t nl = ol + size + 1;
-  char *n = cext_realloc(c->g_dumpbuf, nl);
-  c->g_dumpbuf = n;
-  strncpy(n + ol, buf, size);
-  (n+ol)[size] = 0;
-  return size;
-}
-static cookie_io_functions_t dump_stream_functions = {
-  NULL, &dump_stream_write, NULL, NULL
-};
-#endif
-
 static void cplr_generate_open(cplr_t *c) {
-#ifdef _GNU_SOURCE
-  c->g_codebuf = strdup("");
-  c->g_code = fopencookie(c, "w", code_stream_functions);
-#else
-  c->g_codebuf = cext_calloc(2^16, 1);
-  c->g_code = fmemopen(c->g_codebuf, 2^16, "w");
-#endif
+  c->g_codelen = c->g_codecap = 0;
+  cplr_generate_room(&c->g_codebuf, 0, &c->g_codecap, 0);
+  c->g_codebuf[0] = 0;
+  c->g_dumplen = c->g_dumpcap = 0;
   if(c->dump > 0) {
-#ifdef _GNU_SOURCE
-    c->g_dumpbuf = strdup("");
-    c->g_dump = fopencookie(c, "w", dump_stream_functions);
-#else
-    c->g_dumpbuf = cext_calloc(2^16, 1);
-    c->g_dump = fmemopen(c->g_dumpbuf, 2^16, "w");
-#endif
-  }
-}
-
-static void cplr_generate_close(cplr_t *c) {
-  if(c->g_code) {
-    fflush(c->g_code);
-    fclose(c->g_code);
-    c->g_code = NULL;
-  }
-  if(c->g_dump) {
-    fflush(c->g_dump);
-    fclose(c->g_dump);
-    c->g_dump = NULL;
+    cplr_generate_room(&c->g_dumpbuf, 0, &c->g_dumpcap, 0);
+    c->g_dumpbuf[0] = 0;
   }
+  c->g_state = CPLR_GSTATE_INITIAL;
+  c->g_prevline = 0;
+  c->g_prevfile = NULL;
+  c->g_previndex = -1;
 }
 
 static void cplr_generate_free(cplr_t *c) {
@@ -276,6 +805,8 @@ static void cplr_generate_free(cplr_t *c) {
   if(c->g_dumpbuf) {
     cext_xptrfree((void**)&c->g_dumpbuf);
   }
+  c->g_codelen = c->g_codecap = 0;
+  c->g_dumplen = c->g_dumpcap = 0;
 }
 
 static void cplr_generate_dump(cplr_t *c) {
@@ -286,7 +817,7 @@ static void cplr_generate_dump(cplr_t *c) {
   if(c->dump > 0) {
     fprintf(stderr, "%s\n", bar);
     fflush(stderr);
-    size_t total = strlen(c->g_dumpbuf);
+    size_t total = c->g_dumplen;
     char *buf = c->g_dumpbuf;
     FILE *dumpout = popen(filter, "w");
     size_t done = 0;
@@ -310,18 +841,8 @@ static void cplr_generate_dump(cplr_t *c) {
 
 static void cplr_generate_report(cplr_t *c) {
  if(c->verbosity >= 1) {
-    size_t cl = 0, dl = 0;
-    if(c->g_codebuf)
-      cl = strlen(c->g_codebuf);
-    if(c->g_dumpbuf)
-      dl = strlen(c->g_dumpbuf);
-    fprintf(stderr, "Generated: %zu bytes code, %zu bytes dump\n", cl, dl);
-  }
-}
-
-static void cplr_generate_finish(cplr_t *c) {
-  if(c->g_prevfile) {
-    cext_xptrfree((void**)&c->g_prevfile);
+    fprintf(stderr, "Generated: %zu bytes code, %zu bytes dump\n",
+            c->g_codelen, c->g_dumplen);
   }
 }
 
@@ -330,22 +851,16 @@ int cplr_generate(cplr_t *c) {
   if(c->verbosity >= 1) {
     fprintf(stderr, "Generation phase\n");
   }
-  /* close any previous streams */
-  cplr_generate_close(c);
   /* free previous buffers */
   cplr_generate_free(c);
-  /* alloc buffers and open streams */
+  /* alloc buffers */
   cplr_generate_open(c);
   /* perform code generation */
   cplr_generate_code(c);
-  /* flush and close */
-  cplr_generate_close(c);
   /* emit the dump buffer */
   cplr_generate_dump(c);
   /* report stats */
   cplr_generate_report(c);
-  /* clean up */
-  cplr_generate_finish(c);
   /* flag the context */
   c->flag |= CPLR_FLAG_GENERATED;
   /* done */
@@ -33,6 +33,7 @@ int cplr_interact(cplr_t *b) {
     /* create a new state when needed */
     if(c->flag & CPLR_FLAG_LOADED) {
       c = cplr_chain(c);
+      cplr_reclaim(c);
     }
 
     /* ignore empty lines */
@@ -35,15 +35,18 @@
 
 #include "cplr.h"
 
-int main(int argc, char **argv) {
+int cplr_main(int argc, char **argv) {
   int res, ret = 1;
+  double begin;
   cplr_t *c;
 
   /* create the root piler */
   c = cplr_new();
 
   /* parse options */
+  begin = cplr_clock();
   res = cplr_optparse(c, argc, argv);
+  cplr_stats_phase(c, CPLR_PHASE_OPTPARSE, begin);
   switch(res) {
   case 0:
     break;
@@ -56,14 +59,32 @@ int main(int argc, char **argv) {
 
   /* apply defaults */
   if(!(c->flag & CPLR_FLAG_NODEFAULTS)) {
+    begin = cplr_clock();
     if(cplr_defaults(c)) {
       fprintf(stderr, "Error: Default initialization failed.\n");
       goto done;
     }
+    cplr_stats_phase(c, CPLR_PHASE_DEFAULTS, begin);
+  }
+
+  /* warm caches when requested */
+  if(c->flag & CPLR_FLAG_WARM) {
+    ret = cplr_warm(c);
+    goto done;
+  }
+
+  /* serve requests when requested */
+  if(c->server) {
+    if(c->flag & CPLR_FLAG_ZYGOTE) {
+      ret = cplr_zygote(c);
+    } else {
+      ret = cplr_serve(c);
+    }
+    goto done;
   }
 
   /* switch to interactive when no statement and on a tty */
-  if(l_empty(&c->stms) && (isatty(0) == 1) && (isatty(1) == 1)) {
+  if(v_empty(&c->stms) && (isatty(0) == 1) && (isatty(1) == 1)) {
     c->flag |= CPLR_FLAG_INTERACTIVE;
     /* read history */
     if(c->verbosity >= 3) {
@@ -72,6 +93,22 @@ int main(int argc, char **argv) {
     read_history(realpath("~/.cplr_history", NULL));
   }
 
+  /* chained states import their symbols through tcc */
+  if((c->flag & CPLR_FLAG_INTERACTIVE) && c->backend != CPLR_BACKEND_LIBTCC) {
+    fprintf(stderr, "Error: Interactive mode needs the tcc backend\n");
+    goto done;
+  }
+  if((c->flag & CPLR_FLAG_INTERACTIVE) && (c->flag & CPLR_FLAG_TIERED)) {
+    fprintf(stderr, "Error: Interactive mode can not run tiered\n");
+    goto done;
+  }
+
+  /* run code once and fork from there */
+  if(c->flag & CPLR_FLAG_ZYGOTE) {
+    ret = cplr_zygote(c);
+    goto done;
+  }
+
   /* run code on the command line */
   if(!cplr_empty(c)) {
     ret = cplr_run(c);
@@ -96,9 +133,25 @@ int main(int argc, char **argv) {
     write_history(realpath("~/.cplr_history", NULL));
   }
 
+  /* report where the time went */
+  if(res == 0) {
+    cplr_stats_report(c);
+  }
+
   /* clean up */
   cplr_free(c);
 
   /* return result */
   return ret;
 }
+
+int main(int argc, char **argv) {
+  int ret;
+
+  /* let a server do the work if there is one */
+  if(cplr_client(argc, argv, &ret) == 0) {
+    return ret;
+  }
+
+  return cplr_main(argc, argv);
+}
@@ -19,13 +19,48 @@
 
 #include "cplr.h"
 
+#include <errno.h>
 #include <getopt.h>
 #include <libgen.h>
+#include <limits.h>
 
 #define USE_GETOPT_LONG
 
+/* values for long-only options */
+enum {
+  CPLR_OPT_NOCACHE = 256,
+  CPLR_OPT_WARM,
+  CPLR_OPT_PKGCONFIG,
+  CPLR_OPT_SERVER,
+  CPLR_OPT_ZYGOTE,
+  CPLR_OPT_LINES,
+  CPLR_OPT_UNORDERED,
+  CPLR_OPT_FINAL,
+  CPLR_OPT_BENCH,
+  CPLR_OPT_STATS,
+  CPLR_OPT_PROFILE,
+  CPLR_OPT_BACKEND,
+  CPLR_OPT_TIERED,
+  CPLR_OPT_EMIT,
+};
+
+/* output types by name and file extension */
+static const struct {
+  const char *name;
+  const char *ext;
+  cplr_output_t otype;
+} outputs[] = {
+  { "exe", NULL,  CPLR_OUTPUT_EXE },
+  { "obj", ".o",  CPLR_OUTPUT_OBJ },
+  { "dll", ".so", CPLR_OUTPUT_DLL },
+  { "asm", ".s",  CPLR_OUTPUT_ASM },
+  { "c",   ".c",  CPLR_OUTPUT_SOURCE },
+  { "i",   ".i",  CPLR_OUTPUT_PREPROCESS },
+  { NULL,  NULL,  CPLR_OUTPUT_MEMORY },
+};
+
 /* short options */
-const char *shortopts = "-:hHVvdnpyf:m:D:U:I:i:X:x:L:l:P:f:m:b:a:t:s:o:-";
+const char *shortopts = "-:hHVvdnpyj:f:m:D:U:I:i:X:x:L:l:P:f:m:b:a:t:s:o:-";
 
 /* long is optional */
 #ifdef USE_GETOPT_LONG
@@ -41,8 +76,31 @@ const struct option longopts[] = {
   {"noexec",      0, NULL, 'n'},
   {"pristine",    0, NULL, 'p'},
   {"interactive", 0, NULL, 'y'},
+  {"stats",       2, NULL, CPLR_OPT_STATS},
+
+  /* caching */
+  {"nocache",     0, NULL, CPLR_OPT_NOCACHE},
+  {"warm",        0, NULL, CPLR_OPT_WARM},
+
+  /* packages */
+  {"pkg-config",  0, NULL, CPLR_OPT_PKGCONFIG},
+
+  /* server */
+  {"server",      1, NULL, CPLR_OPT_SERVER},
+
+  /* execution */
+  {"zygote",      0, NULL, CPLR_OPT_ZYGOTE},
+  {"lines",       0, NULL, CPLR_OPT_LINES},
+  {"jobs",        1, NULL, 'j'},
+  {"unordered",   0, NULL, CPLR_OPT_UNORDERED},
+  {"final",       1, NULL, CPLR_OPT_FINAL},
+  {"bench",       0, NULL, CPLR_OPT_BENCH},
+  {"profile",     2, NULL, CPLR_OPT_PROFILE},
 
   /* compilation */
+  {"backend",     1, NULL, CPLR_OPT_BACKEND},
+  {"tiered",      0, NULL, CPLR_OPT_TIERED},
+  {"emit",        1, NULL, CPLR_OPT_EMIT},
   {NULL,    1, NULL, 'f'},
   {NULL,    1, NULL, 'm'},
 
@@ -82,7 +140,26 @@ const char *longhelp[] = {
   "inhibit execution",
   "inhibit defaults",
   "run interactor",
+  "report timings and counters (text, json)",
+
+  "disable caches",
+  "prepare and warm caches only",
+
+  "resolve packages using pkg-config",
+
+  "serve requests on socket",
 
+  "run before statements once, fork per run",
+  "run statements for each line of input",
+  "process lines in N threads (0 for all), reads all input first",
+  "write output of lines as it completes",
+  "add final statement, run after all lines",
+  "time statements in a loop, report per iteration",
+  "sample execution, write folded stacks",
+
+  "select compiler (tcc, cc)",
+  "start in tcc, switch functions to cc",
+  "output type (exe, obj, dll, asm, c, i)",
   "compiler option",
   "machine option",
 
@@ -101,7 +178,7 @@ const char *longhelp[] = {
   "add toplevel statement",
 
   "input file (source, object, archive)",
-  "output file (executable, object, source, assembly)",
+  "output file (type from extension or --emit)",
 
   "begin program arguments",
   NULL,
@@ -122,7 +199,11 @@ static void cplr_show_help(cplr_t *c, FILE *out) {
 #ifdef USE_GETOPT_LONG
   int i;
   for(i = 0; longhelp[i]; i++) {
-    if(longopts[i].name) {
+    if(longopts[i].val > 255) {
+      fprintf(out, "      --%-10s\t%s\n",
+              longopts[i].name,
+              longhelp[i]);
+    } else if(longopts[i].name) {
       fprintf(out, "  -%c, --%-10s\t%s\n",
               (char)longopts[i].val,
               longopts[i].name,
@@ -169,8 +250,39 @@ static void cplr_show_version(cplr_t *c, FILE *out) {
 #endif
 }
 
+/* output type by name */
+static cplr_output_t cplr_output_byname(const char *name) {
+  int i;
+  for(i = 0; outputs[i].name; i++) {
+    if(!strcmp(outputs[i].name, name)) {
+      return outputs[i].otype;
+    }
+  }
+  return CPLR_OUTPUT_MEMORY;
+}
+
+/* output type from the extension of a path, executables have none */
+static cplr_output_t cplr_output_infer(const char *path) {
+  const char *b, *e;
+  int i;
+  /* text on stdout is the generated source */
+  if(!strcmp(path, "-")) {
+    return CPLR_OUTPUT_SOURCE;
+  }
+  b = strrchr(path, '/');
+  e = strrchr(b ? b + 1 : path, '.');
+  for(i = 0; e && outputs[i].name; i++) {
+    if(outputs[i].ext && !strcmp(outputs[i].ext, e)) {
+      return outputs[i].otype;
+    }
+  }
+  return CPLR_OUTPUT_EXE;
+}
+
 /* option parser */
 int cplr_optparse(cplr_t *c, int argc, char **argv) {
+  char *end;
+  long jobs;
   int opt;
 
   /* remember argc/argv */
@@ -198,7 +310,7 @@ int cplr_optparse(cplr_t *c, int argc, char **argv) {
     case 0: /* handled by getopt */
       break;
     case 1: /* non-option arguments are statements */
-      l_append_str_static(&c->stms, optarg);
+      v_append_str_static(&c->stms, optarg);
       break;
 
       /* information */
@@ -226,66 +338,147 @@ int cplr_optparse(cplr_t *c, int argc, char **argv) {
       c->flag |= CPLR_FLAG_INTERACTIVE;
       break;
 
+      /* caching */
+    case CPLR_OPT_NOCACHE: /* disable caches */
+      c->flag |= CPLR_FLAG_NOCACHE;
+      break;
+    case CPLR_OPT_WARM: /* warm caches and exit */
+      c->flag |= CPLR_FLAG_WARM;
+      break;
+    case CPLR_OPT_PKGCONFIG: /* use external pkg-config */
+      c->flag |= CPLR_FLAG_PKGCONFIG;
+      break;
+
+      /* server */
+    case CPLR_OPT_SERVER: /* serve requests */
+      cext_lptrfree((void*)&c->server);
+      c->server = strdup(optarg);
+      break;
+
+      /* execution */
+    case CPLR_OPT_ZYGOTE: /* run before statements once */
+      c->flag |= CPLR_FLAG_ZYGOTE;
+      break;
+    case CPLR_OPT_LINES: /* run statements per line */
+      c->flag |= CPLR_FLAG_LINES;
+      break;
+    case 'j': /* threads for lines */
+      errno = 0;
+      jobs = strtol(optarg, &end, 10);
+      if(errno || end == optarg || *end || jobs < 0 || jobs > INT_MAX) {
+        fprintf(stderr, "Invalid job count %s\n", optarg);
+        goto err;
+      }
+      c->jobs = jobs;
+      break;
+    case CPLR_OPT_UNORDERED: /* output of lines as it completes */
+      c->flag |= CPLR_FLAG_UNORDERED;
+      break;
+
       /* compiler */
+    case CPLR_OPT_BACKEND:
+      if(!strcmp(optarg, "tcc") || !strcmp(optarg, "libtcc")) {
+        c->backend = CPLR_BACKEND_LIBTCC;
+      } else if(!strcmp(optarg, "cc")) {
+        c->backend = CPLR_BACKEND_CC;
+      } else {
+        fprintf(stderr, "Unknown backend %s\n", optarg);
+        goto err;
+      }
+      break;
+    case CPLR_OPT_TIERED: /* promote functions */
+      c->flag |= CPLR_FLAG_TIERED;
+      break;
+    case CPLR_OPT_EMIT: /* output type */
+      c->otype = cplr_output_byname(optarg);
+      if(c->otype == CPLR_OUTPUT_MEMORY) {
+        fprintf(stderr, "Unknown output type %s\n", optarg);
+        goto err;
+      }
+      break;
     case 'f':
-      l_append_str_static(&c->optf, optarg);
+      v_append_str_static(&c->optf, optarg);
       break;
     case 'm':
-      l_append_str_static(&c->optf, optarg);
+      v_append_str_static(&c->optm, optarg);
       break;
 
       /* preprocessor */
     case 'D':
-      l_append_str_owned(&c->defs, msnprintf(1024, "-D%s", optarg));
+      v_append_str_owned(&c->defs, msnprintf(1024, "-D%s", optarg));
       break;
     case 'U':
-      l_append_str_owned(&c->defs, msnprintf(1024, "-U%s", optarg));
+      v_append_str_owned(&c->defs, msnprintf(1024, "-U%s", optarg));
       break;
     case 'I':
-      l_append_str_static(&c->incdirs, optarg);
+      v_append_str_unique(&c->incdirs, optarg);
       break;
     case 'i':
-      l_append_str_static(&c->incs, optarg);
+      v_append_str_static(&c->incs, optarg);
       break;
     case 'X':
-      l_append_str_static(&c->sysdirs, optarg);
+      v_append_str_unique(&c->sysdirs, optarg);
       break;
     case 'x':
-      l_append_str_static(&c->syss, optarg);
+      v_append_str_static(&c->syss, optarg);
       break;
 
       /* libraries */
     case 'L':
-      l_append_str_static(&c->libdirs, optarg);
+      v_append_str_unique(&c->libdirs, optarg);
       break;
     case 'l':
-      l_append_str_static(&c->libs, optarg);
+      v_append_str_unique(&c->libs, optarg);
       break;
 
       /* pkg-config */
     case 'P':
-      l_append_str_static(&c->pkgs, optarg);
+      v_append_str_static(&c->pkgs, optarg);
       break;
 
       /* statements */
     case 'b':
-      l_append_str_static(&c->befs, optarg);
+      v_append_str_static(&c->befs, optarg);
       break;
     case 'a':
-      l_append_str_static(&c->afts, optarg);
+      v_append_str_static(&c->afts, optarg);
       break;
     case 't':
-      l_append_str_static(&c->tlfs, optarg);
+      v_append_str_static(&c->tlfs, optarg);
+      break;
+    case CPLR_OPT_FINAL: /* statements after all lines */
+      v_append_str_static(&c->fins, optarg);
+      break;
+    case CPLR_OPT_STATS: /* report timings */
+      if(!optarg || !strcmp(optarg, "text")) {
+        c->statsfmt = CPLR_STATS_TEXT;
+      } else if(!strcmp(optarg, "json")) {
+        c->statsfmt = CPLR_STATS_JSON;
+      } else {
+        fprintf(stderr, "Unknown statistics format %s\n", optarg);
+        goto err;
+      }
+      break;
+    case CPLR_OPT_BENCH: /* time statements */
+      c->flag |= CPLR_FLAG_BENCH;
+      break;
+    case CPLR_OPT_PROFILE: /* sample execution */
+      c->flag |= CPLR_FLAG_PROFILE;
+      cext_lptrfree((void**)&c->profile);
+      if(optarg) {
+        c->profile = strdup(optarg);
+      }
       break;
 
       /* input files */
     case 's':
-      l_append_str_static(&c->srcs, optarg);
+      v_append_str_static(&c->srcs, optarg);
       break;
 
       /* output file */
     case 'o':
       c->flag |= CPLR_FLAG_NORUN;
+      cext_lptrfree((void**)&c->out);
       c->out = strdup(optarg);
       break;
 
@@ -309,6 +502,57 @@ int cplr_optparse(cplr_t *c, int argc, char **argv) {
  done:
   /* set index of program args */
   c->argp = optind;
+  /* output goes to a file of the given or inferred type */
+  if(c->otype != CPLR_OUTPUT_MEMORY && !c->out) {
+    fprintf(stderr, "Option --emit needs -o\n");
+    goto err;
+  }
+  if(c->out && c->otype == CPLR_OUTPUT_MEMORY) {
+    c->otype = cplr_output_infer(c->out);
+  }
+  if(c->out && !strcmp(c->out, "-")
+     && c->otype != CPLR_OUTPUT_ASM && c->otype != CPLR_OUTPUT_SOURCE
+     && c->otype != CPLR_OUTPUT_PREPROCESS) {
+    fprintf(stderr, "Binary output can not go to stdout\n");
+    goto err;
+  }
+  /* tcc does not write assembly */
+  if(c->otype == CPLR_OUTPUT_ASM) {
+    c->backend = CPLR_BACKEND_CC;
+  }
+  /* verbose runs tell where the time went */
+  if(c->verbosity >= 1 && c->statsfmt == CPLR_STATS_NONE) {
+    c->statsfmt = CPLR_STATS_TEXT;
+  }
+  /* threads only split up input */
+  if(c->jobs != 1 && !(c->flag & CPLR_FLAG_LINES)) {
+    fprintf(stderr, "Option --jobs needs --lines\n");
+    goto err;
+  }
+  /* statements loop either over records or for timing */
+  if((c->flag & CPLR_FLAG_BENCH) && (c->flag & CPLR_FLAG_LINES)) {
+    fprintf(stderr, "Option --bench conflicts with --lines\n");
+    goto err;
+  }
+  /* samples are taken in our own process */
+  if((c->flag & CPLR_FLAG_PROFILE)
+     && (c->out || c->server || (c->flag & CPLR_FLAG_ZYGOTE))) {
+    fprintf(stderr, "Option --profile needs an in-memory run without zygote\n");
+    goto err;
+  }
+  /* servers and the profiler hand out tcc states */
+  if(c->backend == CPLR_BACKEND_CC
+     && (c->server || (c->flag & (CPLR_FLAG_ZYGOTE|CPLR_FLAG_PROFILE)))) {
+    fprintf(stderr, "Option --backend=cc conflicts with --server, --zygote and --profile\n");
+    goto err;
+  }
+  /* tiers start in tcc and are loaded into our process */
+  if((c->flag & CPLR_FLAG_TIERED)
+     && (c->backend != CPLR_BACKEND_LIBTCC || c->out || c->server
+         || (c->flag & CPLR_FLAG_ZYGOTE))) {
+    fprintf(stderr, "Option --tiered needs an in-memory tcc run without zygote\n");
+    goto err;
+  }
   return 0;
 
  err:
@@ -17,23 +17,311 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <cext/hash.h>
+
 #include "cpkg.h"
 
 #include "cplr.h"
 
-int cplr_pkgconfig_prepare(cplr_t *c, const char *name) {
-    char *s;
-    bool verbose = (c->verbosity >= 2);
-    TCCState *t = c->tcc;
+/* packages resolved during this session, flags NULL if they failed */
+typedef struct pkgmemo pkgmemo_t;
+struct pkgmemo {
+  pkgmemo_t *next;
+  char *name;
+  char *flags;
+};
+static pkgmemo_t *pkgmemo = NULL;
+
+static pkgmemo_t *cplr_pkgconfig_memo_find(const char *name) {
+  pkgmemo_t *m;
+  for(m = pkgmemo; m; m = m->next) {
+    if(!strcmp(m->name, name)) {
+      return m;
+    }
+  }
+  return NULL;
+}
+
+static void cplr_pkgconfig_memo_add(const char *name, const char *flags) {
+  pkgmemo_t *m = cext_calloc(1, sizeof(pkgmemo_t));
+  m->name = strdup(name);
+  m->flags = flags ? strdup(flags) : NULL;
+  m->next = pkgmemo;
+  pkgmemo = m;
+}
+
+/* packages resolved by pkg-config in the background */
+typedef struct pkgjob pkgjob_t;
+struct pkgjob {
+  pkgjob_t *next;
+  char *name;
+  char *key;
+  char *kpath;
+  cpkg_job_t *job;
+};
+static pkgjob_t *pkgjobs = NULL;
+static double pkgjobs_started = 0;
+
+static bool cplr_pkgconfig_pending(const char *name) {
+  pkgjob_t *j;
+  for(j = pkgjobs; j; j = j->next) {
+    if(!strcmp(j->name, name)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static char *cplr_pkgconfig_key(const char *name) {
+  const char *vars[] = {
+    "PKG_CONFIG_PATH", "PKG_CONFIG_LIBDIR", "PKG_CONFIG_SYSROOT_DIR",
+    "PKG_CONFIG_ALLOW_SYSTEM_CFLAGS", "PKG_CONFIG_ALLOW_SYSTEM_LIBS",
+    NULL
+  };
+  const char *v;
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *f;
+  int i;
+  f = open_memstream(&buf, &len);
+  fprintf(f, "pkg %s\n", name);
+  for(i = 0; vars[i]; i++) {
+    v = getenv(vars[i]);
+    fprintf(f, "%s %s\n", vars[i], v ? v : "");
+  }
+  fclose(f);
+  return buf;
+}
+
+static char *cplr_pkgconfig_deps(const char *name) {
+  char *buf = NULL, *path, *dir, *save, *dep, *files, *pc;
+  size_t len = 0;
+  FILE *f;
+  f = open_memstream(&buf, &len);
+  /* directories change when files are added or removed */
+  path = cpkg_search_path();
+  for(dir = strtok_r(path, ":", &save); dir; dir = strtok_r(NULL, ":", &save)) {
+    if(*dir && (dep = cplr_cache_depline(dir))) {
+      fputs(dep, f);
+      cext_free(dep);
+    }
+  }
+  cext_free(path);
+  /* package files may be edited in place, required ones included */
+  files = cpkg_files(name);
+  for(pc = strtok_r(files, "\n", &save); pc; pc = strtok_r(NULL, "\n", &save)) {
+    if((dep = cplr_cache_depline(pc))) {
+      fputs(dep, f);
+      cext_free(dep);
+    }
+  }
+  cext_free(files);
+  fclose(f);
+  return buf;
+}
+
+static char *cplr_pkgconfig_load(cplr_t *c, const char *kpath, const char *key) {
+  char *stored, *cur, *end, *ret = NULL;
+  size_t klen = strlen(key);
+  stored = cplr_cache_read(kpath, NULL);
+  if(!stored) {
+    return NULL;
+  }
+  if(strncmp(stored, key, klen) || !strprefix(stored + klen, "--\nF ")) {
+    goto out;
+  }
+  cur = stored + klen + 5;
+  end = strchr(cur, '\n');
+  if(!end || !cplr_cache_depcheck(end + 1)) {
+    goto out;
+  }
+  ret = strndup(cur, end - cur);
+ out:
+  cext_free(stored);
+  return ret;
+}
+
+static void cplr_pkgconfig_store(cplr_t *c, const char *kpath,
+                                 const char *key, const char *name,
+                                 const char *flags) {
+  char *deps, *entry;
+  deps = cplr_pkgconfig_deps(name);
+  entry = msprintf("%s--\nF %s\n%s", key, flags, deps);
+  cplr_cache_write(kpath, entry, strlen(entry));
+  cext_free(entry);
+  cext_free(deps);
+}
+
+/* look up a package in the disk cache */
+static char *cplr_pkgconfig_cached(cplr_t *c, const char *name,
+                                   char **keyp, char **kpathp) {
+  cext_hash_t h;
+  char hex[CEXT_HASH_HEXLEN];
+  char *key, *kpath, *s = NULL;
+  key = cplr_pkgconfig_key(name);
+  cext_hash_init(&h);
+  cext_hash_str(&h, key);
+  cext_hash_hex(&h, hex);
+  kpath = cplr_cache_path("pkgconfig", hex, ".key");
+  if(kpath) {
+    s = cplr_pkgconfig_load(c, kpath, key);
+  }
+  if(c->verbosity >= 1) {
+    fprintf(stderr, "Package cache %s for %s\n", s ? "hit" : "miss", name);
+  }
+  *keyp = key;
+  *kpathp = kpath;
+  return s;
+}
+
+void cplr_pkgconfig_start(cplr_t *c) {
+  bool verbose = (c->verbosity >= 2);
+  char *key = NULL, *kpath = NULL, *s;
+  const char *name;
+  pkgjob_t *j;
+  value_t *i;
+
+  /* the native resolver is quick and runs in place */
+  if(!(c->flag & CPLR_FLAG_PKGCONFIG)) {
+    return;
+  }
+
+  V_FORWARD(&c->pkgs, i) {
+    name = value_get_str(i);
+    if(cplr_pkgconfig_memo_find(name) || cplr_pkgconfig_pending(name)) {
+      continue;
+    }
+    /* cached packages need no process */
+    if(cplr_cache_enabled(c)) {
+      s = cplr_pkgconfig_cached(c, name, &key, &kpath);
+      if(s) {
+        cplr_pkgconfig_memo_add(name, s);
+        cext_free(s);
+        cext_lfree(kpath);
+        cext_free(key);
+        continue;
+      }
+    }
+    /* start all others at once */
+    j = cext_calloc(1, sizeof(pkgjob_t));
+    j->job = cpkg_start(name, "--cflags --libs", verbose);
+    if(!j->job) {
+      cext_lfree(kpath);
+      cext_lfree(key);
+      cext_free(j);
+      continue;
+    }
+    j->name = strdup(name);
+    j->key = key;
+    j->kpath = kpath;
+    j->next = pkgjobs;
+    pkgjobs = j;
+    key = kpath = NULL;
+    if(!pkgjobs_started) {
+      pkgjobs_started = cplr_clock();
+    }
+  }
+}
 
+void cplr_pkgconfig_join(cplr_t *c) {
+  double begin, end;
+  int n = 0;
+  pkgjob_t *j;
+  char *s;
+
+  if(!pkgjobs) {
+    return;
+  }
+
+  begin = cplr_clock();
+  while((j = pkgjobs)) {
+    pkgjobs = j->next;
+    /* failures are reported when resolving in place */
+    s = cpkg_finish(j->job);
+    if(s) {
+      if(j->kpath) {
+        cplr_pkgconfig_store(c, j->kpath, j->key, j->name, s);
+      }
+      cplr_pkgconfig_memo_add(j->name, s);
+      cext_free(s);
+    }
+    cext_lfree(j->kpath);
+    cext_lfree(j->key);
+    cext_free(j->name);
+    cext_free(j);
+    n++;
+  }
+  end = cplr_clock();
+
+  if(c->verbosity >= 1) {
+    fprintf(stderr, "Resolved %d packages in the background, waited %.2fms of %.2fms\n",
+            n, end - begin, end - pkgjobs_started);
+  }
+  pkgjobs_started = 0;
+}
+
+char *cplr_pkgconfig_resolve(cplr_t *c, const char *name) {
+  bool verbose = (c->verbosity >= 2);
+  char *key = NULL, *kpath = NULL, *s = NULL;
+  pkgmemo_t *m;
+
+  /* collect background results */
+  cplr_pkgconfig_join(c);
+
+  /* resolved before in this session */
+  if((m = cplr_pkgconfig_memo_find(name))) {
+    /* failures have been reported the first time */
+    if(!m->flags) {
+      return NULL;
+    }
+    if(verbose) {
+      fprintf(stderr, "Package %s already resolved\n", name);
+    }
+    return strdup(m->flags);
+  }
+
+  /* resolve natively unless asked not to */
+  if(!(c->flag & CPLR_FLAG_PKGCONFIG)) {
+    s = cpkg_resolve(name, verbose);
+    goto out;
+  }
+
+  /* check the disk cache */
+  if(cplr_cache_enabled(c)) {
+    s = cplr_pkgconfig_cached(c, name, &key, &kpath);
+  }
+
+  /* ask pkg-config */
+  if(!s) {
     if(!cpkg_exists(name, verbose)) {
       fprintf(stderr, "Error: Could not find package %s\n", name);
-      return 1;
+      goto out;
     }
-
     s = cpkg_retrieve(name, "--cflags --libs", verbose);
     if(!s) {
       fprintf(stderr, "Error: Could not get options for package %s\n", name);
+      goto out;
+    }
+    if(kpath) {
+      cplr_pkgconfig_store(c, kpath, key, name, s);
+    }
+  }
+
+ out:
+  /* remember for the session */
+  cplr_pkgconfig_memo_add(name, s);
+  cext_lfree(kpath);
+  cext_lfree(key);
+  return s;
+}
+
+int cplr_pkgconfig_prepare(cplr_t *c, const char *name) {
+    char *s;
+    bool verbose = (c->verbosity >= 2);
+    TCCState *t = c->tcc;
+
+    s = cplr_pkgconfig_resolve(c, name);
+    if(!s) {
       return 1;
     }
     if(verbose)
@@ -52,6 +340,28 @@ int cplr_pkgconfig_prepare(cplr_t *c, const char *name) {
     return 0;
 }
 
+int cplr_pkgconfig_apply(cplr_t *c, const char *name) {
+  char *s;
+
+  s = cplr_pkgconfig_resolve(c, name);
+  if(!s) {
+    return 1;
+  }
+  if(cplr_pkgconfig_add(c, name, s)) {
+    fprintf(stderr, "Error: Failed to process package %s.\n", name);
+    return 1;
+  }
+  cext_free(s);
+
+  return 0;
+}
+
+static void cplr_pkgconfig_pile(vh_t *pile, char *s) {
+  /* shared by packages and chained states, keep one of each */
+  v_append_str_unique(pile, s);
+  cext_free(s);
+}
+
 int cplr_pkgconfig_add(cplr_t *c, const char *name, const char *args) {
   bool dash = false;
   char opt = 0;
@@ -68,25 +378,25 @@ int cplr_pkgconfig_add(cplr_t *c, const char *name, const char *args) {
       switch(opt) {
       case 'D':
       case 'U':
-        l_append_str_owned(&c->defs, msprintf("-%c%s", opt, s));
-        cext_free(s);
         if(c->verbosity >= 2)
           fprintf(stderr, "Package %s define: -%c%s\n", name, opt, s);
+        cplr_pkgconfig_pile(&c->defs, msprintf("-%c%s", opt, s));
+        cext_free(s);
         break;
       case 'I':
-        l_append_str_owned(&c->incdirs, s);
         if(c->verbosity >= 2)
           fprintf(stderr, "Package %s include dir: %s\n", name, s);
+        cplr_pkgconfig_pile(&c->incdirs, s);
         break;
       case 'L':
-        l_append_str_owned(&c->libdirs, s);
         if(c->verbosity >= 2)
           fprintf(stderr, "Package %s library dir: %s\n", name, s);
+        cplr_pkgconfig_pile(&c->libdirs, s);
         break;
       case 'l':
-        l_append_str_owned(&c->libs, s);
         if(c->verbosity >= 2)
           fprintf(stderr, "Package %s library: %s\n", name, s);
+        cplr_pkgconfig_pile(&c->libs, s);
         break;
       default:
         cext_free(s);
@@ -106,7 +416,9 @@ int cplr_pkgconfig_add(cplr_t *c, const char *name, const char *args) {
         if(strstr(o, "pthread") == o) {
           if(c->verbosity >= 2)
             fprintf(stderr, "Package %s uses pthreads.\n", name);
-          tcc_set_options(c->tcc, "-pthread");
+          if(c->tcc) {
+            tcc_set_options(c->tcc, "-pthread");
+          }
           o += 6;
           break;
         }
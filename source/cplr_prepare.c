@@ -19,6 +19,13 @@
 
 #include "cplr.h"
 
+#include <cplr/runtime.h>
+
+#include <sys/wait.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
 static void cplr_tcc_error(void *o, const char *msg) {
   cplr_t *c = (cplr_t*)o;
   char *clone = strdup(msg);
@@ -34,7 +41,7 @@ static void cplr_tcc_error(void *o, const char *msg) {
   cext_free(clone);
 }
 
-static int cplr_tcc_prepare_libdir(cplr_t *c) {
+int cplr_tcc_prepare_libdir(cplr_t *c, TCCState *t) {
   const char *libdir = NULL;
   /* check the environment */
   libdir = getenv("CPLR_TINYCC_LIBDIR");
@@ -46,15 +53,121 @@ static int cplr_tcc_prepare_libdir(cplr_t *c) {
 #endif
   /* give the path to tcc - owned by it */
   if(libdir) {
-    tcc_set_lib_path(c->tcc, libdir);
+    tcc_set_lib_path(t, libdir);
   }
+  return 0;
 }
 
-static int cplr_tcc_prepare(cplr_t *c) {
+int cplr_tcc_prepare_paths(cplr_t *c, TCCState *t) {
+  value_t *i;
+
+  /* cpp defines */
+  V_FORWARD(&c->defdef, i) {
+    tcc_set_options(t, value_get_str(i));
+  }
+
+  /* cpp undefines */
+  V_FORWARD(&c->defs, i) {
+    tcc_set_options(t, value_get_str(i));
+  }
+
+  /* sysinclude dirs */
+  V_FORWARD(&c->sysdirs, i) {
+    if(tcc_add_sysinclude_path(t, value_get_str(i))) {
+      fprintf(stderr, "Failed to add sysinclude path %s\n", value_get_str(i));
+      return 1;
+    }
+  }
+
+  /* include dirs */
+  V_FORWARD(&c->incdirs, i) {
+    if(tcc_add_include_path(t, value_get_str(i))) {
+      fprintf(stderr, "Failed to add include path %s\n", value_get_str(i));
+      return 1;
+    }
+  }
+  if(tcc_add_include_path(t, ".")) {
+    fprintf(stderr, "Failed to add include path .\n");
+    return 1;
+  }
+
+  return 0;
+}
+
+/* functions of our runtime */
+static const struct {
+  const char *name;
+  const void *addr;
+} cplr_runtime_syms[] = {
+  { "cplr_scan", cplr_scan },
+  { "cplr_split", cplr_split },
+  { "cplr_fields", cplr_fields },
+  { "cplr_int", cplr_int },
+  { "cplr_float", cplr_float },
+  { "cplr_runtime_isa", cplr_runtime_isa },
+  { NULL, NULL },
+};
+
+/* inline helpers of the runtime header */
+static const char *cplr_runtime_inlines[] = {
+  "cplr_field_int",
+  "cplr_field_float",
+  NULL,
+};
+
+/* check if NAME belongs to our runtime */
+bool cplr_runtime_defines(const char *name) {
+  int i;
+  for(i = 0; cplr_runtime_syms[i].name; i++) {
+    if(strcmp(name, cplr_runtime_syms[i].name) == 0) {
+      return true;
+    }
+  }
+  for(i = 0; cplr_runtime_inlines[i]; i++) {
+    if(strcmp(name, cplr_runtime_inlines[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* in-memory code uses the runtime linked into cplr */
+static void cplr_tcc_prepare_runtime(cplr_t *c, TCCState *t) {
+  int i;
+  if(c->otype != CPLR_OUTPUT_MEMORY) {
+    return;
+  }
+  for(i = 0; cplr_runtime_syms[i].name; i++) {
+    tcc_add_symbol(t, cplr_runtime_syms[i].name, cplr_runtime_syms[i].addr);
+  }
+}
+
+/* compiler and machine options */
+static void cplr_tcc_prepare_options(cplr_t *c, TCCState *t) {
+  value_t *i;
+  char *o;
+  V_FORWARD(&c->optf, i) {
+    o = msprintf("-f%s", value_get_str(i));
+    tcc_set_options(t, o);
+    cext_free(o);
+  }
+  V_FORWARD(&c->optm, i) {
+    o = msprintf("-m%s", value_get_str(i));
+    tcc_set_options(t, o);
+    cext_free(o);
+  }
+  /* code cache entries record the files we open */
+  if(c->cache_deps) {
+    tcc_set_options(t, "-vv");
+  }
+}
+
+static int cplr_tcc_prepare_compiler(cplr_t *c) {
   int ret = 1;
   TCCState *t;
   int otype;
-  ln_t *i;
+  value_t *i;
+  double begin;
 
   /* new compiler */
   t = tcc_new();
@@ -64,16 +177,28 @@ static int cplr_tcc_prepare(cplr_t *c) {
   c->tcc = t;
 
   /* set up libdir */
-  cplr_tcc_prepare_libdir(c);
+  cplr_tcc_prepare_libdir(c, t);
 
   /* error handling */
   tcc_set_error_func(t, c, cplr_tcc_error);
 
   /* set output type */
-  if(c->out == NULL) {
-    otype = TCC_OUTPUT_MEMORY;
-  } else {
+  switch(c->otype) {
+  case CPLR_OUTPUT_DLL:
+    otype = TCC_OUTPUT_DLL;
+    break;
+  case CPLR_OUTPUT_EXE:
     otype = TCC_OUTPUT_EXE;
+    break;
+  case CPLR_OUTPUT_OBJ:
+    otype = TCC_OUTPUT_OBJ;
+    break;
+  case CPLR_OUTPUT_PREPROCESS:
+    otype = TCC_OUTPUT_PREPROCESS;
+    break;
+  default:
+    otype = TCC_OUTPUT_MEMORY;
+    break;
   }
   if(tcc_set_output_type(c->tcc, otype)) {
     fprintf(stderr, "Failed to set output type %d\n", otype);
@@ -84,81 +209,324 @@ static int cplr_tcc_prepare(cplr_t *c) {
   tcc_set_options(t, "-Wall");
   //tcc_set_options(t, "-g");
   //tcc_set_options(t, "-bt");
+  cplr_tcc_prepare_options(c, t);
 
   /* packages */
-  L_FORWARD(&c->pkgs, i) {
-    if(cplr_pkgconfig_prepare(c, value_get_str(&i->v))) {
-      fprintf(stderr, "Failed to prepare package %s\n", value_get_str(&i->v));
+  V_FORWARD(&c->pkgs, i) {
+    begin = cplr_clock();
+    if(cplr_pkgconfig_prepare(c, value_get_str(i))) {
+      fprintf(stderr, "Failed to prepare package %s\n", value_get_str(i));
       goto out;
     }
+    cplr_stats_item(c, "package", value_get_str(i), begin);
   }
 
-  /* cpp defines */
-  L_FORWARD(&c->defdef, i) {
-    tcc_set_options(t, value_get_str(&i->v));
-  }
-
-  /* cpp undefines */
-  L_FORWARD(&c->defs, i) {
-    tcc_set_options(t, value_get_str(&i->v));
+  /* defines and include dirs */
+  if(cplr_tcc_prepare_paths(c, t)) {
+    goto out;
   }
 
-  /* sysinclude dirs */
-  L_FORWARD(&c->sysdirs, i) {
-    if(tcc_add_sysinclude_path(t, value_get_str(&i->v))) {
-      fprintf(stderr, "Failed to add sysinclude path %s\n", value_get_str(&i->v));
+  /* library dirs */
+  V_FORWARD(&c->libdirs, i) {
+    if(tcc_add_library_path(t, value_get_str(i))) {
+      fprintf(stderr, "Failed to add library path %s\n", value_get_str(i));
       goto out;
     }
   }
+  if(tcc_add_library_path(t, ".")) {
+    fprintf(stderr, "Failed to add library path .\n");
+    goto out;
+  }
 
-  /* include dirs */
-  L_FORWARD(&c->incdirs, i) {
-    if(tcc_add_include_path(t, value_get_str(&i->v))) {
-      fprintf(stderr, "Failed to add include path %s\n", value_get_str(&i->v));
-      goto out;
+  /* libraries, unless linking is left to others */
+  if(cplr_output_links(c)) {
+    V_FORWARD(&c->libs, i) {
+      if(tcc_add_library(t, value_get_str(i))) {
+        fprintf(stderr, "Failed to add library %s\n", value_get_str(i));
+        goto out;
+      }
+      c->stats.libraries++;
     }
   }
-  if(tcc_add_include_path(t, ".")) {
-    fprintf(stderr, "Failed to add include path .\n");
-    goto out;
+
+  /* runtime */
+  cplr_tcc_prepare_runtime(c, t);
+
+  /* done */
+  ret = 0;
+
+ out:
+
+  return ret;
+}
+
+/* number of parallel compilations */
+static int cplr_tcc_prepare_jobs(void) {
+  const char *env = getenv("CPLR_COMPILE_JOBS");
+  long n;
+  if(env && *env) {
+    return atoi(env);
   }
+  n = sysconf(_SC_NPROCESSORS_ONLN);
+  return (n > 0) ? n : 1;
+}
 
-  /* library dirs */
-  L_FORWARD(&c->libdirs, i) {
-    if(tcc_add_library_path(t, value_get_str(&i->v))) {
-      fprintf(stderr, "Failed to add library path %s\n", value_get_str(&i->v));
-      goto out;
+static bool cplr_tcc_prepare_isc(const char *src) {
+  size_t l = strlen(src);
+  return l > 2 && !strcmp(src + l - 2, ".c");
+}
+
+/* compile a source file to an object in a child */
+static pid_t cplr_tcc_prepare_object(cplr_t *c, const char *src, const char *obj) {
+  TCCState *t;
+  pid_t p;
+  fflush(stdout);
+  fflush(stderr);
+  p = fork();
+  if(p != 0) {
+    return p;
+  }
+  /* reports of concurrent compilers must not mix within lines */
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  t = tcc_new();
+  if(!t) {
+    _exit(1);
+  }
+  cplr_tcc_prepare_libdir(c, t);
+  tcc_set_error_func(t, c, cplr_tcc_error);
+  if(tcc_set_output_type(t, TCC_OUTPUT_OBJ)) {
+    _exit(1);
+  }
+  tcc_set_options(t, "-Wall");
+  cplr_tcc_prepare_options(c, t);
+  if(cplr_tcc_prepare_paths(c, t)) {
+    _exit(1);
+  }
+  if(tcc_add_file(t, src)) {
+    _exit(1);
+  }
+  if(tcc_output_file(t, obj)) {
+    fprintf(stderr, "Failed to output file %s\n", obj);
+    _exit(1);
+  }
+  _exit(0);
+}
+
+/* wait for an object and check that it was built */
+static int cplr_tcc_prepare_reap(pid_t p) {
+  pid_t rp;
+  int rc;
+  do {
+    rp = waitpid(p, &rc, 0);
+    if(rp < 0 && errno != EINTR) {
+      return 1;
     }
+  } while(rp != p);
+  return !WIFEXITED(rc) || WEXITSTATUS(rc) != 0;
+}
+
+/* wait for the object of source K, which took until now */
+static int cplr_tcc_prepare_await(cplr_t *c, pid_t *pids, double *begins,
+                                  const char **names, int k) {
+  if(cplr_tcc_prepare_reap(pids[k])) {
+    return 1;
   }
-  if(tcc_add_library_path(t, ".")) {
-    fprintf(stderr, "Failed to add library path .\n");
-    goto out;
+  cplr_stats_item(c, "source", names[k], begins[k]);
+  return 0;
+}
+
+/*
+ * Compile C sources to objects concurrently, one compiler per child,
+ * and add the objects to our compiler in command line order.
+ *
+ * Returns -1 if there is nothing to parallelize.
+ */
+static int cplr_tcc_prepare_sources(cplr_t *c) {
+  const char *tmpdir = getenv("TMPDIR");
+  int ret = 1, jobs, n = 0, k, first = 0, next = 0;
+  char *dir, **objs;
+  const char **names;
+  double *begins;
+  pid_t *pids;
+  value_t *i;
+
+  /* only worth it with several C sources */
+  jobs = cplr_tcc_prepare_jobs();
+  V_FORWARD(&c->srcs, i) {
+    if(cplr_tcc_prepare_isc(value_get_str(i))) {
+      n++;
+    }
+  }
+  if(n < 2 || jobs < 2) {
+    return -1;
   }
 
-  /* libraries */
-  L_FORWARD(&c->libs, i) {
-    if(tcc_add_library(t, value_get_str(&i->v))) {
-      fprintf(stderr, "Failed to add library %s\n", value_get_str(&i->v));
+  /* objects go to a private directory */
+  dir = msprintf("%s/cplr-objects.XXXXXX", tmpdir ? tmpdir : "/tmp");
+  if(!mkdtemp(dir)) {
+    cext_free(dir);
+    return -1;
+  }
+  objs = cext_calloc(n, sizeof(char*));
+  pids = cext_calloc(n, sizeof(pid_t));
+  begins = cext_calloc(n, sizeof(double));
+  names = cext_calloc(n, sizeof(char*));
+
+  if(c->verbosity >= 1) {
+    fprintf(stderr, "Compiling %d sources with %d jobs\n", n, jobs);
+  }
+
+  /* keep up to jobs compilers running, collect in order */
+  V_FORWARD(&c->srcs, i) {
+    const char *src = value_get_str(i);
+    if(!cplr_tcc_prepare_isc(src)) {
+      continue;
+    }
+    if(next - first == jobs) {
+      if(cplr_tcc_prepare_await(c, pids, begins, names, first++)) {
+        goto out;
+      }
+    }
+    objs[next] = msprintf("%s/%d.o", dir, next);
+    if(c->verbosity >= 2) {
+      fprintf(stderr, "Compiling %s\n", src);
+    }
+    names[next] = src;
+    begins[next] = cplr_clock();
+    pids[next] = cplr_tcc_prepare_object(c, src, objs[next]);
+    if(pids[next] < 0) {
+      fprintf(stderr, "Failed to fork compiler for %s\n", src);
+      goto out;
+    }
+    next++;
+  }
+  while(first < next) {
+    if(cplr_tcc_prepare_await(c, pids, begins, names, first++)) {
       goto out;
     }
   }
 
-  /* source files */
-  L_FORWARD(&c->srcs, i) {
-    if(tcc_add_file(t, value_get_str(&i->v))) {
-      fprintf(stderr, "Failed to add file %s\n", value_get_str(&i->v));
+  /* link everything in the original order */
+  k = 0;
+  V_FORWARD(&c->srcs, i) {
+    const char *src = value_get_str(i);
+    const char *file = cplr_tcc_prepare_isc(src) ? objs[k++] : src;
+    if(tcc_add_file(c->tcc, file)) {
+      fprintf(stderr, "Failed to add file %s\n", src);
       goto out;
     }
   }
 
-  /* done */
   ret = 0;
 
  out:
-
+  /* reap what is left after an error */
+  while(first < next) {
+    cplr_tcc_prepare_reap(pids[first++]);
+  }
+  for(k = 0; k < next; k++) {
+    unlink(objs[k]);
+    cext_free(objs[k]);
+  }
+  rmdir(dir);
+  cext_free(objs);
+  cext_free(pids);
+  cext_free(begins);
+  cext_free(names);
+  cext_free(dir);
   return ret;
 }
 
+static int cplr_tcc_prepare_inputs(cplr_t *c) {
+  TCCState *t = c->tcc;
+  value_t *i;
+  double begin;
+  int res;
+
+  /* preprocessed output is the generated code alone */
+  if(c->otype == CPLR_OUTPUT_PREPROCESS) {
+    return 0;
+  }
+
+  /* header prologue, once per session when interactive */
+  if(c->flag & CPLR_FLAG_INTERACTIVE) {
+    if(cplr_prologue_session(c) && cplr_cache_enabled(c)) {
+      cplr_prologue_prepare(c);
+    }
+  } else if(cplr_cache_enabled(c)) {
+    cplr_prologue_prepare(c);
+  }
+
+  /* compile sources in parallel if there are several */
+  res = cplr_tcc_prepare_sources(c);
+  if(res >= 0) {
+    return res;
+  }
+
+  /* source files */
+  V_FORWARD(&c->srcs, i) {
+    begin = cplr_clock();
+    if(tcc_add_file(t, value_get_str(i))) {
+      fprintf(stderr, "Failed to add file %s\n", value_get_str(i));
+      return 1;
+    }
+    cplr_stats_item(c, "source", value_get_str(i), begin);
+  }
+
+  return 0;
+}
+
+static int cplr_tcc_prepare(cplr_t *c) {
+  value_t *i;
+  double begin;
+
+  /* use a compiler prepared by the server */
+  c->tcc = cplr_server_take(c);
+  if(c->tcc) {
+    if(c->verbosity >= 2) {
+      fprintf(stderr, "Using prepared compiler\n");
+    }
+    tcc_set_error_func(c->tcc, c, cplr_tcc_error);
+    /* packages still contribute to the piles */
+    V_FORWARD(&c->pkgs, i) {
+      begin = cplr_clock();
+      if(cplr_pkgconfig_apply(c, value_get_str(i))) {
+        fprintf(stderr, "Failed to prepare package %s\n", value_get_str(i));
+        return 1;
+      }
+      cplr_stats_item(c, "package", value_get_str(i), begin);
+    }
+  } else if(cplr_tcc_prepare_compiler(c)) {
+    return 1;
+  }
+
+  return cplr_tcc_prepare_inputs(c);
+}
+
+/* the system compiler only needs the piles */
+static int cplr_cc_prepare(cplr_t *c) {
+  value_t *i;
+  double begin;
+  V_FORWARD(&c->pkgs, i) {
+    begin = cplr_clock();
+    if(cplr_pkgconfig_apply(c, value_get_str(i))) {
+      fprintf(stderr, "Failed to prepare package %s\n", value_get_str(i));
+      return 1;
+    }
+    cplr_stats_item(c, "package", value_get_str(i), begin);
+  }
+  return 0;
+}
+
+int cplr_prepare_compiler(cplr_t *c) {
+  switch(c->backend) {
+  case CPLR_BACKEND_LIBTCC:
+    return cplr_tcc_prepare_compiler(c);
+  default:
+    return 1;
+  }
+}
+
 int cplr_prepare(cplr_t *c) {
   int ret = 1;
 
@@ -167,8 +535,17 @@ int cplr_prepare(cplr_t *c) {
     fprintf(stderr, "Preparation phase\n");
   }
 
+  /* generated source needs no compiler */
+  if(c->otype == CPLR_OUTPUT_SOURCE) {
+    c->flag |= CPLR_FLAG_PREPARED;
+    return 0;
+  }
+
   /* call backend method */
   switch(c->backend) {
+  case CPLR_BACKEND_CC:
+    ret = cplr_cc_prepare(c);
+    break;
   case CPLR_BACKEND_LIBTCC:
     ret = cplr_tcc_prepare(c);
     break;
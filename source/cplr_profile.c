@@ -0,0 +1,542 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Sampling profiler
+ *
+ * With --profile the program calls back into cplr as main starts.
+ * From there a profiling timer interrupts it at a fixed rate. Each
+ * signal records the interrupted PC, the return addresses along the
+ * chain of frame pointers above it and the statement the program was
+ * last in, as generated code marks every statement with the name its
+ * #line directive carries.
+ *
+ * Identical samples are counted in a table allocated up front, so the
+ * signal handler never allocates. When the program is done, addresses
+ * are resolved against the symbols of the compiler state and against
+ * loaded shared objects, then written as folded stacks for flame graph
+ * tools and summarized on stderr.
+ */
+
+#include "cplr.h"
+
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+/* default sampling rate, off the usual timer multiples */
+#define CPLR_PROFILE_HZ 997
+/* frames recorded per sample */
+#define CPLR_PROFILE_DEPTH 32
+/* distinct samples, power of two */
+#define CPLR_PROFILE_SLOTS 8192
+/* entries in the summary */
+#define CPLR_PROFILE_TOP 10
+
+/* default file for folded stacks */
+static const char *cplr_profile_default = "cplr.folded";
+
+/* samples with the same stack and statement */
+typedef struct {
+  uintptr_t hash;
+  unsigned long count;
+  const char *origin;
+  int depth;
+  uintptr_t pc[CPLR_PROFILE_DEPTH];
+} profile_slot_t;
+
+/* symbol of generated code or of our runtime */
+typedef struct {
+  uintptr_t addr;
+  void *base;
+  const char *name;
+} profile_sym_t;
+
+/* resolver for sampled addresses */
+typedef struct {
+  /* objects of generated code (NULL if anonymous) and of cplr */
+  void *base;
+  void *self;
+  profile_sym_t *syms;
+  size_t nsyms, cap;
+} profile_map_t;
+
+/* counted name for the summary and folded output */
+typedef struct {
+  const char *name;
+  unsigned long count;
+} profile_count_t;
+
+/* state waiting for its callback */
+static cplr_t *profile_state = NULL;
+/* statement marker of the running program */
+static const char *volatile *profile_origin = NULL;
+/* sample table and its lock */
+static profile_slot_t *profile_slots = NULL;
+static volatile int profile_lock = 0;
+static unsigned long profile_samples = 0;
+static unsigned long profile_dropped = 0;
+/* stack of the thread that started, readable without checks */
+static uintptr_t profile_stack_lo = 0;
+static uintptr_t profile_stack_hi = 0;
+static int profile_hz = CPLR_PROFILE_HZ;
+static double profile_cpu = 0;
+static bool profile_running = false;
+static struct sigaction profile_oldsa;
+
+/* get pc, frame pointer and stack pointer of an interrupted context */
+static bool cplr_profile_context(void *ctx, uintptr_t *pc, uintptr_t *fp, uintptr_t *sp) {
+  ucontext_t *uc = ctx;
+#if defined(__x86_64__)
+  *pc = uc->uc_mcontext.gregs[REG_RIP];
+  *fp = uc->uc_mcontext.gregs[REG_RBP];
+  *sp = uc->uc_mcontext.gregs[REG_RSP];
+  return true;
+#elif defined(__i386__)
+  *pc = uc->uc_mcontext.gregs[REG_EIP];
+  *fp = uc->uc_mcontext.gregs[REG_EBP];
+  *sp = uc->uc_mcontext.gregs[REG_ESP];
+  return true;
+#elif defined(__aarch64__)
+  *pc = uc->uc_mcontext.pc;
+  *fp = uc->uc_mcontext.regs[29];
+  *sp = uc->uc_mcontext.sp;
+  return true;
+#else
+  (void)uc; (void)pc; (void)fp; (void)sp;
+  return false;
+#endif
+}
+
+/* read saved frame pointer and return address, tolerating bad frames */
+static bool cplr_profile_frame(uintptr_t fp, uintptr_t frame[2]) {
+  struct iovec local, remote;
+  if(fp >= profile_stack_lo && fp + 2 * sizeof(uintptr_t) <= profile_stack_hi) {
+    memcpy(frame, (void*)fp, 2 * sizeof(uintptr_t));
+    return true;
+  }
+  /* other threads, let the kernel check the address */
+  local.iov_base = frame;
+  local.iov_len = 2 * sizeof(uintptr_t);
+  remote.iov_base = (void*)fp;
+  remote.iov_len = 2 * sizeof(uintptr_t);
+  return process_vm_readv(getpid(), &local, 1, &remote, 1, 0)
+    == (ssize_t)(2 * sizeof(uintptr_t));
+}
+
+static void cplr_profile_signal(int sig, siginfo_t *si, void *ctx) {
+  uintptr_t pc[CPLR_PROFILE_DEPTH];
+  uintptr_t fp, sp, frame[2], h;
+  const char *origin;
+  profile_slot_t *s;
+  int i, n, saved = errno;
+  (void)sig; (void)si;
+
+  if(!profile_slots || !cplr_profile_context(ctx, &pc[0], &fp, &sp)) {
+    goto out;
+  }
+  origin = profile_origin ? *profile_origin : NULL;
+
+  /* walk frame pointers while they look like a stack */
+  for(n = 1; n < CPLR_PROFILE_DEPTH; n++) {
+    if(fp <= sp || fp - sp > (1 << 20) || (fp & (sizeof(uintptr_t) - 1))) {
+      break;
+    }
+    if(!cplr_profile_frame(fp, frame) || !frame[1]) {
+      break;
+    }
+    /* point into the call instead of after it */
+    pc[n] = frame[1] - 1;
+    sp = fp;
+    fp = frame[0];
+  }
+
+  /* hash the sample */
+  h = (uintptr_t)origin;
+  for(i = 0; i < n; i++) {
+    h = (h ^ pc[i]) * 0x100000001b3ULL;
+  }
+
+  /* count it, threads take turns */
+  while(__sync_lock_test_and_set(&profile_lock, 1));
+  profile_samples++;
+  for(i = 0; i < CPLR_PROFILE_SLOTS; i++) {
+    s = &profile_slots[(h + i) & (CPLR_PROFILE_SLOTS - 1)];
+    if(!s->count) {
+      s->hash = h;
+      s->origin = origin;
+      s->depth = n;
+      memcpy(s->pc, pc, n * sizeof(uintptr_t));
+      s->count = 1;
+      break;
+    }
+    if(s->hash == h && s->origin == origin && s->depth == n
+       && !memcmp(s->pc, pc, n * sizeof(uintptr_t))) {
+      s->count++;
+      break;
+    }
+  }
+  if(i == CPLR_PROFILE_SLOTS) {
+    profile_dropped++;
+  }
+  __sync_lock_release(&profile_lock);
+
+ out:
+  errno = saved;
+}
+
+/* processor time of all threads in milliseconds */
+static double cplr_profile_cpu(void) {
+  struct timespec ts;
+  if(clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts)) {
+    return 0;
+  }
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+/* remember the stack of the starting thread */
+static void cplr_profile_stack(void) {
+  pthread_attr_t attr;
+  void *addr;
+  size_t size;
+  profile_stack_lo = profile_stack_hi = 0;
+  if(pthread_getattr_np(pthread_self(), &attr)) {
+    return;
+  }
+  if(!pthread_attr_getstack(&attr, &addr, &size)) {
+    profile_stack_lo = (uintptr_t)addr;
+    profile_stack_hi = (uintptr_t)addr + size;
+  }
+  pthread_attr_destroy(&attr);
+}
+
+static void cplr_profile_atexit(void) {
+  if(profile_state) {
+    cplr_profile_finish(profile_state);
+  }
+}
+
+/* called by the program as main starts */
+static void cplr_profile_hook(const char *volatile *origin) {
+  static bool registered = false;
+  struct sigaction sa;
+  struct itimerval it;
+  const char *env;
+  cplr_t *c = profile_state;
+
+  if(!c || profile_running) {
+    return;
+  }
+
+  /* sampling rate */
+  profile_hz = CPLR_PROFILE_HZ;
+  env = getenv("CPLR_PROFILE_HZ");
+  if(env && atoi(env) > 0) {
+    profile_hz = atoi(env);
+  }
+
+  /* everything the handler touches exists before it runs */
+  profile_slots = cext_calloc(CPLR_PROFILE_SLOTS, sizeof(profile_slot_t));
+  profile_samples = profile_dropped = 0;
+  profile_origin = origin;
+  cplr_profile_stack();
+
+  /* programs that exit on their own are reported too */
+  if(!registered) {
+    atexit(cplr_profile_atexit);
+    registered = true;
+  }
+
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = cplr_profile_signal;
+  sa.sa_flags = SA_SIGINFO|SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  if(sigaction(SIGPROF, &sa, &profile_oldsa)) {
+    fprintf(stderr, "Error: Failed to install profiling handler\n");
+    goto fail;
+  }
+  memset(&it, 0, sizeof(it));
+  it.it_interval.tv_usec = 1000000 / profile_hz;
+  if(!it.it_interval.tv_usec) {
+    it.it_interval.tv_usec = 1;
+  }
+  it.it_value = it.it_interval;
+  if(setitimer(ITIMER_PROF, &it, NULL)) {
+    fprintf(stderr, "Error: Failed to start profiling timer\n");
+    sigaction(SIGPROF, &profile_oldsa, NULL);
+    goto fail;
+  }
+  profile_running = true;
+  profile_cpu = cplr_profile_cpu();
+
+  if(c->verbosity >= 1) {
+    fprintf(stderr, "Profiling at %d Hz\n", profile_hz);
+  }
+  return;
+
+ fail:
+  cext_ptrfree((void**)&profile_slots);
+  profile_origin = NULL;
+}
+
+/* check if an address belongs to the generated code */
+static bool cplr_profile_generated(profile_map_t *m, uintptr_t pc) {
+  Dl_info info;
+  if(!dladdr((void*)pc, &info)) {
+    /* tcc code lives in anonymous memory */
+    return m->base == NULL;
+  }
+  return info.dli_fbase == m->base;
+}
+
+static void cplr_profile_map_cb(void *ctx, const char *name, const void *val) {
+  profile_map_t *m = ctx;
+  Dl_info info;
+  void *base = NULL;
+  if(!val) {
+    return;
+  }
+  /* imports from libraries resolve through dladdr */
+  if(dladdr(val, &info)) {
+    base = info.dli_fbase;
+  }
+  if(base != m->base && base != m->self) {
+    return;
+  }
+  if(m->nsyms == m->cap) {
+    m->cap = m->cap ? 2 * m->cap : 256;
+    m->syms = cext_realloc(m->syms, m->cap * sizeof(profile_sym_t));
+  }
+  m->syms[m->nsyms].addr = (uintptr_t)val;
+  m->syms[m->nsyms].base = base;
+  m->syms[m->nsyms].name = cext_intern(name);
+  m->nsyms++;
+}
+
+static int cplr_profile_sym_cmp(const void *a, const void *b) {
+  const profile_sym_t *x = a, *y = b;
+  return (x->addr > y->addr) - (x->addr < y->addr);
+}
+
+static void cplr_profile_map(cplr_t *c, profile_map_t *m) {
+  Dl_info info;
+  void *main;
+  memset(m, 0, sizeof(*m));
+  if(!c->tcc) {
+    return;
+  }
+  /* find out where the generated code lives */
+  main = tcc_get_symbol(c->tcc, "main");
+  if(main && dladdr(main, &info)) {
+    m->base = info.dli_fbase;
+  }
+  /* runtime functions are ours, our binary may not export them */
+  if(dladdr((void*)cplr_profile_map_cb, &info)) {
+    m->self = info.dli_fbase;
+  }
+  tcc_list_symbols(c->tcc, m, cplr_profile_map_cb);
+  if(m->nsyms) {
+    qsort(m->syms, m->nsyms, sizeof(profile_sym_t), cplr_profile_sym_cmp);
+  }
+}
+
+/* name the function containing an address */
+static const char *cplr_profile_name(profile_map_t *m, uintptr_t pc) {
+  Dl_info info;
+  const char *base;
+  void *obj = NULL;
+  size_t lo = 0, hi = m->nsyms, mid;
+  bool found = dladdr((void*)pc, &info);
+  if(found) {
+    obj = info.dli_fbase;
+    /* exported symbols of libraries are exact */
+    if(info.dli_sname && obj != m->base) {
+      return info.dli_sname;
+    }
+  }
+  /* last symbol of the same object at or below the address */
+  while(lo < hi) {
+    mid = (lo + hi) / 2;
+    if(m->syms[mid].addr <= pc) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if(lo && m->syms[lo - 1].base == obj) {
+    return m->syms[lo - 1].name;
+  }
+  if(obj == m->base) {
+    return "[generated]";
+  }
+  if(found && info.dli_fname && *info.dli_fname) {
+    base = strrchr(info.dli_fname, '/');
+    return base ? base + 1 : info.dli_fname;
+  }
+  return "[unknown]";
+}
+
+/* add to the count of a name */
+static void cplr_profile_count(profile_count_t **v, size_t *n, size_t *cap,
+                               const char *name, unsigned long count) {
+  size_t i;
+  for(i = 0; i < *n; i++) {
+    if(!strcmp((*v)[i].name, name)) {
+      (*v)[i].count += count;
+      return;
+    }
+  }
+  if(*n == *cap) {
+    *cap = *cap ? 2 * *cap : 64;
+    *v = cext_realloc(*v, *cap * sizeof(profile_count_t));
+  }
+  (*v)[*n].name = name;
+  (*v)[*n].count = count;
+  (*n)++;
+}
+
+static int cplr_profile_count_cmp(const void *a, const void *b) {
+  const profile_count_t *x = a, *y = b;
+  if(x->count != y->count) {
+    return (x->count < y->count) - (x->count > y->count);
+  }
+  return strcmp(x->name, y->name);
+}
+
+static int cplr_profile_line_cmp(const void *a, const void *b) {
+  const profile_count_t *x = a, *y = b;
+  return strcmp(x->name, y->name);
+}
+
+static void cplr_profile_top(profile_count_t *v, size_t n, const char *what) {
+  size_t i;
+  qsort(v, n, sizeof(profile_count_t), cplr_profile_count_cmp);
+  fprintf(stderr, "    self  samples  %s\n", what);
+  for(i = 0; i < n && i < CPLR_PROFILE_TOP; i++) {
+    fprintf(stderr, "  %5.1f%%  %7lu  %s\n",
+            100.0 * v[i].count / profile_samples, v[i].count, v[i].name);
+  }
+}
+
+/* fold one sample into a line, outermost frame first */
+static char *cplr_profile_fold(profile_map_t *m, profile_slot_t *s) {
+  char buf[4096];
+  size_t len;
+  int i, n;
+  /* only generated code keeps its frame pointers */
+  for(n = 1; n < s->depth && cplr_profile_generated(m, s->pc[n]); n++);
+  len = snprintf(buf, sizeof(buf), "%s", s->origin ? s->origin : "[startup]");
+  for(i = n - 1; i >= 0 && len < sizeof(buf); i--) {
+    len += snprintf(buf + len, sizeof(buf) - len, ";%s",
+                    cplr_profile_name(m, s->pc[i]));
+  }
+  return strdup(buf);
+}
+
+void cplr_profile_define(cplr_t *c) {
+  profile_state = c;
+  tcc_add_symbol(c->tcc, "__cplr_profile", cplr_profile_hook);
+}
+
+void cplr_profile_finish(cplr_t *c) {
+  struct itimerval it;
+  profile_map_t m;
+  profile_count_t *lines = NULL, *funcs = NULL, *origins = NULL;
+  size_t nlines = 0, clines = 0, nfuncs = 0, cfuncs = 0, norigins = 0, corigins = 0;
+  const char *path;
+  profile_slot_t *s;
+  double cpu;
+  FILE *f;
+  size_t i, j;
+
+  if(!profile_running) {
+    return;
+  }
+
+  /* stop sampling */
+  memset(&it, 0, sizeof(it));
+  setitimer(ITIMER_PROF, &it, NULL);
+  sigaction(SIGPROF, &profile_oldsa, NULL);
+  cpu = cplr_profile_cpu() - profile_cpu;
+  profile_running = false;
+  profile_origin = NULL;
+
+  /* resolve every distinct sample */
+  cplr_profile_map(c, &m);
+  for(i = 0; i < CPLR_PROFILE_SLOTS; i++) {
+    s = &profile_slots[i];
+    if(!s->count) {
+      continue;
+    }
+    cplr_profile_count(&lines, &nlines, &clines,
+                       cplr_profile_fold(&m, s), s->count);
+    cplr_profile_count(&funcs, &nfuncs, &cfuncs,
+                       cplr_profile_name(&m, s->pc[0]), s->count);
+    cplr_profile_count(&origins, &norigins, &corigins,
+                       s->origin ? s->origin : "[startup]", s->count);
+  }
+
+  /* write folded stacks */
+  path = c->profile ? c->profile : cplr_profile_default;
+  f = strcmp(path, "-") ? fopen(path, "w") : stdout;
+  if(!f) {
+    fprintf(stderr, "Error: Failed to open %s\n", path);
+  } else {
+    if(nlines) {
+      qsort(lines, nlines, sizeof(profile_count_t), cplr_profile_line_cmp);
+    }
+    for(i = 0; i < nlines; i++) {
+      fprintf(f, "%s %lu\n", lines[i].name, lines[i].count);
+    }
+    if(f == stdout) {
+      fflush(f);
+    } else {
+      fclose(f);
+    }
+  }
+
+  /* summarize, the timer may be coarser than asked for */
+  fprintf(stderr, "profile: %lu samples in %.0fms of cpu", profile_samples, cpu);
+  if(profile_dropped) {
+    fprintf(stderr, ", %lu without room", profile_dropped);
+  }
+  fprintf(stderr, ", folded stacks in %s\n", strcmp(path, "-") ? path : "stdout");
+  if(profile_samples) {
+    cplr_profile_top(funcs, nfuncs, "function");
+    cplr_profile_top(origins, norigins, "statement");
+  }
+
+  /* clean up */
+  for(j = 0; j < nlines; j++) {
+    cext_free((void*)lines[j].name);
+  }
+  cext_lfree(lines);
+  cext_lfree(funcs);
+  cext_lfree(origins);
+  cext_lfree(m.syms);
+  cext_ptrfree((void**)&profile_slots);
+}
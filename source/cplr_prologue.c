@@ -0,0 +1,438 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Header prologue cache
+ *
+ * TinyCC has no precompiled headers, so the include sections of the
+ * generated code get processed from scratch on every run. We instead
+ * preprocess them once (with -dD so that macros survive) into a flat
+ * file and include that in place of the original headers. This saves
+ * all include path searching, file opening and conditional skipping.
+ *
+ * Entries are keyed by everything that can influence preprocessing.
+ * Each entry records the headers it was built from, so that changes
+ * to any of them invalidate it.
+ */
+
+#include "cplr.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cext/hash.h>
+#include <cext/memory.h>
+
+/* separator between key and dependencies */
+static const char *keysep = "--\n";
+
+static void cplr_prologue_key_pile(FILE *f, const char *name, vh_t *list) {
+  value_t *i;
+  V_FORWARD(list, i) {
+    fprintf(f, "%s %s\n", name, value_get_str(i));
+  }
+}
+
+static char *cplr_prologue_key(cplr_t *c) {
+  char *buf = NULL;
+  size_t len = 0;
+  const char *libdir = getenv("CPLR_TINYCC_LIBDIR");
+  FILE *f;
+#ifndef CPLR_TINYCC_EXTERNAL
+  if(!libdir) {
+    libdir = CPLR_TINYCC_LIBDIR;
+  }
+#endif
+  f = open_memstream(&buf, &len);
+  fprintf(f, "cplr " CPLR_VERSION_STRING "\n");
+  fprintf(f, "libdir %s\n", libdir ? libdir : "");
+  cplr_prologue_key_pile(f, "defdef", &c->defdef);
+  cplr_prologue_key_pile(f, "defs", &c->defs);
+  cplr_prologue_key_pile(f, "sysdir", &c->sysdirs);
+  cplr_prologue_key_pile(f, "incdir", &c->incdirs);
+  cplr_prologue_key_pile(f, "defsys", &c->defsys);
+  cplr_prologue_key_pile(f, "sys", &c->syss);
+  cplr_prologue_key_pile(f, "inc", &c->incs);
+  fclose(f);
+  return buf;
+}
+
+static char *cplr_prologue_source(cplr_t *c) {
+  char *buf = NULL;
+  size_t len = 0;
+  value_t *i;
+  FILE *f = open_memstream(&buf, &len);
+  V_FORWARD(&c->defsys, i) {
+    fprintf(f, "#include <%s>\n", value_get_str(i));
+  }
+  V_FORWARD(&c->syss, i) {
+    fprintf(f, "#include <%s>\n", value_get_str(i));
+  }
+  V_FORWARD(&c->incs, i) {
+    fprintf(f, "#include <%s>\n", value_get_str(i));
+  }
+  fclose(f);
+  return buf;
+}
+
+static void cplr_prologue_error(void *o, const char *msg) {
+  /* the real compilation will report problems */
+}
+
+static int cplr_prologue_preprocess(cplr_t *c, const char *src, const char *tmp) {
+  TCCState *t;
+  pid_t p, rp;
+  int fd, rc = 0;
+  /* preprocessing writes to stdout, so do it in a child */
+  fflush(stdout);
+  fflush(stderr);
+  p = fork();
+  if(p < 0) {
+    return 1;
+  }
+  if(p == 0) {
+    fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    if(fd < 0 || dup2(fd, 1) < 0) {
+      _exit(1);
+    }
+    t = tcc_new();
+    if(!t) {
+      _exit(1);
+    }
+    cplr_tcc_prepare_libdir(c, t);
+    tcc_set_error_func(t, c, cplr_prologue_error);
+    if(tcc_set_output_type(t, TCC_OUTPUT_PREPROCESS)) {
+      _exit(1);
+    }
+    tcc_set_options(t, "-dD");
+    if(cplr_tcc_prepare_paths(c, t)) {
+      _exit(1);
+    }
+    if(tcc_compile_string(t, src)) {
+      _exit(1);
+    }
+    fflush(stdout);
+    _exit(0);
+  }
+  /* wait for the child */
+  do {
+    rp = waitpid(p, &rc, 0);
+    if(rp < 0 && errno != EINTR) {
+      return 1;
+    }
+  } while(rp != p);
+  if(!WIFEXITED(rc) || WEXITSTATUS(rc) != 0) {
+    return 1;
+  }
+  return 0;
+}
+
+static bool cplr_prologue_seen(vh_t *seen, const char *path) {
+  value_t *i;
+  V_FORWARD(seen, i) {
+    if(!strcmp(value_get_str(i), path)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static char *cplr_prologue_deps(const char *pre, bool *relative) {
+  char *buf = NULL, *path, *dep;
+  size_t len = 0;
+  const char *cur = pre, *q, *e;
+  vh_t seen;
+  FILE *f;
+  v_init(&seen);
+  *relative = false;
+  f = open_memstream(&buf, &len);
+  /* scan for line markers of the form '# N "file"' */
+  while(cur && *cur) {
+    if(cur[0] == '#' && cur[1] == ' ' && isdigit(cur[2])) {
+      q = strchr(cur, '"');
+      e = q ? strchr(q + 1, '"') : NULL;
+      if(q && e && q[1] != '<' && e < strchrnul(cur, '\n')) {
+        path = strndup(q + 1, e - (q + 1));
+        if(!cplr_prologue_seen(&seen, path)) {
+          if(path[0] != '/') {
+            *relative = true;
+          }
+          dep = cplr_cache_depline(path);
+          if(dep) {
+            fputs(dep, f);
+            cext_free(dep);
+          }
+          v_append_str_owned(&seen, path);
+        } else {
+          cext_free(path);
+        }
+      }
+    }
+    cur = strchr(cur, '\n');
+    if(cur) {
+      cur++;
+    }
+  }
+  fclose(f);
+  v_clear(&seen);
+  /* an empty prologue is not useful */
+  if(len == 0) {
+    cext_free(buf);
+    return NULL;
+  }
+  return buf;
+}
+
+static bool cplr_prologue_check(cplr_t *c, const char *kpath,
+                                const char *key, const char *cwd) {
+  bool ret = false;
+  char *stored, *deps;
+  size_t klen = strlen(key);
+  /* read the stored key */
+  stored = cplr_cache_read(kpath, NULL);
+  if(!stored) {
+    return false;
+  }
+  /* compare the key itself */
+  if(strncmp(stored, key, klen) || !strprefix(stored + klen, keysep)) {
+    goto out;
+  }
+  deps = stored + klen + strlen(keysep);
+  /* entries with relative headers are specific to a directory */
+  if(strprefix(deps, "C ")) {
+    char *end = strchrnul(deps, '\n');
+    if(!cwd || strncmp(deps + 2, cwd, end - (deps + 2))
+       || strlen(cwd) != (size_t)(end - (deps + 2))) {
+      goto out;
+    }
+    deps = *end ? end + 1 : end;
+  }
+  /* check the headers */
+  ret = cplr_cache_depcheck(deps);
+ out:
+  cext_free(stored);
+  return ret;
+}
+
+static int cplr_prologue_generate(cplr_t *c, const char *ipath,
+                                  const char *kpath, const char *key,
+                                  const char *cwd) {
+  int ret = 1;
+  char *src, *tmp, *pre = NULL, *deps = NULL, *entry = NULL;
+  bool relative;
+  /* preprocess into a temporary */
+  src = cplr_prologue_source(c);
+  tmp = cplr_cache_tmpname(ipath);
+  if(!tmp) {
+    goto out;
+  }
+  if(cplr_prologue_preprocess(c, src, tmp)) {
+    unlink(tmp);
+    goto out;
+  }
+  /* determine dependencies */
+  pre = cplr_cache_read(tmp, NULL);
+  if(!pre || !(deps = cplr_prologue_deps(pre, &relative))) {
+    unlink(tmp);
+    goto out;
+  }
+  /* publish the prologue, then its key */
+  if(cplr_cache_publish(tmp, ipath)) {
+    goto out;
+  }
+  if(relative && cwd) {
+    entry = msprintf("%s%sC %s\n%s", key, keysep, cwd, deps);
+  } else {
+    entry = msprintf("%s%s%s", key, keysep, deps);
+  }
+  if(cplr_cache_write(kpath, entry, strlen(entry))) {
+    goto out;
+  }
+  ret = 0;
+ out:
+  cext_lfree(entry);
+  cext_lfree(deps);
+  cext_lfree(pre);
+  cext_lfree(tmp);
+  cext_free(src);
+  return ret;
+}
+
+int cplr_prologue_prepare(cplr_t *c) {
+  int ret = 1;
+  cext_hash_t h;
+  char hex[CEXT_HASH_HEXLEN];
+  char *key, *cwd, *ipath = NULL, *kpath = NULL;
+
+  /* nothing to do without headers */
+  if(v_empty(&c->defsys) && v_empty(&c->syss) && v_empty(&c->incs)) {
+    return 0;
+  }
+
+  /* determine the key */
+  key = cplr_prologue_key(c);
+  cwd = getcwd(NULL, 0);
+  cext_hash_init(&h);
+  cext_hash_str(&h, key);
+  cext_hash_hex(&h, hex);
+
+  /* determine paths */
+  ipath = cplr_cache_path("prologue", hex, ".i");
+  kpath = cplr_cache_path("prologue", hex, ".key");
+  if(!ipath || !kpath || strchr(ipath, '"')) {
+    goto out;
+  }
+
+  /* check for a valid entry */
+  if(cplr_prologue_check(c, kpath, key, cwd)) {
+    if(c->verbosity >= 1) {
+      fprintf(stderr, "Header cache hit %s\n", hex);
+    }
+  } else {
+    if(c->verbosity >= 1) {
+      fprintf(stderr, "Header cache miss %s\n", hex);
+    }
+    if(cplr_prologue_generate(c, ipath, kpath, key, cwd)) {
+      if(c->verbosity >= 1) {
+        fprintf(stderr, "Header cache not updated\n");
+      }
+      goto out;
+    }
+  }
+
+  /* use the prologue */
+  cext_lptrfree((void**)&c->g_prologue);
+  c->g_prologue = ipath;
+  ipath = NULL;
+  ret = 0;
+
+ out:
+  cext_lfree(kpath);
+  cext_lfree(ipath);
+  cext_lfree(cwd);
+  cext_free(key);
+  return ret;
+}
+
+/*
+ * Interactive sessions compile every line as a new state with the
+ * same headers. The first state preprocesses them once and keeps the
+ * flat result in memory, so that later states neither search, open
+ * nor check a single header. This works with caches disabled, too.
+ */
+static char *cplr_prologue_session_text(cplr_t *c) {
+  char *src, *tmp, *text = NULL;
+  const char *dir;
+  int fd;
+  /* the header cache has it on disk already */
+  if(cplr_cache_enabled(c)) {
+    if(cplr_prologue_prepare(c) == 0 && c->g_prologue) {
+      return cplr_cache_read(c->g_prologue, NULL);
+    }
+    return NULL;
+  }
+  /* otherwise preprocess through a temporary */
+  dir = getenv("TMPDIR");
+  if(!dir || !*dir) {
+    dir = "/tmp";
+  }
+  tmp = msprintf("%s/cplr-headers.XXXXXX", dir);
+  fd = mkstemp(tmp);
+  if(fd < 0) {
+    cext_free(tmp);
+    return NULL;
+  }
+  close(fd);
+  src = cplr_prologue_source(c);
+  if(cplr_prologue_preprocess(c, src, tmp) == 0) {
+    text = cplr_cache_read(tmp, NULL);
+  }
+  unlink(tmp);
+  cext_free(src);
+  cext_free(tmp);
+  return text;
+}
+
+int cplr_prologue_session(cplr_t *c) {
+  cplr_t *f = c->c_first;
+  char *key, *text;
+
+  /* nothing to do without headers */
+  if(v_empty(&c->defsys) && v_empty(&c->syss) && v_empty(&c->incs)) {
+    return 0;
+  }
+
+  /* reuse what the session has if nothing changed */
+  key = cplr_prologue_key(c);
+  if(f->s_headers && f->s_headkey && !strcmp(f->s_headkey, key)) {
+    if(c->verbosity >= 2) {
+      fprintf(stderr, "Reusing session headers\n");
+    }
+    cext_free(key);
+    c->g_headers = f->s_headers;
+    return 0;
+  }
+
+  /* preprocess the headers */
+  text = cplr_prologue_session_text(c);
+  if(!text) {
+    cext_free(key);
+    return 1;
+  }
+  if(c->verbosity >= 1) {
+    fprintf(stderr, "Session headers: %zu bytes\n", strlen(text));
+  }
+
+  /* attach them to the session */
+  cext_lptrfree((void**)&f->s_headkey);
+  cext_lptrfree((void**)&f->s_headers);
+  f->s_headkey = key;
+  f->s_headers = text;
+  c->g_headers = text;
+  return 0;
+}
+
+char *cplr_prologue_depends(cplr_t *c) {
+  char *kpath, *stored, *deps, *ret = NULL;
+  size_t plen;
+  /* need a prologue */
+  if(!c->g_prologue || !strsuffix(c->g_prologue, ".i")) {
+    return NULL;
+  }
+  /* read its key */
+  plen = strlen(c->g_prologue);
+  kpath = msprintf("%.*s.key", (int)(plen - 2), c->g_prologue);
+  stored = cplr_cache_read(kpath, NULL);
+  cext_free(kpath);
+  if(!stored) {
+    return NULL;
+  }
+  /* return the dependencies, with the directory they need */
+  deps = strstr(stored, "\n--\n");
+  if(deps) {
+    ret = strdup(deps + 1 + strlen(keysep));
+  }
+  cext_free(stored);
+  return ret;
+}
@@ -0,0 +1,292 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Reclamation of old chain states
+ *
+ * Every line of an interactive session leaves a state behind. Once a
+ * state has run, everything but its compiler is only needed for
+ * listing, so buffers and stable piles are dropped right away.
+ *
+ * The compiler holds the loaded code and only goes when nothing can
+ * point into it: the state defines no functions or objects, has no
+ * literals or statics in its statements, no registry symbol is
+ * defined by it and no live state imports from it. Anything else
+ * keeps its compiler for the session.
+ *
+ * States without a compiler are folded into their predecessor once
+ * the chain grows beyond CPLR_CHAIN_LIMIT records.
+ */
+
+#include "cplr.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+/* default for CPLR_CHAIN_LIMIT */
+#define CPLR_CHAIN_LIMIT 32
+
+size_t cplr_reclaim_size(cplr_t *c) {
+  size_t r = sizeof(cplr_t);
+  r += c->g_codecap;
+  r += c->g_dumpcap;
+  r += c->sym_ndeps * sizeof(cplr_t*);
+  r += cext_arena_size(c->arena);
+  return r;
+}
+
+/* check if code has literals or statics living in its state */
+static bool cplr_reclaim_pins_code(const char *p) {
+  const char *e;
+  size_t len;
+  while(*p) {
+    if(*p == '"') {
+      /* string literals */
+      return true;
+    } else if(*p == '\'') {
+      /* character literals */
+      for(e = p + 1; *e && *e != '\''; e++) {
+        if(*e == '\\' && e[1]) {
+          e++;
+        }
+      }
+      p = *e ? e + 1 : e;
+    } else if(isalpha(*p) || *p == '_') {
+      /* identifiers */
+      for(e = p + 1; isalnum(*e) || *e == '_'; e++);
+      len = e - p;
+      if(len == 6 && !strncmp(p, "static", len)) {
+        return true;
+      }
+      /* __FILE__, __func__ and friends are literals */
+      if(len > 2 && p[0] == '_' && p[1] == '_') {
+        return true;
+      }
+      p = e;
+    } else {
+      p++;
+    }
+  }
+  return false;
+}
+
+static bool cplr_reclaim_pins_pile(vh_t *l) {
+  value_t *i;
+  V_FORWARD(l, i) {
+    if(cplr_reclaim_pins_code(value_get_str(i))) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* check if declarations create storage in every state */
+static bool cplr_reclaim_pins_decls(vh_t *l) {
+  const char *d, *e;
+  value_t *i;
+  V_FORWARD(l, i) {
+    d = value_get_str(i);
+    while(isspace(*d)) {
+      d++;
+    }
+    if(strprefix(d, "extern") || strprefix(d, "typedef")) {
+      continue;
+    }
+    /* prototypes end in a parameter list */
+    e = d + strlen(d);
+    while(e > d && isspace(e[-1])) {
+      e--;
+    }
+    if(e > d && e[-1] == ')' && !strchr(d, '=') && !strstr(d, "(*")) {
+      continue;
+    }
+    return true;
+  }
+  return false;
+}
+
+static bool cplr_reclaim_pinned(cplr_t *c) {
+  /* definitions stay where they are */
+  if(!v_empty(&c->srcs) || !v_empty(&c->tlfs)) {
+    return true;
+  }
+  /* and so does storage of declarations or statements */
+  return cplr_reclaim_pins_decls(&c->tlds)
+    || cplr_reclaim_pins_pile(&c->befs)
+    || cplr_reclaim_pins_pile(&c->stms)
+    || cplr_reclaim_pins_pile(&c->afts)
+    || cplr_reclaim_pins_pile(&c->fins);
+}
+
+static bool cplr_reclaimable(cplr_t *c) {
+  /* must have been entered into the registry */
+  cplr_symtab_learn(c);
+  if(!c->sym_learned) {
+    return false;
+  }
+  /* nothing may refer to our symbols */
+  return !c->sym_owned && !c->sym_users;
+}
+
+/* move a pile into the current arena of its state */
+static void cplr_reclaim_keep(cplr_t *c, vh_t *l) {
+  vh_t o = *l;
+  v_init_arena(l, c->arena);
+  v_splice(l, &o);
+}
+
+/* drop a pile, releasing elements shared with other states */
+static void cplr_reclaim_drop(cplr_t *c, vh_t *l) {
+  v_clear(l);
+  v_init_arena(l, c->arena);
+}
+
+static void cplr_reclaim_trim(cplr_t *c) {
+  cext_arena_t *old;
+  /* decide once, before the piles go */
+  if(cplr_reclaim_pinned(c)) {
+    c->flag |= CPLR_FLAG_PINNED;
+  }
+  c->flag |= CPLR_FLAG_TRIMMED;
+  /* drop buffers */
+  cext_lptrfree((void**)&c->g_codebuf);
+  cext_lptrfree((void**)&c->g_dumpbuf);
+  c->g_codelen = c->g_codecap = 0;
+  c->g_dumplen = c->g_dumpcap = 0;
+  c->g_prologue_len = 0;
+  /* the first state keeps its piles for the session */
+  if(c == c->c_first) {
+    return;
+  }
+  /* stable piles live on in later states, keep only our own */
+  old = c->arena;
+  c->arena = cext_arena_new(0);
+  cplr_reclaim_keep(c, &c->srcs);
+  cplr_reclaim_keep(c, &c->tlfs);
+  cplr_reclaim_keep(c, &c->befs);
+  cplr_reclaim_keep(c, &c->stms);
+  cplr_reclaim_keep(c, &c->afts);
+  cplr_reclaim_keep(c, &c->fins);
+  cplr_reclaim_drop(c, &c->optf);
+  cplr_reclaim_drop(c, &c->optm);
+  cplr_reclaim_drop(c, &c->defdef);
+  cplr_reclaim_drop(c, &c->defsys);
+  cplr_reclaim_drop(c, &c->sysdirs);
+  cplr_reclaim_drop(c, &c->incdirs);
+  cplr_reclaim_drop(c, &c->libdirs);
+  cplr_reclaim_drop(c, &c->defs);
+  cplr_reclaim_drop(c, &c->syss);
+  cplr_reclaim_drop(c, &c->incs);
+  cplr_reclaim_drop(c, &c->libs);
+  cplr_reclaim_drop(c, &c->pkgs);
+  cplr_reclaim_drop(c, &c->tlds);
+  cext_arena_free(old);
+}
+
+static void cplr_reclaim_state(cplr_t *c) {
+  /* things only needed until the state has run */
+  if(!(c->flag & CPLR_FLAG_TRIMMED)) {
+    cplr_reclaim_trim(c);
+  }
+  /* code still running keeps its compiler */
+  if((c->flag & CPLR_FLAG_EXECUTED) && !(c->flag & CPLR_FLAG_FINISHED)) {
+    return;
+  }
+  /* drop the compiler if nothing can refer to it */
+  if(c->tcc && !(c->flag & CPLR_FLAG_PINNED) && cplr_reclaimable(c)) {
+    if(c->verbosity >= 2) {
+      fprintf(stderr, "Reclaiming state c%d\n", c->c_index);
+    }
+    tcc_delete(c->tcc);
+    c->tcc = NULL;
+    cplr_symtab_release(c);
+    c->c_first->c_reclaimed++;
+  }
+}
+
+static void cplr_reclaim_fold(cplr_t *p, cplr_t *c) {
+  if(c->verbosity >= 2) {
+    fprintf(stderr, "Folding state c%d into c%d\n", c->c_index, p->c_index);
+  }
+  /* keep the history for listing */
+  v_splice(&p->srcs, &c->srcs);
+  v_splice(&p->tlfs, &c->tlfs);
+  v_splice(&p->befs, &c->befs);
+  v_splice(&p->stms, &c->stms);
+  v_splice(&p->afts, &c->afts);
+  v_splice(&p->fins, &c->fins);
+  p->c_folded += 1 + c->c_folded;
+  /* unlink and free */
+  p->c_next = c->c_next;
+  if(c->c_next) {
+    c->c_next->c_prev = p;
+  }
+  cplr_free(c);
+}
+
+void cplr_reclaim(cplr_t *c) {
+  const char *env = getenv("CPLR_CHAIN_LIMIT");
+  int limit = CPLR_CHAIN_LIMIT, count = 0;
+  cplr_t *cur, *prev;
+
+  /* reclaim what finished states no longer need */
+  for(cur = c->c_prev; cur; cur = cur->c_prev) {
+    cplr_reclaim_state(cur);
+    count++;
+  }
+
+  /* fold states without compilers when the chain is long */
+  if(env && *env) {
+    limit = atoi(env);
+  }
+  if(count <= limit) {
+    return;
+  }
+  for(cur = c->c_prev; cur && cur->c_prev; cur = prev) {
+    prev = cur->c_prev;
+    if(!cur->tcc && !prev->tcc && prev != c->c_first) {
+      cplr_reclaim_fold(prev, cur);
+    }
+  }
+}
+
+void cplr_reclaim_report(cplr_t *c) {
+  size_t total = 0;
+  long pages = 0, rss = 0;
+  int states = 0, compilers = 0;
+  cplr_t *cur;
+  FILE *f;
+  for(cur = c->c_first; cur; cur = cur->c_next) {
+    total += cplr_reclaim_size(cur);
+    states += 1 + cur->c_folded;
+    if(cur->tcc) {
+      compilers++;
+    }
+  }
+  fprintf(stderr, "mem: %zu bytes in %d states, %d compilers, %d reclaimed",
+          total, states, compilers, c->c_first->c_reclaimed);
+  f = fopen("/proc/self/statm", "r");
+  if(f) {
+    if(fscanf(f, "%ld %ld", &pages, &rss) == 2) {
+      fprintf(stderr, ", %ld kB resident", rss * (sysconf(_SC_PAGESIZE) / 1024));
+    }
+    fclose(f);
+  }
+  fprintf(stderr, "\n");
+}
@@ -1,30 +1,89 @@
 
 #include "cplr.h"
 
+#include <time.h>
+
+double cplr_clock(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
 int cplr_run(cplr_t *c) {
   int res, ret = 1;
-  cplr_t *n;
+  bool cache = false;
+  double begin;
 
-  /* prepare compilation */
-  if(!(c->flag & CPLR_FLAG_PREPARED)) {
-    if(cplr_prepare(c)) {
-      fprintf(stderr, "Error: Prepare failed.\n");
-      goto out;
-    }
+  /* packages resolve in the background while we generate */
+  if(!(c->flag & (CPLR_FLAG_PREPARED|CPLR_FLAG_COMPILED))) {
+    cplr_pkgconfig_start(c);
   }
 
+  /* generate code */
   if(!(c->flag & CPLR_FLAG_COMPILED)) {
-    /* generate code */
+    begin = cplr_clock();
     if(cplr_generate(c)) {
       fprintf(stderr, "Error: Code generation failed.\n");
       goto out;
     }
+    cplr_stats_phase(c, CPLR_PHASE_GENERATE, begin);
+    c->stats.generated = c->g_codelen;
+    if(c->verbosity >= 1) {
+      fprintf(stderr, "Generation took %.2fms\n", cplr_clock() - begin);
+    }
+  }
+
+  /* try the code cache */
+  if(!(c->flag & CPLR_FLAG_COMPILED) && cplr_codecache_usable(c)) {
+    /* loading cached code takes the place of relocation */
+    begin = cplr_clock();
+    if(cplr_codecache_load(c) == 0) {
+      c->flag |= (CPLR_FLAG_COMPILED|CPLR_FLAG_LOADED);
+      cplr_stats_phase(c, CPLR_PHASE_RELOCATE, begin);
+    } else {
+      cache = true;
+    }
+  }
+
+  /* misses compile straight into a cache entry */
+  if(cache) {
+    cplr_codecache_begin(c);
+  }
+
+  /* prepare compilation */
+ compile:
+  if(!(c->flag & (CPLR_FLAG_PREPARED|CPLR_FLAG_COMPILED))) {
+    begin = cplr_clock();
+    if(cplr_prepare(c)) {
+      fprintf(stderr, "Error: Prepare failed.\n");
+      goto out;
+    }
+    cplr_stats_phase(c, CPLR_PHASE_PREPARE, begin);
+    if(c->verbosity >= 1) {
+      fprintf(stderr, "Preparation took %.2fms\n", cplr_clock() - begin);
+    }
+  }
 
+  if(!(c->flag & CPLR_FLAG_COMPILED)) {
     /* perform compilation */
+    begin = cplr_clock();
     if(cplr_compile(c)) {
       fprintf(stderr, "Error: Compilation failed.\n");
       goto out;
     }
+    cplr_stats_phase(c, CPLR_PHASE_COMPILE, begin);
+
+    /* populate the code cache and run from it */
+    if(cache) {
+      cache = false;
+      if(cplr_codecache_store(c)) {
+        /* the object is unusable, compile in memory after all */
+        tcc_delete(c->tcc);
+        c->tcc = NULL;
+        c->flag &= ~(CPLR_FLAG_PREPARED|CPLR_FLAG_COMPILED);
+        goto compile;
+      }
+    }
   }
 
   /* expect success */
@@ -33,7 +92,9 @@ int cplr_run(cplr_t *c) {
   /* execute code */
   if(!(c->flag & CPLR_FLAG_NORUN)) {
     /* perform execution */
+    begin = cplr_clock();
     res = cplr_execute(c);
+    cplr_stats_phase(c, CPLR_PHASE_EXECUTE, begin);
     if(res) {
         if(c->flag & CPLR_FLAG_INTERACTIVE) {
           fprintf(stderr, "Program returned %d.\n", res);
@@ -44,5 +105,27 @@ int cplr_run(cplr_t *c) {
 
   /* return */
  out:
+  cplr_codecache_finish(c);
   return ret;
 }
+
+int cplr_warm(cplr_t *c) {
+  /* caches must be enabled */
+  if(!cplr_cache_enabled(c)) {
+    fprintf(stderr, "Error: Caches are disabled.\n");
+    return 1;
+  }
+
+  /* preparation populates the caches */
+  if(cplr_prepare(c)) {
+    fprintf(stderr, "Error: Prepare failed.\n");
+    return 1;
+  }
+
+  /* report */
+  if(c->verbosity >= 1) {
+    fprintf(stderr, "Caches are warm\n");
+  }
+
+  return 0;
+}
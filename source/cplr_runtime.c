@@ -0,0 +1,332 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Runtime for snippets
+ *
+ * This file is linked into cplr, which hands its functions to programs
+ * run in memory, and into the runtime archive for executables. It must
+ * not depend on anything else in cplr.
+ *
+ * Scanning uses the widest vector unit available, chosen on first use.
+ * Setting CPLR_RUNTIME_ISA to avx2, sse2 or scalar forces a choice.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <cplr/runtime.h>
+
+#if defined(__x86_64__)
+#define CPLR_RUNTIME_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+/* find the first byte A or B in [P, E) */
+typedef const char *(*cplr_scan_fn_t)(const char *p, const char *e, int a, int b);
+
+static const char *cplr_scan_scalar(const char *p, const char *e, int a, int b) {
+  for(; p < e; p++) {
+    if(*p == (char)a || *p == (char)b) {
+      return p;
+    }
+  }
+  return NULL;
+}
+
+#ifdef CPLR_RUNTIME_X86
+static const char *cplr_scan_sse2(const char *p, const char *e, int a, int b) {
+  const __m128i va = _mm_set1_epi8((char)a);
+  const __m128i vb = _mm_set1_epi8((char)b);
+  __m128i x;
+  unsigned m;
+  for(; e - p >= 16; p += 16) {
+    x = _mm_loadu_si128((const __m128i*)p);
+    m = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, va),
+                                       _mm_cmpeq_epi8(x, vb)));
+    if(m) {
+      return p + __builtin_ctz(m);
+    }
+  }
+  return cplr_scan_scalar(p, e, a, b);
+}
+
+__attribute__((target("avx2")))
+static const char *cplr_scan_avx2(const char *p, const char *e, int a, int b) {
+  const __m256i va = _mm256_set1_epi8((char)a);
+  const __m256i vb = _mm256_set1_epi8((char)b);
+  __m256i x;
+  unsigned m;
+  for(; e - p >= 32; p += 32) {
+    x = _mm256_loadu_si256((const __m256i*)p);
+    m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x, va),
+                                             _mm256_cmpeq_epi8(x, vb)));
+    if(m) {
+      return p + __builtin_ctz(m);
+    }
+  }
+  /* legacy encoded code is slow with dirty upper halves */
+  _mm256_zeroupper();
+  return cplr_scan_sse2(p, e, a, b);
+}
+
+static bool cplr_runtime_avx2(void) {
+  unsigned a, b, c, d, lo, hi;
+  if(!__get_cpuid(1, &a, &b, &c, &d)) {
+    return false;
+  }
+  /* the system must preserve the wide registers */
+  if(!(c & bit_OSXSAVE) || !(c & bit_AVX)) {
+    return false;
+  }
+  __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+  if((lo & 6) != 6) {
+    return false;
+  }
+  if(__get_cpuid_max(0, NULL) < 7) {
+    return false;
+  }
+  __cpuid_count(7, 0, a, b, c, d);
+  return (b & bit_AVX2) != 0;
+}
+#endif
+
+/* scanners, best first */
+static const struct {
+  const char *name;
+  cplr_scan_fn_t scan;
+} cplr_runtime_isas[] = {
+#ifdef CPLR_RUNTIME_X86
+  { "avx2", cplr_scan_avx2 },
+  { "sse2", cplr_scan_sse2 },
+#endif
+  { "scalar", cplr_scan_scalar },
+};
+
+#define CPLR_RUNTIME_NISAS \
+  (sizeof(cplr_runtime_isas) / sizeof(cplr_runtime_isas[0]))
+
+/* index of the chosen scanner */
+static int cplr_runtime_chosen = -1;
+
+static bool cplr_runtime_usable(int i) {
+#ifdef CPLR_RUNTIME_X86
+  if(cplr_runtime_isas[i].scan == cplr_scan_avx2) {
+    return cplr_runtime_avx2();
+  }
+#endif
+  return true;
+}
+
+static int cplr_runtime_choose(void) {
+  const char *env = getenv("CPLR_RUNTIME_ISA");
+  int i;
+  if(env && *env) {
+    for(i = 0; i < (int)CPLR_RUNTIME_NISAS; i++) {
+      if(!strcmp(env, cplr_runtime_isas[i].name) && cplr_runtime_usable(i)) {
+        return i;
+      }
+    }
+  }
+  for(i = 0; !cplr_runtime_usable(i); i++);
+  return i;
+}
+
+static cplr_scan_fn_t cplr_runtime_scanner(void) {
+  if(cplr_runtime_chosen < 0) {
+    cplr_runtime_chosen = cplr_runtime_choose();
+  }
+  return cplr_runtime_isas[cplr_runtime_chosen].scan;
+}
+
+const char *cplr_runtime_isa(void) {
+  cplr_runtime_scanner();
+  return cplr_runtime_isas[cplr_runtime_chosen].name;
+}
+
+const char *cplr_scan(const char *p, size_t n, int c) {
+  return cplr_runtime_scanner()(p, p + n, c, c);
+}
+
+size_t cplr_split(const char *p, size_t n, int delim,
+                  cplr_field_t *f, size_t max) {
+  cplr_scan_fn_t scan = cplr_runtime_scanner();
+  const char *e = p + n, *d;
+  size_t k = 0;
+  if(!max) {
+    return 0;
+  }
+  while(k + 1 < max && (d = scan(p, e, delim, delim))) {
+    f[k].p = p;
+    f[k].n = d - p;
+    k++;
+    p = d + 1;
+  }
+  f[k].p = p;
+  f[k].n = e - p;
+  return k + 1;
+}
+
+static inline bool cplr_blank(char c) {
+  return c == ' ' || c == '\t';
+}
+
+size_t cplr_fields(const char *p, size_t n,
+                   cplr_field_t *f, size_t max) {
+  cplr_scan_fn_t scan = cplr_runtime_scanner();
+  const char *e = p + n, *d;
+  size_t k = 0;
+  while(k < max) {
+    /* separators are usually short, skip them one by one */
+    while(p < e && cplr_blank(*p)) {
+      p++;
+    }
+    if(p == e) {
+      break;
+    }
+    d = (k + 1 < max) ? scan(p, e, ' ', '\t') : NULL;
+    if(!d) {
+      d = e;
+    }
+    f[k].p = p;
+    f[k].n = d - p;
+    k++;
+    p = d;
+  }
+  return k;
+}
+
+long long cplr_int(const char *p, size_t n, const char **end) {
+  const char *e = p + n, *s = p;
+  unsigned long long v = 0;
+  bool neg = false;
+  while(p < e && cplr_blank(*p)) {
+    p++;
+  }
+  if(p < e && (*p == '-' || *p == '+')) {
+    neg = (*p == '-');
+    p++;
+  }
+  if(p == e || (unsigned)(*p - '0') >= 10) {
+    /* nothing to parse */
+    if(end) {
+      *end = s;
+    }
+    return 0;
+  }
+  /* wraps around on overflow */
+  for(; p < e && (unsigned)(*p - '0') < 10; p++) {
+    v = v * 10 + (*p - '0');
+  }
+  if(end) {
+    *end = p;
+  }
+  return neg ? (long long)(0 - v) : (long long)v;
+}
+
+/* powers of ten that are exact in a double */
+static const double cplr_pow10[] = {
+  1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+  1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+double cplr_float(const char *p, size_t n, const char **end) {
+  const char *e = p + n, *s, *q;
+  unsigned long long m = 0;
+  int digits = 0, exp10 = 0, x = 0;
+  bool neg = false, xneg = false, any = false, exact = true;
+  char buf[64];
+  size_t len;
+  double v;
+  while(p < e && cplr_blank(*p)) {
+    p++;
+  }
+  s = p;
+  if(p < e && (*p == '-' || *p == '+')) {
+    neg = (*p == '-');
+    p++;
+  }
+  /* up to 19 significant digits fit the mantissa */
+  for(; p < e && (unsigned)(*p - '0') < 10; p++) {
+    any = true;
+    if(digits < 19) {
+      m = m * 10 + (*p - '0');
+      digits += (m != 0);
+    } else {
+      exp10++;
+      exact = false;
+    }
+  }
+  if(p < e && *p == '.') {
+    for(p++; p < e && (unsigned)(*p - '0') < 10; p++) {
+      any = true;
+      if(digits < 19) {
+        m = m * 10 + (*p - '0');
+        digits += (m != 0);
+        exp10--;
+      } else {
+        exact = false;
+      }
+    }
+  }
+  if(!any) {
+    goto slow;
+  }
+  if(p < e && (*p == 'e' || *p == 'E')) {
+    q = p + 1;
+    if(q < e && (*q == '-' || *q == '+')) {
+      xneg = (*q == '-');
+      q++;
+    }
+    if(q < e && (unsigned)(*q - '0') < 10) {
+      for(; q < e && (unsigned)(*q - '0') < 10; q++) {
+        if(x < 10000) {
+          x = x * 10 + (*q - '0');
+        }
+      }
+      exp10 += xneg ? -x : x;
+      p = q;
+    }
+  }
+  /* exact operands give a correctly rounded result */
+  if(exact && m <= (1ULL << 53) && exp10 >= -22 && exp10 <= 22) {
+    v = (double)m;
+    v = (exp10 < 0) ? v / cplr_pow10[-exp10] : v * cplr_pow10[exp10];
+    if(end) {
+      *end = p;
+    }
+    return neg ? -v : v;
+  }
+
+ slow:
+  /* everything else goes to libc */
+  len = e - s;
+  if(len >= sizeof(buf)) {
+    len = sizeof(buf) - 1;
+  }
+  memcpy(buf, s, len);
+  buf[len] = 0;
+  v = strtod(buf, (char**)&q);
+  if(end) {
+    *end = s + (q - buf);
+  }
+  return v;
+}
@@ -0,0 +1,498 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <cext/memory.h>
+
+#include "cplr.h"
+
+/*
+ * The server accepts connections and hands each one to a
+ * pre-forked worker that has already prepared a compiler.
+ * Workers serve a single request and exit, the server reports
+ * their wait status to the client and forks a replacement.
+ *
+ * A zygote server runs inside its program and forks workers
+ * that return to it with the arguments of their request.
+ */
+
+/* default number of idle workers */
+#define CPLR_SERVER_WORKERS 4
+
+extern char **environ;
+
+/* worker process */
+typedef struct cplr_worker cplr_worker_t;
+struct cplr_worker {
+  cplr_worker_t *next;
+  pid_t pid;
+  /* control socket while idle */
+  int ctl;
+  /* client connection while busy */
+  int conn;
+};
+
+/* list of workers */
+static cplr_worker_t *server_workers = NULL;
+/* listening socket */
+static int server_listen = -1;
+/* self-pipe for signals */
+static int server_pipe[2] = { -1, -1 };
+/* termination requested */
+static volatile sig_atomic_t server_stop = 0;
+
+/* compiler prepared in a worker and its inputs */
+static TCCState *server_tcc = NULL;
+static char *server_key = NULL;
+
+/* describe the inputs of compiler preparation */
+static char *cplr_server_key(cplr_t *c) {
+  const char *libdir = getenv("CPLR_TINYCC_LIBDIR");
+  struct { const char *name; vh_t *pile; } piles[] = {
+    { "optf", &c->optf },
+    { "optm", &c->optm },
+    { "defdef", &c->defdef },
+    { "def", &c->defs },
+    { "sysdir", &c->sysdirs },
+    { "incdir", &c->incdirs },
+    { "libdir", &c->libdirs },
+    { "lib", &c->libs },
+    { "pkg", &c->pkgs },
+    { NULL, NULL },
+  };
+  char *buf = NULL;
+  size_t len = 0;
+  FILE *f;
+  value_t *n;
+  int i;
+  f = open_memstream(&buf, &len);
+  fprintf(f, "backend %d\notype %d\n", c->backend, c->otype);
+  fprintf(f, "tccdir %s\n", libdir ? libdir : "");
+  for(i = 0; piles[i].name; i++) {
+    V_FORWARD(piles[i].pile, n) {
+      fprintf(f, "%s %s\n", piles[i].name, value_get_str(n));
+    }
+  }
+  fclose(f);
+  return buf;
+}
+
+TCCState *cplr_server_take(cplr_t *c) {
+  TCCState *t = NULL;
+  char *key;
+  if(!server_tcc) {
+    return NULL;
+  }
+  key = cplr_server_key(c);
+  if(!strcmp(key, server_key)) {
+    t = server_tcc;
+    server_tcc = NULL;
+  }
+  cext_free(key);
+  return t;
+}
+
+static void cplr_server_signal(int sig) {
+  int saved = errno;
+  if(sig != SIGCHLD) {
+    server_stop = 1;
+  }
+  if(write(server_pipe[1], "", 1) < 0) {
+    /* pipe is full, a wakeup is pending */
+  }
+  errno = saved;
+}
+
+/* receive and apply a request */
+static int cplr_worker_accept(int conn, int *argcp, char ***argvp) {
+  cplr_request_t req;
+  int fds[3], nfds, i;
+  int32_t pid = getpid();
+  char *buf, *p, *end, *cwd;
+  char **argv, **envv;
+
+  /* requests run as us, so they must come from us */
+  if(!cplr_socket_trusted(conn)) {
+    fprintf(stderr, "Error: Rejected request from another user\n");
+    return 1;
+  }
+
+  /* header and stdio */
+  nfds = cplr_socket_recvfds(conn, &req, sizeof(req), fds, 3);
+  if(nfds < 0) {
+    return 1;
+  }
+  if(nfds != 3 || req.magic != CPLR_REQUEST_MAGIC) {
+    for(i = 0; i < nfds; i++) {
+      close(fds[i]);
+    }
+    return 1;
+  }
+
+  /* strings */
+  buf = cext_malloc(req.size + 1);
+  if(cplr_socket_read(conn, buf, req.size)) {
+    return 1;
+  }
+  buf[req.size] = 0;
+  argv = cext_calloc(req.argc + 1, sizeof(char*));
+  envv = cext_calloc(req.envc + 1, sizeof(char*));
+  p = buf;
+  end = buf + req.size;
+  cwd = p;
+  p += strlen(p) + 1;
+  for(i = 0; i < (int)req.argc && p < end; i++) {
+    argv[i] = p;
+    p += strlen(p) + 1;
+  }
+  for(i = 0; i < (int)req.envc && p < end; i++) {
+    envv[i] = p;
+    p += strlen(p) + 1;
+  }
+
+  /* tell the client who we are */
+  if(cplr_socket_write(conn, &pid, sizeof(pid))) {
+    return 1;
+  }
+  close(conn);
+
+  /* become the client */
+  for(i = 0; i < 3; i++) {
+    dup2(fds[i], i);
+    if(fds[i] > 2) {
+      close(fds[i]);
+    }
+  }
+  if(chdir(cwd)) {
+    fprintf(stderr, "Error: Could not change to %s\n", cwd);
+    return 1;
+  }
+  environ = envv;
+
+  *argcp = req.argc;
+  *argvp = argv;
+  return 0;
+}
+
+/* receive a request and run it like main */
+static int cplr_worker_request(int conn) {
+  int argc;
+  char **argv;
+  if(cplr_worker_accept(conn, &argc, &argv)) {
+    return 1;
+  }
+  return cplr_main(argc, argv);
+}
+
+static void cplr_worker_main(cplr_t *c, int ctl) {
+  struct sigaction sa;
+  cplr_worker_t *w;
+  char b;
+  int conn;
+
+  /* default signal handling */
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = SIG_DFL;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGCHLD, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+  sigaction(SIGPIPE, &sa, NULL);
+  /* drop descriptors of the server */
+  close(server_pipe[0]);
+  close(server_pipe[1]);
+  close(server_listen);
+  for(w = server_workers; w; w = w->next) {
+    if(w->ctl >= 0) {
+      close(w->ctl);
+    }
+    if(w->conn >= 0) {
+      close(w->conn);
+    }
+  }
+
+  /* leave the terminal of the server */
+  setsid();
+
+  /* prepare a compiler for the expected request */
+  if(!(c->flag & CPLR_FLAG_ZYGOTE)) {
+    server_key = cplr_server_key(c);
+    if(cplr_prepare_compiler(c) == 0) {
+      server_tcc = c->tcc;
+      c->tcc = NULL;
+    }
+  }
+
+  /* wait for a connection */
+  if(cplr_socket_recvfds(ctl, &b, 1, &conn, 1) != 1) {
+    _exit(0);
+  }
+  close(ctl);
+
+  /* zygote workers return to the program with the request */
+  if(c->flag & CPLR_FLAG_ZYGOTE) {
+    int argc;
+    char **argv;
+    if(cplr_worker_accept(conn, &argc, &argv)) {
+      exit(1);
+    }
+    cplr_zygote_request(argc, argv);
+    return;
+  }
+
+  /* serve it */
+  exit(cplr_worker_request(conn));
+}
+
+static int cplr_server_spawn(cplr_t *c) {
+  cplr_worker_t *w;
+  int sv[2];
+  pid_t pid;
+
+  if(socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, sv)) {
+    fprintf(stderr, "Error: Could not create worker socket\n");
+    return 1;
+  }
+
+  fflush(NULL);
+  pid = fork();
+  if(pid < 0) {
+    fprintf(stderr, "Error: Could not fork worker\n");
+    close(sv[0]);
+    close(sv[1]);
+    return 1;
+  }
+  if(pid == 0) {
+    close(sv[0]);
+    cplr_worker_main(c, sv[1]);
+    return 0;
+  }
+  close(sv[1]);
+
+  w = cext_calloc(1, sizeof(cplr_worker_t));
+  w->pid = pid;
+  w->ctl = sv[0];
+  w->conn = -1;
+  w->next = server_workers;
+  server_workers = w;
+
+  if(c->verbosity >= 2) {
+    fprintf(stderr, "Worker %d started\n", pid);
+  }
+
+  return 0;
+}
+
+/* oldest idle worker, most likely to be prepared */
+static cplr_worker_t *cplr_server_oldest(void) {
+  cplr_worker_t *w, *r = NULL;
+  for(w = server_workers; w; w = w->next) {
+    if(w->ctl >= 0) {
+      r = w;
+    }
+  }
+  return r;
+}
+
+/* pass a connection to an idle worker */
+static int cplr_server_dispatch(cplr_t *c, int conn) {
+  cplr_worker_t *w;
+  while((w = cplr_server_oldest())) {
+    if(cplr_socket_sendfds(w->ctl, "c", 1, &conn, 1)) {
+      /* worker is gone, reaping takes care */
+      close(w->ctl);
+      w->ctl = -1;
+      continue;
+    }
+    close(w->ctl);
+    w->ctl = -1;
+    w->conn = conn;
+    if(c->verbosity >= 2) {
+      fprintf(stderr, "Worker %d serving request\n", w->pid);
+    }
+    return 0;
+  }
+  return 1;
+}
+
+/* collect finished workers and report to their clients */
+static void cplr_server_reap(cplr_t *c) {
+  cplr_worker_t **wp, *w;
+  int32_t status;
+  int st;
+  pid_t pid;
+  while((pid = waitpid(-1, &st, WNOHANG)) > 0) {
+    for(wp = &server_workers; (w = *wp); wp = &w->next) {
+      if(w->pid == pid) {
+        break;
+      }
+    }
+    if(!w) {
+      continue;
+    }
+    if(c->verbosity >= 2) {
+      fprintf(stderr, "Worker %d finished with status %d\n", pid, st);
+    }
+    if(w->conn >= 0) {
+      status = st;
+      cplr_socket_write(w->conn, &status, sizeof(status));
+      close(w->conn);
+    }
+    if(w->ctl >= 0) {
+      close(w->ctl);
+    }
+    *wp = w->next;
+    cext_free(w);
+  }
+}
+
+/* number of workers waiting for a request */
+static int cplr_server_idle(void) {
+  cplr_worker_t *w;
+  int n = 0;
+  for(w = server_workers; w; w = w->next) {
+    if(w->ctl >= 0) {
+      n++;
+    }
+  }
+  return n;
+}
+
+int cplr_serve(cplr_t *c) {
+  struct sigaction sa;
+  struct pollfd pfd[2];
+  const char *env;
+  int conn, nworkers, ret = 1;
+  char drain[64];
+
+  /* pool size */
+  nworkers = CPLR_SERVER_WORKERS;
+  env = getenv("CPLR_SERVER_WORKERS");
+  if(env && atoi(env) > 0) {
+    nworkers = atoi(env);
+  }
+
+  /* refuse to replace a live server */
+  server_listen = cplr_socket_connect(c->server);
+  if(server_listen >= 0) {
+    fprintf(stderr, "Error: Server already running on %s\n", c->server);
+    close(server_listen);
+    return 1;
+  }
+  unlink(c->server);
+  server_listen = cplr_socket_listen(c->server);
+  if(server_listen < 0) {
+    fprintf(stderr, "Error: Could not listen on %s\n", c->server);
+    return 1;
+  }
+
+  /* signals wake the main loop */
+  if(pipe2(server_pipe, O_CLOEXEC|O_NONBLOCK)) {
+    fprintf(stderr, "Error: Could not create pipe\n");
+    goto out;
+  }
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = cplr_server_signal;
+  sa.sa_flags = SA_RESTART|SA_NOCLDSTOP;
+  sigemptyset(&sa.sa_mask);
+  sigaction(SIGCHLD, &sa, NULL);
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+  sigaction(SIGHUP, &sa, NULL);
+  sa.sa_handler = SIG_IGN;
+  sigaction(SIGPIPE, &sa, NULL);
+
+  if(c->verbosity >= 1) {
+    fprintf(stderr, "Serving on %s with %d workers\n", c->server, nworkers);
+  }
+
+  while(!server_stop) {
+    /* keep the pool filled */
+    while(cplr_server_idle() < nworkers) {
+      if(cplr_server_spawn(c)) {
+        goto out;
+      }
+      /* zygote workers leave the loop */
+      if(cplr_zygote_child()) {
+        return 0;
+      }
+    }
+
+    pfd[0].fd = server_listen;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = server_pipe[0];
+    pfd[1].events = POLLIN;
+    if(poll(pfd, 2, -1) < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      fprintf(stderr, "Error: Poll failed\n");
+      goto out;
+    }
+
+    /* signals */
+    if(pfd[1].revents & POLLIN) {
+      while(read(server_pipe[0], drain, sizeof(drain)) > 0);
+      cplr_server_reap(c);
+    }
+
+    /* connections */
+    if(pfd[0].revents & POLLIN) {
+      conn = accept4(server_listen, NULL, NULL, SOCK_CLOEXEC);
+      if(conn < 0) {
+        continue;
+      }
+      if(cplr_server_dispatch(c, conn)) {
+        fprintf(stderr, "Error: No worker for request\n");
+        close(conn);
+      }
+    }
+  }
+
+  if(c->verbosity >= 1) {
+    fprintf(stderr, "Server stopping\n");
+  }
+  ret = 0;
+
+ out:
+  /* idle workers exit when their control socket closes */
+  while(server_workers) {
+    cplr_worker_t *w = server_workers;
+    server_workers = w->next;
+    if(w->ctl >= 0) {
+      close(w->ctl);
+    }
+    if(w->conn >= 0) {
+      close(w->conn);
+    }
+    cext_free(w);
+  }
+  close(server_listen);
+  unlink(c->server);
+  return ret;
+}
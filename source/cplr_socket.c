@@ -0,0 +1,209 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "cplr.h"
+
+/*
+ * Unix socket helpers shared by client and server.
+ *
+ * These must not allocate through the collector because
+ * the client runs them before anything is initialized.
+ */
+
+static int cplr_socket_addr(struct sockaddr_un *sa, const char *path) {
+  memset(sa, 0, sizeof(*sa));
+  sa->sun_family = AF_UNIX;
+  if(strlen(path) >= sizeof(sa->sun_path)) {
+    errno = ENAMETOOLONG;
+    return -1;
+  }
+  strcpy(sa->sun_path, path);
+  return 0;
+}
+
+int cplr_socket_connect(const char *path) {
+  struct sockaddr_un sa;
+  int fd;
+  if(cplr_socket_addr(&sa, path)) {
+    return -1;
+  }
+  fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+  if(fd < 0) {
+    return -1;
+  }
+  if(connect(fd, (struct sockaddr*)&sa, sizeof(sa))) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+int cplr_socket_listen(const char *path) {
+  struct sockaddr_un sa;
+  mode_t mask;
+  int fd, rc;
+  if(cplr_socket_addr(&sa, path)) {
+    return -1;
+  }
+  fd = socket(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0);
+  if(fd < 0) {
+    return -1;
+  }
+  /* only our user may connect, from the moment it exists */
+  mask = umask(0177);
+  rc = bind(fd, (struct sockaddr*)&sa, sizeof(sa));
+  umask(mask);
+  if(rc || chmod(path, 0600) || listen(fd, 64)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+bool cplr_socket_trusted(int fd) {
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len)) {
+    return false;
+  }
+  return cred.uid == geteuid();
+}
+
+int cplr_socket_write(int fd, const void *buf, size_t len) {
+  const char *p = buf;
+  ssize_t res;
+  while(len) {
+    res = write(fd, p, len);
+    if(res < 0 && errno == EINTR) {
+      continue;
+    }
+    if(res <= 0) {
+      return -1;
+    }
+    p += res;
+    len -= res;
+  }
+  return 0;
+}
+
+int cplr_socket_read(int fd, void *buf, size_t len) {
+  char *p = buf;
+  ssize_t res;
+  while(len) {
+    res = read(fd, p, len);
+    if(res < 0 && errno == EINTR) {
+      continue;
+    }
+    if(res <= 0) {
+      return -1;
+    }
+    p += res;
+    len -= res;
+  }
+  return 0;
+}
+
+int cplr_socket_sendfds(int fd, const void *buf, size_t len,
+                        const int *fds, int nfds) {
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cm;
+  char cbuf[CMSG_SPACE(sizeof(int) * CPLR_SOCKET_MAXFDS)];
+  ssize_t res;
+  if(nfds > CPLR_SOCKET_MAXFDS || !len) {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(&msg, 0, sizeof(msg));
+  memset(cbuf, 0, sizeof(cbuf));
+  iov.iov_base = (void*)buf;
+  iov.iov_len = len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+  cm = CMSG_FIRSTHDR(&msg);
+  cm->cmsg_level = SOL_SOCKET;
+  cm->cmsg_type = SCM_RIGHTS;
+  cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+  memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
+  do {
+    res = sendmsg(fd, &msg, MSG_NOSIGNAL);
+  } while(res < 0 && errno == EINTR);
+  if(res < 0) {
+    return -1;
+  }
+  /* the descriptors went with the first byte */
+  return cplr_socket_write(fd, (const char*)buf + res, len - res);
+}
+
+int cplr_socket_recvfds(int fd, void *buf, size_t len,
+                        int *fds, int nfds) {
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *cm;
+  char cbuf[CMSG_SPACE(sizeof(int) * CPLR_SOCKET_MAXFDS)];
+  ssize_t res;
+  int i, n = 0;
+  if(nfds > CPLR_SOCKET_MAXFDS || !len) {
+    errno = EINVAL;
+    return -1;
+  }
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = buf;
+  iov.iov_len = len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  do {
+    res = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+  } while(res < 0 && errno == EINTR);
+  if(res <= 0) {
+    return -1;
+  }
+  for(cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+    if(cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+      int *got = (int*)CMSG_DATA(cm);
+      int cnt = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      for(i = 0; i < cnt; i++) {
+        if(n < nfds) {
+          fds[n++] = got[i];
+        } else {
+          close(got[i]);
+        }
+      }
+    }
+  }
+  /* the rest of the message follows */
+  if(cplr_socket_read(fd, (char*)buf + res, len - res)) {
+    for(i = 0; i < n; i++) {
+      close(fds[i]);
+    }
+    return -1;
+  }
+  return n;
+}
@@ -17,18 +17,47 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include <dlfcn.h>
+
 #include "cext/memory.h"
 
 #include "cplr.h"
 
+/* size of the first arena chunk of a state */
+#define CPLR_ARENA_CHUNK 4096
+
 cplr_t *cplr_new(void) {
   cplr_t *res = cext_calloc(sizeof(cplr_t), 1);
 
   res->backend = CPLR_BACKEND_LIBTCC;
   res->target = CPLR_TARGET_POSIX;
+  res->jobs = 1;
+  res->cache_stdout = -1;
 
   res->c_first = res;
 
+  /* piles live and die with the state */
+  res->arena = cext_arena_new(CPLR_ARENA_CHUNK);
+  v_init_arena(&res->optf, res->arena);
+  v_init_arena(&res->optm, res->arena);
+  v_init_arena(&res->defdef, res->arena);
+  v_init_arena(&res->defsys, res->arena);
+  v_init_arena(&res->sysdirs, res->arena);
+  v_init_arena(&res->incdirs, res->arena);
+  v_init_arena(&res->libdirs, res->arena);
+  v_init_arena(&res->defs, res->arena);
+  v_init_arena(&res->syss, res->arena);
+  v_init_arena(&res->incs, res->arena);
+  v_init_arena(&res->libs, res->arena);
+  v_init_arena(&res->pkgs, res->arena);
+  v_init_arena(&res->tlds, res->arena);
+  v_init_arena(&res->srcs, res->arena);
+  v_init_arena(&res->tlfs, res->arena);
+  v_init_arena(&res->stms, res->arena);
+  v_init_arena(&res->befs, res->arena);
+  v_init_arena(&res->afts, res->arena);
+  v_init_arena(&res->fins, res->arena);
+
   return res;
 }
 
@@ -37,29 +66,53 @@ void cplr_free(cplr_t *c) {
     tcc_delete(c->tcc);
     c->tcc = NULL;
   }
+  if(c->so_handle) {
+    dlclose(c->so_handle);
+    c->so_handle = NULL;
+    c->so_main = NULL;
+  }
+  cplr_codecache_finish(c);
+  cext_lptrfree((void*)&c->cache_key);
   cext_lptrfree((void*)&c->out);
+  cext_lptrfree((void*)&c->server);
+  cext_lptrfree((void*)&c->profile);
   cext_lptrfree((void*)&c->g_codebuf);
   cext_lptrfree((void*)&c->g_dumpbuf);
-  l_clear(&c->defdef);
-  l_clear(&c->defsys);
-  l_clear(&c->sysdirs);
-  l_clear(&c->incdirs);
-  l_clear(&c->libdirs);
-  l_clear(&c->defs);
-  l_clear(&c->syss);
-  l_clear(&c->incs);
-  l_clear(&c->libs);
-  l_clear(&c->pkgs);
-  l_clear(&c->srcs);
-  l_clear(&c->tlds);
-  l_clear(&c->tlfs);
-  l_clear(&c->stms);
-  l_clear(&c->befs);
-  l_clear(&c->afts);
+  cext_lptrfree((void*)&c->g_prologue);
+  cext_lptrfree((void*)&c->s_headkey);
+  cext_lptrfree((void*)&c->s_headers);
+  cext_lptrfree((void*)&c->sym_deps);
+  cplr_stats_free(c);
+  if(c->s_syms) {
+    cplr_symtab_free(c->s_syms);
+    c->s_syms = NULL;
+  }
+  /* drop shared elements, our own go with the arena */
+  v_clear(&c->optf);
+  v_clear(&c->optm);
+  v_clear(&c->defdef);
+  v_clear(&c->defsys);
+  v_clear(&c->sysdirs);
+  v_clear(&c->incdirs);
+  v_clear(&c->libdirs);
+  v_clear(&c->defs);
+  v_clear(&c->syss);
+  v_clear(&c->incs);
+  v_clear(&c->libs);
+  v_clear(&c->pkgs);
+  v_clear(&c->tlds);
+  v_clear(&c->srcs);
+  v_clear(&c->tlfs);
+  v_clear(&c->stms);
+  v_clear(&c->befs);
+  v_clear(&c->afts);
+  v_clear(&c->fins);
+  cext_arena_free(c->arena);
   cext_free(c);
 }
 
-cplr_t *cplr_clone(cplr_t *c) {
+/* copy settings, sharing the stable piles */
+static cplr_t *cplr_clone_stable(cplr_t *c) {
   cplr_t *r = cplr_new();
   r->argc = c->argc;
   r->argv = c->argv;
@@ -67,42 +120,56 @@ cplr_t *cplr_clone(cplr_t *c) {
   r->flag = c->flag;
   r->dump = c->dump;
   r->verbosity = c->verbosity;
+  r->jobs = c->jobs;
+  r->backend = c->backend;
   r->target = c->target;
   r->out = NULL;
+  r->profile = c->profile ? strdup(c->profile) : NULL;
   r->g_codebuf = NULL;
   r->g_dumpbuf = NULL;
-  l_clone(&c->defdef, &r->defdef);
-  l_clone(&c->defsys, &r->defsys);
-  l_clone(&c->sysdirs, &r->sysdirs);
-  l_clone(&c->incdirs, &r->incdirs);
-  l_clone(&c->libdirs, &r->libdirs);
-  l_clone(&c->defs, &r->defs);
-  l_clone(&c->syss, &r->syss);
-  l_clone(&c->incs, &r->incs);
-  l_clone(&c->libs, &r->libs);
-  l_clone(&c->pkgs, &r->pkgs);
-  l_clone(&c->srcs, &r->srcs);
-  l_clone(&c->tlds, &r->tlds);
-  l_clone(&c->tlfs, &r->tlfs);
-  l_clone(&c->stms, &r->stms);
-  l_clone(&c->befs, &r->befs);
-  l_clone(&c->afts, &r->afts);
+  r->g_prologue = NULL;
+  r->g_headers = NULL;
+  v_share(&c->optf, &r->optf);
+  v_share(&c->optm, &r->optm);
+  v_share(&c->defdef, &r->defdef);
+  v_share(&c->defsys, &r->defsys);
+  v_share(&c->sysdirs, &r->sysdirs);
+  v_share(&c->incdirs, &r->incdirs);
+  v_share(&c->libdirs, &r->libdirs);
+  v_share(&c->defs, &r->defs);
+  v_share(&c->syss, &r->syss);
+  v_share(&c->incs, &r->incs);
+  v_share(&c->libs, &r->libs);
+  v_share(&c->pkgs, &r->pkgs);
+  v_share(&c->tlds, &r->tlds);
+  return r;
+}
+
+cplr_t *cplr_clone(cplr_t *c) {
+  cplr_t *r = cplr_clone_stable(c);
+  v_share(&c->srcs, &r->srcs);
+  v_share(&c->tlfs, &r->tlfs);
+  v_share(&c->stms, &r->stms);
+  v_share(&c->befs, &r->befs);
+  v_share(&c->afts, &r->afts);
+  v_share(&c->fins, &r->fins);
   return r;
 }
 
 bool cplr_empty(cplr_t *c) {
-  return l_empty(&c->srcs)
-         && l_empty(&c->tlfs)
-         && l_empty(&c->stms)
-         && l_empty(&c->befs)
-         && l_empty(&c->afts);
+  return v_empty(&c->srcs)
+         && v_empty(&c->tlfs)
+         && v_empty(&c->stms)
+         && v_empty(&c->befs)
+         && v_empty(&c->afts)
+         && v_empty(&c->fins);
 }
 
 cplr_t *cplr_chain(cplr_t *c) {
   cplr_t *n;
 
-  /* clone the context */
-  n = cplr_clone(c);
+  /* clone the context without statements */
+  n = cplr_clone_stable(c);
 
   /* establish chaining */
   n->c_index = c->c_index + 1;
@@ -115,14 +182,10 @@ cplr_t *cplr_chain(cplr_t *c) {
                |CPLR_FLAG_COMPILED
                |CPLR_FLAG_LOADED
                |CPLR_FLAG_EXECUTED
-               |CPLR_FLAG_FINISHED);
-
-  /* clear statement piles */
-  l_clear(&n->srcs);
-  l_clear(&n->tlfs);
-  l_clear(&n->stms);
-  l_clear(&n->befs);
-  l_clear(&n->afts);
+               |CPLR_FLAG_FINISHED
+               |CPLR_FLAG_TRIMMED
+               |CPLR_FLAG_PINNED
+               |CPLR_FLAG_RELOCATED);
 
   /* return the new state */
   return n;
@@ -0,0 +1,158 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Timings and counters
+ *
+ * Every state records how long its phases took, along with each
+ * package and source file, and counts what it produced. Phases run
+ * before the first state exists are recorded in the first state.
+ *
+ * Relocation is only timed where cplr relocates or loads code itself,
+ * tcc_run relocates as part of execution.
+ */
+
+#include "cplr.h"
+
+#include <sys/resource.h>
+
+static const char *phases[CPLR_PHASE_COUNT] = {
+  "optparse",
+  "defaults",
+  "generate",
+  "prepare",
+  "compile",
+  "relocate",
+  "execute",
+};
+
+void cplr_stats_phase(cplr_t *c, cplr_phase_t p, double begin) {
+  c->stats.phase[p] += cplr_clock() - begin;
+}
+
+void cplr_stats_item(cplr_t *c, const char *kind, const char *name, double begin) {
+  cplr_stats_t *s = &c->stats;
+  /* grow in powers of two */
+  if(!s->items) {
+    s->items = cext_malloc(4 * sizeof(cplr_timing_t));
+  } else if(s->nitems >= 4 && !(s->nitems & (s->nitems - 1))) {
+    s->items = cext_realloc(s->items, 2 * s->nitems * sizeof(cplr_timing_t));
+  }
+  s->items[s->nitems].kind = kind;
+  s->items[s->nitems].name = cext_intern(name);
+  s->items[s->nitems].ms = cplr_clock() - begin;
+  s->nitems++;
+}
+
+void cplr_stats_free(cplr_t *c) {
+  cext_lptrfree((void**)&c->stats.items);
+  c->stats.nitems = 0;
+}
+
+/* peak resident set of the process in kB */
+static long cplr_stats_peak(void) {
+  struct rusage ru;
+  if(getrusage(RUSAGE_SELF, &ru)) {
+    return 0;
+  }
+  return ru.ru_maxrss;
+}
+
+void cplr_stats_print(cplr_t *c, FILE *f, const char *indent) {
+  cplr_stats_t *s = &c->stats;
+  size_t i;
+  int p;
+  for(p = 0; p < CPLR_PHASE_COUNT; p++) {
+    /* leave out what did not happen */
+    if(s->phase[p] > 0) {
+      fprintf(f, "%s%-24s %8.2fms\n", indent, phases[p], s->phase[p]);
+    }
+    /* packages and sources belong to preparation */
+    if(p != CPLR_PHASE_PREPARE) {
+      continue;
+    }
+    for(i = 0; i < s->nitems; i++) {
+      fprintf(f, "%s  %-7s %-14s %8.2fms\n", indent,
+              s->items[i].kind, s->items[i].name, s->items[i].ms);
+    }
+  }
+  fprintf(f, "%s%zu bytes generated, %lu symbols redefined, %lu libraries\n",
+          indent, s->generated, s->redefined, s->libraries);
+}
+
+static void cplr_stats_json_string(FILE *f, const char *str) {
+  fputc('"', f);
+  for(; *str; str++) {
+    if(*str == '"' || *str == '\\') {
+      fprintf(f, "\\%c", *str);
+    } else if((unsigned char)*str < 0x20) {
+      fprintf(f, "\\u%04x", *str);
+    } else {
+      fputc(*str, f);
+    }
+  }
+  fputc('"', f);
+}
+
+static void cplr_stats_json_items(FILE *f, cplr_stats_t *s, const char *kind) {
+  bool first = true;
+  size_t i;
+  fprintf(f, "[");
+  for(i = 0; i < s->nitems; i++) {
+    if(strcmp(s->items[i].kind, kind)) {
+      continue;
+    }
+    fprintf(f, "%s{\"name\":", first ? "" : ",");
+    cplr_stats_json_string(f, s->items[i].name);
+    fprintf(f, ",\"ms\":%.3f}", s->items[i].ms);
+    first = false;
+  }
+  fprintf(f, "]");
+}
+
+static void cplr_stats_json(cplr_t *c, FILE *f) {
+  cplr_stats_t *s = &c->stats;
+  int p;
+  fprintf(f, "{\"phases\":{");
+  for(p = 0; p < CPLR_PHASE_COUNT; p++) {
+    fprintf(f, "%s\"%s\":%.3f", p ? "," : "", phases[p], s->phase[p]);
+  }
+  fprintf(f, "},\"packages\":");
+  cplr_stats_json_items(f, s, "package");
+  fprintf(f, ",\"sources\":");
+  cplr_stats_json_items(f, s, "source");
+  fprintf(f, ",\"generated_bytes\":%zu,\"symbols_redefined\":%lu,\"libraries\":%lu",
+          s->generated, s->redefined, s->libraries);
+  fprintf(f, ",\"peak_rss_kb\":%ld}\n", cplr_stats_peak());
+}
+
+void cplr_stats_report(cplr_t *c) {
+  switch(c->statsfmt) {
+  case CPLR_STATS_JSON:
+    cplr_stats_json(c, stderr);
+    break;
+  case CPLR_STATS_TEXT:
+    fprintf(stderr, "Statistics:\n");
+    cplr_stats_print(c, stderr, "  ");
+    fprintf(stderr, "  peak resident set %ld kB\n", cplr_stats_peak());
+    break;
+  default:
+    break;
+  }
+}
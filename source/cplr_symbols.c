@@ -17,13 +17,324 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+/*
+ * Session symbol registry
+ *
+ * Chained states see the definitions of their predecessors through a
+ * hash table kept on the first state. A state enters its definitions
+ * when its successor compiles, and every new state imports only the
+ * names its own code mentions. Chaining thereby costs as much as the
+ * new code and its new symbols, not the whole session.
+ */
+
 #include "cplr.h"
 
+#include <dlfcn.h>
+
+#include <cext/hash.h>
+#include <cext/memory.h>
+
+/* initial number of buckets, must be a power of two */
+#define CPLR_SYMTAB_INITIAL 256
+
+typedef struct cplr_sym cplr_sym_t;
+
+struct cplr_sym {
+  /* next in bucket */
+  cplr_sym_t *next;
+  /* hash of the name */
+  uint64_t hash;
+  /* address of the definition */
+  const void *val;
+  /* state holding the definition */
+  cplr_t *owner;
+  /* index of the last state that imported us */
+  int mark;
+  /* name of the symbol */
+  char name[];
+};
+
+struct cplr_symtab {
+  /* hash buckets */
+  cplr_sym_t **buckets;
+  size_t nbuckets;
+  /* number of symbols */
+  size_t count;
+  /* lookups over the whole session */
+  unsigned long hits;
+  unsigned long misses;
+};
+
+static uint64_t cplr_symtab_hash(const char *name, size_t len) {
+  cext_hash_t h;
+  cext_hash_init(&h);
+  cext_hash_update(&h, name, len);
+  return h.h;
+}
+
+static cplr_symtab_t *cplr_symtab_get(cplr_t *c) {
+  cplr_t *f = c->c_first;
+  if(!f->s_syms) {
+    f->s_syms = cext_calloc(1, sizeof(cplr_symtab_t));
+    f->s_syms->nbuckets = CPLR_SYMTAB_INITIAL;
+    f->s_syms->buckets = cext_calloc(CPLR_SYMTAB_INITIAL, sizeof(cplr_sym_t*));
+  }
+  return f->s_syms;
+}
+
+static cplr_sym_t *cplr_symtab_find(cplr_symtab_t *t, const char *name,
+                                    size_t len, uint64_t hash) {
+  cplr_sym_t *s;
+  for(s = t->buckets[hash & (t->nbuckets - 1)]; s; s = s->next) {
+    if(s->hash == hash && !strncmp(s->name, name, len) && !s->name[len]) {
+      return s;
+    }
+  }
+  return NULL;
+}
+
+static void cplr_symtab_grow(cplr_symtab_t *t) {
+  size_t i, n = t->nbuckets * 2;
+  cplr_sym_t **b = cext_calloc(n, sizeof(cplr_sym_t*));
+  cplr_sym_t *s, *next;
+  for(i = 0; i < t->nbuckets; i++) {
+    for(s = t->buckets[i]; s; s = next) {
+      next = s->next;
+      s->next = b[s->hash & (n - 1)];
+      b[s->hash & (n - 1)] = s;
+    }
+  }
+  cext_free(t->buckets);
+  t->buckets = b;
+  t->nbuckets = n;
+}
+
+void cplr_symtab_free(cplr_symtab_t *t) {
+  cplr_sym_t *s, *next;
+  size_t i;
+  for(i = 0; i < t->nbuckets; i++) {
+    for(s = t->buckets[i]; s; s = next) {
+      next = s->next;
+      cext_free(s);
+    }
+  }
+  cext_free(t->buckets);
+  cext_free(t);
+}
+
+static bool cplr_symtab_ignored(const char *name) {
+  /* ignore various built-ins (FIXME better method?) */
+  if(name[0] == '_') {
+    return true;
+  }
+  if(strcmp(name, "main") == 0) {
+    return true;
+  }
+  if(strcmp(name, "exit") == 0) {
+    return true;
+  }
+  if(strcmp(name, "atexit") == 0) {
+    return true;
+  }
+  if(strcmp(name, "on_exit") == 0) {
+    return true;
+  }
+  if(strprefix(name, "tcc_")) {
+    return true;
+  }
+  /* our runtime belongs to cplr itself */
+  if(cplr_runtime_defines(name)) {
+    return true;
+  }
+  if(strsuffix(name, "@plt")) {
+    return true;
+  }
+  return false;
+}
+
+static void cplr_symtab_learn_cb(void *ctx, const char *name, const void *val) {
+  cplr_t *c = (cplr_t *)ctx;
+  cplr_symtab_t *t = c->c_first->s_syms;
+  size_t len = strlen(name);
+  uint64_t hash;
+  cplr_sym_t *s;
+  if(cplr_symtab_ignored(name)) {
+    return;
+  }
+  /* known symbols are either imports or redefinitions */
+  hash = cplr_symtab_hash(name, len);
+  s = cplr_symtab_find(t, name, len, hash);
+  if(s) {
+    if(s->val != val) {
+      if(c->verbosity >= 3) {
+        fprintf(stderr, "Redefined symbol %s as %p\n", name, val);
+      }
+      c->stats.redefined++;
+      s->owner->sym_owned--;
+      s->owner = c;
+      s->val = val;
+      c->sym_owned++;
+    }
+    return;
+  }
+  /* libraries resolve by themselves */
+  if(dlsym(RTLD_DEFAULT, name) == val) {
+    return;
+  }
+  /* log for debugging */
+  if(c->verbosity >= 3) {
+    fprintf(stderr, "Registering symbol %s as %p\n", name, val);
+  }
+  /* add the symbol */
+  if(t->count >= t->nbuckets) {
+    cplr_symtab_grow(t);
+  }
+  s = cext_malloc(sizeof(cplr_sym_t) + len + 1);
+  memcpy(s->name, name, len + 1);
+  s->hash = hash;
+  s->val = val;
+  s->owner = c;
+  s->mark = -1;
+  s->next = t->buckets[hash & (t->nbuckets - 1)];
+  t->buckets[hash & (t->nbuckets - 1)] = s;
+  t->count++;
+  c->sym_owned++;
+}
+
+void cplr_symtab_learn(cplr_t *p) {
+  if(p->sym_learned || !p->tcc || !(p->flag & CPLR_FLAG_LOADED)) {
+    return;
+  }
+  cplr_symtab_get(p);
+  /* addresses are only known after relocation */
+  if(!(p->flag & CPLR_FLAG_RELOCATED)) {
+    double begin = cplr_clock();
+    if(tcc_relocate(p->tcc, TCC_RELOCATE_AUTO) < 0) {
+      return;
+    }
+    p->flag |= CPLR_FLAG_RELOCATED;
+    cplr_stats_phase(p, CPLR_PHASE_RELOCATE, begin);
+  }
+  tcc_list_symbols(p->tcc, p, &cplr_symtab_learn_cb);
+  p->sym_learned = true;
+}
+
+static void cplr_symtab_depend(cplr_t *c, cplr_t *owner) {
+  size_t i;
+  if(owner == c) {
+    return;
+  }
+  for(i = 0; i < c->sym_ndeps; i++) {
+    if(c->sym_deps[i] == owner) {
+      return;
+    }
+  }
+  /* grow in powers of two */
+  if(!c->sym_deps) {
+    c->sym_deps = cext_malloc(4 * sizeof(cplr_t*));
+  } else if(c->sym_ndeps >= 4 && !(c->sym_ndeps & (c->sym_ndeps - 1))) {
+    c->sym_deps = cext_realloc(c->sym_deps, 2 * c->sym_ndeps * sizeof(cplr_t*));
+  }
+  c->sym_deps[c->sym_ndeps++] = owner;
+  owner->sym_users++;
+}
+
+void cplr_symtab_release(cplr_t *c) {
+  size_t i;
+  for(i = 0; i < c->sym_ndeps; i++) {
+    c->sym_deps[i]->sym_users--;
+  }
+  cext_lptrfree((void**)&c->sym_deps);
+  c->sym_ndeps = 0;
+}
+
+static void cplr_symtab_import(cplr_t *c, cplr_symtab_t *t,
+                               const char *name, size_t len) {
+  uint64_t hash = cplr_symtab_hash(name, len);
+  cplr_sym_t *s = cplr_symtab_find(t, name, len, hash);
+  if(!s) {
+    c->sym_misses++;
+    t->misses++;
+    return;
+  }
+  c->sym_hits++;
+  t->hits++;
+  /* import each symbol only once */
+  if(s->mark == c->c_index) {
+    return;
+  }
+  s->mark = c->c_index;
+  cplr_symtab_depend(c, s->owner);
+  if(c->verbosity >= 3) {
+    fprintf(stderr, "Importing symbol %s as %p\n", s->name, s->val);
+  }
+  tcc_add_symbol(c->tcc, s->name, s->val);
+}
+
+int cplr_symtab_resolve(cplr_t *c, const char *code) {
+  cplr_symtab_t *t;
+  const char *p = code, *e;
+
+  /* only chained states need this */
+  if(!c->c_prev) {
+    return 0;
+  }
+  t = cplr_symtab_get(c);
+
+  /* enter what the previous state defined */
+  cplr_symtab_learn(c->c_prev);
+  if(!t->count) {
+    return 0;
+  }
+
+  /* import identifiers that name registered symbols */
+  while(*p) {
+    if(*p == '#' && (p == code || p[-1] == '\n')) {
+      /* line markers */
+      p = strchrnul(p, '\n');
+    } else if(p[0] == '/' && p[1] == '*') {
+      /* comments */
+      e = strstr(p + 2, "*/");
+      p = e ? e + 2 : p + strlen(p);
+    } else if(*p == '"' || *p == '\'') {
+      /* string and character literals */
+      for(e = p + 1; *e && *e != *p; e++) {
+        if(*e == '\\' && e[1]) {
+          e++;
+        }
+      }
+      p = *e ? e + 1 : e;
+    } else if(isalpha(*p) || *p == '_') {
+      /* identifiers */
+      for(e = p + 1; isalnum(*e) || *e == '_'; e++);
+      cplr_symtab_import(c, t, p, e - p);
+      p = e;
+    } else if(isdigit(*p)) {
+      /* numbers */
+      for(e = p + 1; isalnum(*e) || *e == '_' || *e == '.'; e++);
+      p = e;
+    } else {
+      p++;
+    }
+  }
+
+  return 0;
+}
+
+void cplr_symtab_report(cplr_t *c) {
+  cplr_symtab_t *t = c->c_first->s_syms;
+  if(!t) {
+    return;
+  }
+  fprintf(stderr, "syms: %zu registered, %lu hits, %lu misses\n",
+          t->count, t->hits, t->misses);
+}
+
 TCCState *cplr_find_syms(cplr_t *c) {
   TCCState *res = NULL;
 
   while(c) {
-    if(c->flag & CPLR_FLAG_LOADED) {
+    if((c->flag & CPLR_FLAG_LOADED) && c->tcc) {
       res = c->tcc;
       break;
     }
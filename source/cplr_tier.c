@@ -0,0 +1,508 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Tiered execution
+ *
+ * With --tiered the program starts right away under TinyCC while the
+ * same code is built by the system compiler in the background. Toplevel
+ * functions are renamed and called through a slot each, so once the
+ * optimized object is loaded their slots are switched over and every
+ * further call enters optimized code. Calls already running finish
+ * where they started.
+ *
+ * The optimized object has its own copy of all data, so only functions
+ * that use no toplevel variables, no statics and no runtime functions,
+ * directly or through other functions of the snippet, are promoted.
+ * Programs with extra sources are not promoted at all, as those would
+ * be linked into the object a second time.
+ */
+
+#include "cplr.h"
+
+#include <sys/wait.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* state waiting for its callback */
+static cplr_t *tier_state = NULL;
+/* slots and names handed over by the program */
+static void *volatile **tier_slots = NULL;
+static const char **tier_names = NULL;
+/* background compilation */
+static pthread_t tier_thread;
+static bool tier_started = false;
+static volatile bool tier_cancel = false;
+static bool tier_cut = false;
+static volatile pid_t tier_pid = 0;
+static char *tier_code = NULL;
+static char *tier_cmd = NULL;
+static char *tier_path = NULL;
+static double tier_begin = 0;
+
+/* keywords never name objects */
+static const char *tier_keywords[] = {
+  "auto", "break", "case", "char", "const", "continue", "default", "do",
+  "double", "else", "enum", "extern", "float", "for", "goto", "if",
+  "inline", "int", "long", "register", "restrict", "return", "short",
+  "signed", "sizeof", "static", "struct", "switch", "typedef", "union",
+  "unsigned", "void", "volatile", "while", "_Bool", "_Thread_local",
+  NULL
+};
+
+static bool cplr_tier_keyword(const char *p, size_t len) {
+  int i;
+  for(i = 0; tier_keywords[i]; i++) {
+    if(strlen(tier_keywords[i]) == len && !strncmp(p, tier_keywords[i], len)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/* find the next identifier, skipping literals */
+static const char *cplr_tier_ident(const char *p, const char *end, size_t *len) {
+  const char *e;
+  char q;
+  while(p < end) {
+    if(*p == '"' || *p == '\'') {
+      q = *p;
+      for(p++; p < end && *p != q; p++) {
+        if(*p == '\\' && p + 1 < end) {
+          p++;
+        }
+      }
+      p++;
+    } else if(isalpha((unsigned char)*p) || *p == '_') {
+      for(e = p + 1; e < end && (isalnum((unsigned char)*e) || *e == '_'); e++);
+      *len = e - p;
+      return p;
+    } else if(isdigit((unsigned char)*p)) {
+      /* suffixes of numbers are no identifiers */
+      while(p < end && (isalnum((unsigned char)*p) || *p == '.' || *p == '_')) {
+        p++;
+      }
+    } else {
+      p++;
+    }
+  }
+  return NULL;
+}
+
+/* check if text calls into our runtime */
+static bool cplr_tier_runtime(const char *p, const char *end) {
+  const char *id;
+  size_t len;
+  char *n;
+  bool found;
+  while((id = cplr_tier_ident(p, end, &len))) {
+    n = cext_strndup(id, len);
+    found = cplr_runtime_defines(n);
+    cext_free(n);
+    if(found) {
+      return true;
+    }
+    p = id + len;
+  }
+  return false;
+}
+
+/* check if text uses one of a set of names */
+static bool cplr_tier_uses(const char *p, const char *end, vh_t *names) {
+  const char *id;
+  value_t *n;
+  size_t len;
+  while((id = cplr_tier_ident(p, end, &len))) {
+    V_FORWARD(names, n) {
+      if(strlen(value_get_str(n)) == len && !strncmp(id, value_get_str(n), len)) {
+        return true;
+      }
+    }
+    p = id + len;
+  }
+  return false;
+}
+
+bool cplr_tier_function(const char *def, size_t *pos, size_t *len, size_t *body) {
+  const char *p, *b = NULL, *e;
+  int depth = 0;
+  /* the body starts at the first brace outside of parentheses */
+  for(p = def; *p; p++) {
+    if(*p == '(') {
+      depth++;
+    } else if(*p == ')') {
+      depth--;
+    } else if(*p == '{' && depth == 0) {
+      b = p;
+      break;
+    } else if(*p == ';' || *p == '=' || *p == '"') {
+      return false;
+    }
+  }
+  if(!b) {
+    return false;
+  }
+  /* the header ends in a parameter list */
+  for(e = b; e > def && isspace((unsigned char)e[-1]); e--);
+  if(e == def || e[-1] != ')') {
+    return false;
+  }
+  for(depth = 0, e--; e >= def; e--) {
+    if(*e == ')') {
+      depth++;
+    } else if(*e == '(' && --depth == 0) {
+      break;
+    }
+  }
+  if(e <= def) {
+    return false;
+  }
+  /* with the name right before it */
+  for(; e > def && isspace((unsigned char)e[-1]); e--);
+  for(p = e; p > def && (isalnum((unsigned char)p[-1]) || p[-1] == '_'); p--);
+  if(p == e || isdigit((unsigned char)*p) || cplr_tier_keyword(p, e - p)) {
+    return false;
+  }
+  /* declarators returning function pointers are left alone */
+  for(b = p; b > def && isspace((unsigned char)b[-1]); b--);
+  if(b > def && b[-1] == '(') {
+    return false;
+  }
+  if(e - p == 4 && !strncmp(p, "main", 4)) {
+    return false;
+  }
+  *pos = p - def;
+  *len = e - p;
+  *body = strchr(def + *pos, '{') - def;
+  return true;
+}
+
+/* remember names declared by a toplevel declaration */
+static void cplr_tier_objects(vh_t *objs, vh_t *funs, const char *d) {
+  const char *id, *end = d + strlen(d);
+  size_t len;
+  while(isspace((unsigned char)*d)) {
+    d++;
+  }
+  if(strprefix(d, "typedef")) {
+    return;
+  }
+  /* anything named might be an object, skip initializers */
+  while((id = cplr_tier_ident(d, end, &len))) {
+    if(!cplr_tier_keyword(id, len)) {
+      /* prototypes of our functions are no objects */
+      char *o = cext_strndup(id, len);
+      if(v_find_str(funs, o)) {
+        cext_free(o);
+      } else {
+        v_append_str_owned(objs, o);
+      }
+    }
+    d = id + len;
+    if(*d == '=' || (*d == ' ' && d[1] == '=')) {
+      for(; d < end && *d != ',' && *d != ';'; d++);
+    }
+  }
+}
+
+bool *cplr_tier_select(cplr_t *c) {
+  size_t pos, len, body, n = v_size(&c->tlfs), i = 0;
+  bool *sel, *fun, changed, any = false;
+  const char *d, **name;
+  vh_t objs, funs, rejected;
+  value_t *v;
+
+  /* extra sources would exist twice */
+  if(!v_empty(&c->srcs)) {
+    if(c->verbosity >= 1) {
+      fprintf(stderr, "Tier: program has extra sources, not promoted\n");
+    }
+    return NULL;
+  }
+
+  sel = cext_calloc(n + 1, sizeof(bool));
+  fun = cext_calloc(n + 1, sizeof(bool));
+  name = cext_calloc(n + 1, sizeof(char*));
+  v_init(&objs);
+  v_init(&funs);
+  v_init(&rejected);
+
+  /* sort toplevel things into functions and objects */
+  V_FORWARD(&c->tlfs, v) {
+    d = value_get_str(v);
+    if(cplr_tier_function(d, &pos, &len, &body)) {
+      fun[i] = sel[i] = true;
+      name[i] = cext_strndup(d + pos, len);
+      v_append_str_static(&funs, name[i]);
+    }
+    i++;
+  }
+  i = 0;
+  V_FORWARD(&c->tlfs, v) {
+    if(!fun[i++]) {
+      cplr_tier_objects(&objs, &funs, value_get_str(v));
+    }
+  }
+  V_FORWARD(&c->tlds, v) {
+    cplr_tier_objects(&objs, &funs, value_get_str(v));
+  }
+
+  /* functions touching data stay where the data is */
+  i = 0;
+  V_FORWARD(&c->tlfs, v) {
+    d = value_get_str(v);
+    if(fun[i]) {
+      cplr_tier_function(d, &pos, &len, &body);
+      if(cplr_tier_uses(d + body, d + strlen(d), &objs)
+         || cplr_tier_runtime(d + body, d + strlen(d))
+         || strstr(d + body, "static")) {
+        sel[i] = false;
+        v_append_str_static(&rejected, name[i]);
+      }
+    }
+    i++;
+  }
+  /* and so do their callers */
+  do {
+    changed = false;
+    i = 0;
+    V_FORWARD(&c->tlfs, v) {
+      d = value_get_str(v);
+      if(sel[i]) {
+        cplr_tier_function(d, &pos, &len, &body);
+        if(cplr_tier_uses(d + body, d + strlen(d), &rejected)) {
+          sel[i] = false;
+          v_append_str_static(&rejected, name[i]);
+          changed = true;
+        }
+      }
+      i++;
+    }
+  } while(changed);
+
+  /* report */
+  for(i = 0; i < n; i++) {
+    if(sel[i]) {
+      any = true;
+    } else if(fun[i] && c->verbosity >= 1) {
+      fprintf(stderr, "Tier: %s uses toplevel data or the runtime, not promoted\n", name[i]);
+    }
+  }
+
+  for(i = 0; i < n; i++) {
+    cext_lfree((void*)name[i]);
+  }
+  cext_free(name);
+  cext_free(fun);
+  v_clear(&objs);
+  v_clear(&funs);
+  v_clear(&rejected);
+  if(!any) {
+    cext_free(sel);
+    return NULL;
+  }
+  return sel;
+}
+
+/* build the optimized object, then switch the slots over */
+static void cplr_tier_build(cplr_t *c) {
+  void (*pipesig)(int);
+  const char **names;
+  void **impls;
+  char *done = NULL;
+  size_t len = 0, off = 0;
+  ssize_t w;
+  int fds[2], rc, i, n = 0;
+  FILE *f;
+  void *dl;
+  pid_t p;
+
+  /* the compiler reads the code from a pipe */
+  if(tier_cancel || pipe(fds)) {
+    tier_cut = tier_cancel;
+    unlink(tier_path);
+    return;
+  }
+  p = fork();
+  if(p < 0) {
+    close(fds[0]);
+    close(fds[1]);
+    unlink(tier_path);
+    return;
+  }
+  if(p == 0) {
+    /* in a group of its own so that it can be stopped as one */
+    setpgid(0, 0);
+    dup2(fds[0], 0);
+    close(fds[0]);
+    close(fds[1]);
+    execl("/bin/sh", "sh", "-c", tier_cmd, (char*)NULL);
+    _exit(127);
+  }
+  /* both sides, or an early kill could miss the group */
+  setpgid(p, p);
+  tier_pid = p;
+  close(fds[0]);
+  pipesig = signal(SIGPIPE, SIG_IGN);
+  len = strlen(tier_code);
+  while(off < len && !tier_cancel) {
+    w = write(fds[1], tier_code + off, len - off);
+    if(w < 0 && errno == EINTR) {
+      continue;
+    }
+    if(w <= 0) {
+      break;
+    }
+    off += w;
+  }
+  close(fds[1]);
+  signal(SIGPIPE, pipesig);
+  while(waitpid(p, &rc, 0) < 0 && errno == EINTR);
+  tier_pid = 0;
+  if(tier_cancel || !WIFEXITED(rc) || WEXITSTATUS(rc)) {
+    unlink(tier_path);
+    if(tier_cancel) {
+      tier_cut = true;
+    } else {
+      fprintf(stderr, "Tier: optimized build failed\n");
+    }
+    return;
+  }
+
+  /* load, then publish every function we know */
+  dl = dlopen(tier_path, RTLD_NOW|RTLD_LOCAL);
+  unlink(tier_path);
+  if(!dl) {
+    fprintf(stderr, "Tier: failed to load optimized code: %s\n", dlerror());
+    return;
+  }
+  names = dlsym(dl, "__cplr_tier_names");
+  impls = dlsym(dl, "__cplr_tier_impls");
+  if(!names || !impls) {
+    fprintf(stderr, "Tier: optimized code has no function table\n");
+    dlclose(dl);
+    return;
+  }
+  if(tier_cancel) {
+    tier_cut = true;
+    dlclose(dl);
+    return;
+  }
+  f = open_memstream(&done, &len);
+  for(i = 0; tier_names[i] && names[i]; i++) {
+    if(strcmp(tier_names[i], names[i])) {
+      break;
+    }
+    __atomic_store_n(tier_slots[i], impls[i], __ATOMIC_RELEASE);
+    fprintf(f, "%s%s", n++ ? ", " : "", names[i]);
+  }
+  fclose(f);
+  /* the object stays, slots point into it until we exit */
+  if(n && c->verbosity >= 1) {
+    fprintf(stderr, "Tier: promoted %s after %.2fms\n", done, cplr_clock() - tier_begin);
+  }
+  cext_lfree(done);
+  return;
+}
+
+static void *cplr_tier_main(void *arg) {
+  cplr_tier_build(arg);
+  return NULL;
+}
+
+static void cplr_tier_atexit(void) {
+  if(tier_state) {
+    cplr_tier_finish(tier_state);
+  }
+}
+
+/* called by the program as main starts */
+static void cplr_tier_hook(void *volatile **slots, const char **names) {
+  static bool registered = false;
+  const char *tmpdir = getenv("TMPDIR");
+  cplr_t *c = tier_state;
+  int fd;
+
+  if(!c || tier_started) {
+    return;
+  }
+  tier_begin = cplr_clock();
+  tier_slots = slots;
+  tier_names = names;
+  tier_cancel = false;
+  tier_cut = false;
+
+  /* the optimized object takes the place of a loaded one */
+  tier_path = msprintf("%s/cplr-XXXXXX.so", (tmpdir && *tmpdir) ? tmpdir : "/tmp");
+  fd = mkstemps(tier_path, 3);
+  if(fd < 0) {
+    fprintf(stderr, "Tier: failed to create temporary file %s\n", tier_path);
+    cext_ptrfree((void**)&tier_path);
+    return;
+  }
+  close(fd);
+  tier_code = cext_strdup(c->g_codebuf);
+  tier_cmd = cplr_cc_cmdline(c, tier_path);
+  if(c->verbosity >= 2) {
+    fprintf(stderr, "Running \"%s\" in the background\n", tier_cmd);
+  }
+
+  /* a program that exits on its own must not leave a compiler behind */
+  if(!registered) {
+    atexit(cplr_tier_atexit);
+    registered = true;
+  }
+  if(pthread_create(&tier_thread, NULL, cplr_tier_main, c)) {
+    fprintf(stderr, "Tier: failed to start background compilation\n");
+    unlink(tier_path);
+    return;
+  }
+  tier_started = true;
+}
+
+void cplr_tier_define(cplr_t *c) {
+  tier_state = c;
+  tcc_add_symbol(c->tcc, "__cplr_tier", cplr_tier_hook);
+}
+
+void cplr_tier_finish(cplr_t *c) {
+  pid_t p;
+  if(!tier_started) {
+    return;
+  }
+  /* stop a compiler still working */
+  tier_cancel = true;
+  p = tier_pid;
+  if(p > 0) {
+    kill(-p, SIGTERM);
+  }
+  pthread_join(tier_thread, NULL);
+  tier_started = false;
+  /* only a build stopped by us counts as unfinished */
+  if(tier_cut && c->verbosity >= 1) {
+    fprintf(stderr, "Tier: finished before optimized code was ready\n");
+  }
+  cext_ptrfree((void**)&tier_path);
+  cext_ptrfree((void**)&tier_code);
+  cext_ptrfree((void**)&tier_cmd);
+}
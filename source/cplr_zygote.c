@@ -0,0 +1,164 @@
+/*
+ * cplr - Utility for running C code
+ *
+ * Copyright (C) 2020-2021 Ingo Albrecht <copyright@promovicz.org>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Zygote execution
+ *
+ * The program runs its before statements once and then calls back
+ * into cplr, which keeps the initialized process as a zygote and
+ * forks a child for every further run:
+ *
+ *  - interactive lines are compiled against the zygote and each
+ *    runs in a child of it,
+ *  - server workers are forked from it and run the statements
+ *    with the arguments of their request.
+ *
+ * Children return from the callback and continue with the statements
+ * and after statements of the program. The zygote itself skips the
+ * statements and only runs the after statements once it is done.
+ */
+
+#include "cplr.h"
+
+#include <sys/wait.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/* state waiting for its callback */
+static cplr_t *zygote_state = NULL;
+/* set in forked children */
+static bool zygote_ischild = false;
+/* arguments for the child, replacing those of the zygote */
+static int zygote_argc = 0;
+static char **zygote_argv = NULL;
+
+/* fork a child running the statements of the zygote */
+static int cplr_zygote_fork(cplr_t *c) {
+  pid_t p, rp;
+  int rc;
+  fflush(NULL);
+  p = fork();
+  if(p < 0) {
+    fprintf(stderr, "Error: Failed to fork\n");
+    return -1;
+  }
+  if(p == 0) {
+    zygote_ischild = true;
+    return 0;
+  }
+  do {
+    rp = waitpid(p, &rc, 0);
+    if(rp < 0 && errno != EINTR) {
+      fprintf(stderr, "Error: Failed to wait for child\n");
+      return -1;
+    }
+  } while(rp != p);
+  if(c->verbosity >= 1) {
+    fprintf(stderr, "Child has returned\n");
+  }
+  return p;
+}
+
+/* called by the program after its before statements */
+static int cplr_zygote_hook(int *argc, char ***argv, int *ret) {
+  cplr_t *c = zygote_state;
+
+  /* only the zygote itself serves */
+  if(!c || zygote_ischild) {
+    return 0;
+  }
+  zygote_state = NULL;
+
+  if(c->verbosity >= 1) {
+    fprintf(stderr, "Zygote ready\n");
+  }
+
+  /* fork server workers from here */
+  if(c->server) {
+    *ret = cplr_serve(c);
+    if(zygote_ischild) {
+      /* worker with a request to run */
+      *argc = zygote_argc;
+      *argv = zygote_argv;
+      return 0;
+    }
+    return 1;
+  }
+
+  /* fork interactive lines from here */
+  if(c->flag & CPLR_FLAG_INTERACTIVE) {
+    /* statements of the command line run first */
+    if(!v_empty(&c->stms) || !v_empty(&c->afts) || !v_empty(&c->fins)) {
+      if(cplr_zygote_fork(c) == 0) {
+        return 0;
+      }
+    }
+    /* chained states inherit the flag */
+    c->flag |= CPLR_FLAG_FORK;
+    *ret = cplr_interact(c);
+    return 1;
+  }
+
+  /* a single run has nothing to fork for */
+  return 0;
+}
+
+bool cplr_zygote_enabled(cplr_t *c) {
+  if(!(c->flag & CPLR_FLAG_ZYGOTE)) {
+    return false;
+  }
+  /* only for in-memory runs of the first state */
+  if(c->backend != CPLR_BACKEND_LIBTCC) {
+    return false;
+  }
+  return !c->out && !c->c_prev;
+}
+
+bool cplr_zygote_child(void) {
+  return zygote_ischild;
+}
+
+void cplr_zygote_define(cplr_t *c) {
+  tcc_add_symbol(c->tcc, "__cplr_zygote", cplr_zygote_hook);
+}
+
+void cplr_zygote_request(int argc, char **argv) {
+  int i, skip = 0;
+  /* the program is ours, the client only brings arguments */
+  if(argc > 1 && !strcmp(argv[1], "--")) {
+    skip = 1;
+  }
+  zygote_argc = argc - skip;
+  zygote_argv = cext_calloc(zygote_argc + 1, sizeof(char*));
+  zygote_argv[0] = "c";
+  for(i = 1; i < zygote_argc; i++) {
+    zygote_argv[i] = argv[i + skip];
+  }
+  zygote_ischild = true;
+}
+
+int cplr_zygote(cplr_t *c) {
+  if(!cplr_zygote_enabled(c)) {
+    fprintf(stderr, "Error: Zygote needs an in-memory run\n");
+    return 1;
+  }
+  zygote_state = c;
+  return cplr_run(c);
+}
@@ -0,0 +1 @@
+../cplr -dnvv --backend=cc -t 'static int sq(int x) { return x * x; }' 'return sq(7)'
@@ -0,0 +1 @@
+../cplr -nv --backend=cc -t 'static int sq(int x) { return x * x; }' 'return sq(7)'
@@ -0,0 +1 @@
+49
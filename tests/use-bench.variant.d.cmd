@@ -0,0 +1 @@
+(set -o pipefail; ../cplr -d --bench -b 'volatile int x = 0' 'x++' 2>&1 | sed -E -e '/^bench:/s/ of [0-9]+ / of # /' -e '/^  min /s/ [0-9]+(\.[0-9]+)?/ #/g')
@@ -0,0 +1,12 @@
+run() ( set -o pipefail; env -u CPLR_NOCACHE -u CPLR_CACHE_DIR XDG_CACHE_HOME="${cache}" ../cplr -i stdint.h "$1" -dnpv -- 2>&1 | sed -E -e "s|${cache}|@cache|g" -e 's/ [0-9a-f]{16}/ #/g' )
+cache="$(mktemp -d)"
+echo "Cold run:"
+run 'printf("%d\n", INT8_MAX)'
+ret=$?
+echo "Warm run, same headers:"
+run 'printf("%d\n", INT16_MAX)' || ret=$?
+echo "Warm run, same code:"
+run 'printf("%d\n", INT8_MAX)' || ret=$?
+ls "${cache}/cplr"
+rm -rf "${cache}"
+(exit ${ret})
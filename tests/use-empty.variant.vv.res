@@ -1 +1 @@
-0
+1
@@ -0,0 +1 @@
+seq 1 30000 | ../cplr -dpv --lines --jobs 4 -t 'long total; int threads' -b 'long n = 0' 'n += atol(line)' -a 'total += n; threads++' --final 'printf("%ld in %d threads\n", total, threads)'
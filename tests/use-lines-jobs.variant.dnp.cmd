@@ -0,0 +1 @@
+seq 1 30000 | ../cplr -dnp --lines --jobs 4 'if(atol(line) % 5000 == 0) puts(line)'
@@ -0,0 +1 @@
+../cplr --lines -b 'size_t n = 0' 'n += len' 'printf("%ld %zu %s\n", nr, len, line)' -a 'printf("%zu bytes\n", n)'
@@ -0,0 +1 @@
+cat | ../cplr -dnp --lines -b 'size_t n = 0' 'n += len' 'printf("%ld %zu %s\n", nr, len, line)' -a 'printf("%zu bytes\n", n)'
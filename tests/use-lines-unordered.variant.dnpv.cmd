@@ -0,0 +1,8 @@
+run() { ../cplr -dnpv --lines --jobs 4 --unordered 'if(atol(line) % 5000 == 0) puts(line)' -- "$@"; }
+in="${TMPDIR:-/tmp}/use-lines-unordered.$$"
+seq 1 30000 > "${in}"
+run "${in}" > "${in}.out"
+ret=$?
+sort -n "${in}.out"
+rm -f "${in}" "${in}.out"
+(exit ${ret})
@@ -0,0 +1,2 @@
+../cplr -t 'int answer(void) { return 42; }' -o "${TMPDIR:-/tmp}/use-output-dll.so" -d
+../cplr -i dlfcn.h -l dl 'void *h = dlopen("'"${TMPDIR:-/tmp}"'/use-output-dll.so", RTLD_NOW)' 'int (*f)(void) = dlsym(h, "answer")' 'ret = f()'
@@ -0,0 +1,2 @@
+../cplr -t 'int answer(void) { return 42; }' 'ret = answer()' -o "${TMPDIR:-/tmp}/use-output-exe" -d
+"${TMPDIR:-/tmp}/use-output-exe"
@@ -0,0 +1,2 @@
+../cplr -t 'int answer(void) { return 42; }' 'ret = answer()' -o "${TMPDIR:-/tmp}/use-output-exe" -dn
+"${TMPDIR:-/tmp}/use-output-exe"
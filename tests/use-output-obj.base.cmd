@@ -0,0 +1,3 @@
+../cplr -t 'int answer(void) { return 42; }' 'ret = answer()' -o "${TMPDIR:-/tmp}/use-output-obj.o"
+cc -o "${TMPDIR:-/tmp}/use-output-obj" "${TMPDIR:-/tmp}/use-output-obj.o"
+"${TMPDIR:-/tmp}/use-output-obj"
@@ -0,0 +1,2 @@
+../cplr -D ANSWER=42 'ret = ANSWER' -o "${TMPDIR:-/tmp}/use-output-preprocess.i" -dpv
+grep -o 'ret = 42' "${TMPDIR:-/tmp}/use-output-preprocess.i"
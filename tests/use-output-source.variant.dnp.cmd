@@ -0,0 +1 @@
+../cplr -t 'int answer(void) { return 42; }' 'ret = answer()' -o - -dnp
@@ -0,0 +1,8 @@
+run() { ../cplr -dnpv --profile="${out}" -t 'long fib(long n) { return n < 2 ? n : fib(n - 1) + fib(n - 2); }' 'printf("%ld\n", fib(34))' -- "$@"; }
+out="${TMPDIR:-/tmp}/use-profile.$$.folded"
+run 2> "${out}.err"
+ret=$?
+sed -E -e "s|${out}|@.folded|" -e '/^profile:/s/[0-9]+/#/g' -e '/^ +[0-9.]+% +[0-9]+  (fib|statements_0)$/s/ +[0-9]+(\.[0-9]+)?/ #/g' -e '/^ +[0-9.]+% /d' "${out}.err"
+grep -q ';fib[; ]' "${out}" 2> /dev/null && echo "fib sampled"
+rm -f "${out}" "${out}.err"
+(exit ${ret})
@@ -0,0 +1,9 @@
+run() { CPLR_SERVER="${sock}" ../cplr "$@" -dnp --; }
+sock="${TMPDIR:-/tmp}/use-server.$$.sock"
+../cplr "--server=${sock}" &
+while [ ! -S "${sock}" ]; do sleep 0.1; done
+run 'puts("Hello from a worker.")'
+ret=$?
+kill $!
+wait
+(exit ${ret})
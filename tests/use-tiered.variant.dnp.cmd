@@ -0,0 +1 @@
+../cplr -dnp --tiered -i stdio.h -i unistd.h -t 'int n;' -t 'int count(void) { return ++n; }' -t 'int sq(int x) { return x * x; }' 'count()' 'for(int i = 0; i < 30000 && __cplr_tier_sq == (void *)__cplr_tier0_sq; i++) usleep(1000)' 'printf("%d %d %s\n", sq(7), count(), __cplr_tier_sq != (void *)__cplr_tier0_sq ? "promoted" : "not promoted")'
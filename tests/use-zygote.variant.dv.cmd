@@ -0,0 +1 @@
+../cplr -dv --zygote -b 'int n = 6' -b 'n *= 7' 'printf("%d\n", n)'
@@ -0,0 +1 @@
+../cplr -pvv --zygote -b 'int n = 6' -b 'n *= 7' 'printf("%d\n", n)'